@@ -0,0 +1,523 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include "common/defs.h"
+#include "common/job_system.h"
+#include "common/json.h"
+#include "opengl/bvh.h"
+#include "opengl/tlas.h"
+#include "opengl/wide_bvh.h"
+#include "cpu/common/data.h"
+#include "cpu/common/intersect.h"
+#include "cpu/common/packet.h"
+#include "cpu/common/sampling.h"
+#include "scenes.h"
+
+#ifndef FART_RESOURCE_DIR
+#define FART_RESOURCE_DIR "resources"
+#endif
+
+using namespace fart;
+
+/*
+ * Builds acceleration structures for procedural scenes and the teapot with every
+ * selected split method, then traces primary, diffuse bounce and incoherent rays
+ * through them with the CPU kernels. Results go to stdout and a JSON report.
+ */
+
+// Cost constants of the reported SAH cost, relative to one triangle test
+constexpr float SAH_TRAVERSAL_COST = 1.f;
+constexpr float SAH_INTERSECTION_COST = 1.f;
+
+struct CmdArgs {
+    std::string out { "fart_bench.json" };
+    std::string teapot { FART_RESOURCE_DIR "/teapot.obj" };
+    bool quick { false };
+    BVHLayout layout { BVHLayout::DFS };
+    TriangleLayout triangle_layout { TriangleLayout::Indexed };
+    std::vector<BVHSplitMethod> split_methods { BVHSplitMethod::SAH, BVHSplitMethod::LBVH, BVHSplitMethod::HLBVH, BVHSplitMethod::SBVH };
+};
+
+struct BuildStats {
+    double blas_build_ms { 0. };
+    double tlas_build_ms { 0. };
+    size_t triangles { 0 };
+    size_t blas_nodes { 0 };
+    size_t tlas_nodes { 0 };
+    // Triangle weighted mean over all objects, measured on the binary BVHs
+    double sah_cost { 0. };
+    double duplication_factor { 1. };
+    size_t vertex_bytes { 0 };
+    size_t index_bytes { 0 };
+    size_t triangle_bytes { 0 };
+    size_t blas_bytes { 0 };
+    size_t tlas_bytes { 0 };
+    // Refit after moving every instance, and a build over the moved instances for reference
+    double tlas_refit_ms { 0. };
+    double tlas_rebuild_ms { 0. };
+};
+
+struct TraceStats {
+    std::string ray_type;
+    size_t rays { 0 };
+    uint32_t hits { 0 };
+    double rays_per_second { 0. };
+};
+
+struct Accel {
+    std::vector<glm::vec3> positions;
+    std::vector<VertexAttributes> attributes;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> triangle_materials;
+    std::vector<TrianglePositions> triangles;
+    std::vector<BLASNode> blas;
+    std::vector<BLASInfo> blas_info;
+    std::unique_ptr<TLAS> tlas;
+    std::vector<glm::mat4> instance_to_world;
+    std::vector<uint32_t> material_flags;
+    SceneData data;
+};
+
+static void
+parseCmdArgs(int argc, char** argv, CmdArgs& args) {
+    int ac = 1;
+    while (ac < argc) {
+        std::string arg = argv[ac];
+        bool has_value = ac + 1 < argc;
+        if (arg == "--quick") {
+            args.quick = true;
+        } else if (arg == "--out" && has_value) {
+            args.out = argv[++ac];
+        } else if (arg == "--teapot" && has_value) {
+            args.teapot = argv[++ac];
+        } else if (arg == "--layout" && has_value) {
+            std::string layout = argv[++ac];
+            if (layout == "dfs") args.layout = BVHLayout::DFS;
+            else if (layout == "treelet") args.layout = BVHLayout::Treelet;
+            else throw std::runtime_error("Unknown layout " + layout);
+        } else if (arg == "--triangles" && has_value) {
+            std::string layout = argv[++ac];
+            if (layout == "indexed") args.triangle_layout = TriangleLayout::Indexed;
+            else if (layout == "precomputed") args.triangle_layout = TriangleLayout::Precomputed;
+            else throw std::runtime_error("Unknown triangle layout " + layout);
+        } else if (arg == "--split" && has_value) {
+            // Comma separated list of split methods
+            args.split_methods.clear();
+            std::stringstream list(argv[++ac]);
+            for (std::string name; std::getline(list, name, ',');) {
+                bool found = false;
+                for (BVHSplitMethod split_method : { Equal, SAH, LBVH, HLBVH, SBVH }) {
+                    if (name == splitMethodName(split_method)) {
+                        args.split_methods.push_back(split_method);
+                        found = true;
+                    }
+                }
+                if (!found) throw std::runtime_error("Unknown split method " + name);
+            }
+        } else {
+            throw std::runtime_error("Unknown argument " + arg);
+        }
+        ac += 1;
+    }
+}
+
+// Rays or packets traced per job
+static constexpr size_t CHUNK_SIZE = 4096;
+
+static double
+sahCost(BVH& bvh) {
+    std::vector<BVHNode>& nodes = bvh.getNodes();
+    float root_area = nodes[0].aabb.surfaceArea();
+    if (root_area <= 0.f) return 0.;
+
+    double cost = 0.;
+    for (size_t i = 0; i < bvh.getNodesUsed(); i++) {
+        const BVHNode& node = nodes[i];
+        if (node.left_child == 0) {
+            cost += SAH_INTERSECTION_COST * node.tri_count * node.aabb.surfaceArea();
+        } else {
+            cost += SAH_TRAVERSAL_COST * node.aabb.surfaceArea();
+        }
+    }
+    return cost / root_area;
+}
+
+static double
+millisecondsSince(std::chrono::high_resolution_clock::time_point t_start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t_start).count();
+}
+
+// Mirrors the acceleration structure setup of the renderers
+static BuildStats
+buildAccel(BenchScene& scene, BVHSplitMethod split_method, BVHLayout layout, TriangleLayout triangle_layout, Accel& accel) {
+    BuildStats stats;
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+    std::vector<AligendVertex> vertices;
+    std::vector<BVH> bvhs = BVH::buildAll(scene.objects, vertices, accel.indices, split_method);
+    std::vector<BLASInfo>& blas_info = accel.blas_info;
+    for (auto& bvh : bvhs) {
+        bvh.reorderNodes(layout);
+#if BVH_WIDTH > 2
+        WideBVH blas(bvh);
+#else
+        BVH& blas = bvh;
+#endif
+        std::vector<BLASNode>& nodes = blas.getNodes();
+        accel.blas.insert(accel.blas.end(), nodes.begin(), nodes.begin() + blas.getNodesUsed());
+        blas_info.push_back({ bvh.getNodes()[0].aabb, (uint32_t)blas.getNodesUsed() });
+    }
+    stats.blas_build_ms = millisecondsSince(t_start);
+
+    size_t references = 0;
+    for (size_t i = 0; i < bvhs.size(); i++) {
+        size_t triangles = 0;
+        for (auto& geometry : scene.objects[i].geometries)
+            triangles += geometry.indices.size() / 3;
+        stats.triangles += triangles;
+        stats.sah_cost += sahCost(bvhs[i]) * triangles;
+        references += bvhs[i].getIndexCount() / 3;
+    }
+    if (stats.triangles > 0) {
+        stats.sah_cost /= stats.triangles;
+        stats.duplication_factor = (double)references / stats.triangles;
+    }
+
+    t_start = std::chrono::high_resolution_clock::now();
+    accel.tlas = std::make_unique<TLAS>(scene.instances, blas_info);
+    accel.tlas->reorderNodes(layout);
+    stats.tlas_build_ms = millisecondsSince(t_start);
+
+    for (auto& instance : accel.tlas->getInstances())
+        accel.instance_to_world.push_back(glm::inverse(instance.world_to_instance));
+
+    stats.blas_nodes = accel.blas.size();
+    stats.tlas_nodes = accel.tlas->getNodesUsed();
+    splitVertices(vertices, accel.indices, accel.positions, accel.attributes, accel.triangle_materials);
+    reorderVertices(accel.indices, accel.positions, accel.attributes);
+    if (triangle_layout == TriangleLayout::Precomputed)
+        accel.triangles = precomputeTriangles(accel.indices, accel.positions);
+    stats.vertex_bytes = accel.positions.size() * (sizeof(glm::vec3) + sizeof(VertexAttributes));
+    stats.index_bytes = accel.indices.size() * sizeof(uint32_t);
+    stats.triangle_bytes = accel.triangles.size() * sizeof(TrianglePositions);
+    stats.blas_bytes = accel.blas.size() * sizeof(BLASNode);
+    stats.tlas_bytes = stats.tlas_nodes * sizeof(TLASNode);
+
+    accel.data.scene_scale = 1.f;
+    accel.data.positions = accel.positions.data();
+    accel.data.attributes = accel.attributes.data();
+    accel.data.indices = accel.indices.data();
+    accel.data.triangle_materials = accel.triangle_materials.data();
+    accel.data.triangles = accel.triangles.empty() ? nullptr : accel.triangles.data();
+    accel.data.bvh = accel.blas.data();
+    accel.data.tlas = accel.tlas->getNodes().data();
+    accel.data.blas_offsets = accel.tlas->getBLASOffsets().data();
+    accel.data.instances = accel.tlas->getInstances().data();
+    accel.data.instance_to_world = accel.instance_to_world.data();
+    accel.data.materials = scene.materials.data();
+    // Benchmark scenes are untextured, so every material is opaque
+    accel.material_flags.assign(scene.materials.size(), 0u);
+    accel.data.material_flags = accel.material_flags.data();
+    accel.data.textures = nullptr;
+    accel.data.ggx_albedo = nullptr;
+
+    return stats;
+}
+
+static Ray
+makeRay(glm::vec3 o, glm::vec3 d) {
+    Ray ray;
+    ray.o = o;
+    ray.d = glm::normalize(d);
+    ray.rD = 1.f / ray.d;
+    ray.t = 1e30f;
+    return ray;
+}
+
+// Pinhole camera with a 45 degree field of view, looking at the center of the scene from above
+static std::vector<Ray>
+primaryRays(const AABB& bounds, uint32_t resolution) {
+    glm::vec3 center = bounds.centroid();
+    float radius = glm::length(bounds.extent()) * .5f;
+    glm::vec3 eye = center + glm::normalize(glm::vec3(-1.f, .8f, -1.3f)) * radius * 2.2f;
+    glm::vec3 dir = glm::normalize(center - eye);
+    glm::vec3 right = glm::normalize(glm::cross(dir, glm::vec3(0.f, 1.f, 0.f)));
+    glm::vec3 up = glm::cross(right, dir);
+    float scale = 2.f * std::tan(glm::pi<float>() / 8.f);
+
+    std::vector<Ray> rays;
+    rays.reserve((size_t)resolution * resolution);
+    for (uint32_t y = 0; y < resolution; y++) {
+        for (uint32_t x = 0; x < resolution; x++) {
+            glm::vec2 d = (glm::vec2(x + .5f, y + .5f) / (float)resolution - .5f) * scale;
+            rays.push_back(makeRay(eye, dir + d.x * right + d.y * up));
+        }
+    }
+    return rays;
+}
+
+// One cosine distributed bounce from every primary hit
+static std::vector<Ray>
+diffuseRays(const SceneData& data, const AABB& bounds, const std::vector<Ray>& primary) {
+    float offset = 1e-4f * glm::length(bounds.extent());
+    std::vector<Ray> rays(primary.size());
+    std::vector<uint8_t> valid(primary.size(), 0);
+
+    parallelFor(0, primary.size(), CHUNK_SIZE, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            SurfaceInteraction si = intersect(data, primary[i]);
+            if (!si.valid) continue;
+
+            std::mt19937 rng(i);
+            std::uniform_real_distribution<float> uniform(0.f, 1.f);
+            glm::vec2 u(uniform(rng), uniform(rng));
+            rays[i] = makeRay(si.p + offset * si.n, randomCosineHemispherePoint(u, si.n));
+            valid[i] = 1;
+        }
+    });
+
+    std::vector<Ray> bounces;
+    for (size_t i = 0; i < rays.size(); i++) {
+        if (valid[i]) bounces.push_back(rays[i]);
+    }
+    return bounces;
+}
+
+// Rays from random points in the scene bounds into random directions
+static std::vector<Ray>
+incoherentRays(const AABB& bounds, uint32_t count) {
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+
+    std::vector<Ray> rays;
+    rays.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        glm::vec3 o = bounds.min + glm::vec3(uniform(rng), uniform(rng), uniform(rng)) * bounds.extent();
+        glm::vec3 d = glm::vec3(uniform(rng), uniform(rng), uniform(rng)) - .5f;
+        rays.push_back(makeRay(o, d));
+    }
+    return rays;
+}
+
+// One warm up pass, then keeps the best of three
+static TraceStats
+trace(const SceneData& data, const std::vector<Ray>& rays, const std::string& ray_type) {
+    TraceStats stats;
+    stats.ray_type = ray_type;
+    stats.rays = rays.size();
+
+    for (int run = 0; run < 4; run++) {
+        std::atomic<uint32_t> hit_count { 0 };
+        auto t_start = std::chrono::high_resolution_clock::now();
+        parallelFor(0, rays.size(), CHUNK_SIZE, [&](size_t first, size_t last) {
+            uint32_t local_hits = 0;
+            for (size_t i = first; i < last; i++)
+                local_hits += intersect(data, rays[i]).valid;
+            hit_count += local_hits;
+        });
+        double seconds = millisecondsSince(t_start) / 1000.;
+
+        stats.hits = hit_count;
+        if (run > 0 && seconds > 0.)
+            stats.rays_per_second = std::max(stats.rays_per_second, rays.size() / seconds);
+    }
+    return stats;
+}
+
+// Same as trace, but rays of a resolution squared image traverse as packets of RayPacket::WIDTH squared pixels
+static TraceStats
+tracePackets(const SceneData& data, const std::vector<Ray>& rays, uint32_t resolution, const std::string& ray_type) {
+    TraceStats stats;
+    stats.ray_type = ray_type;
+    stats.rays = rays.size();
+
+    const uint32_t blocks_x = (resolution + RayPacket::WIDTH - 1) / RayPacket::WIDTH;
+    for (int run = 0; run < 4; run++) {
+        std::atomic<uint32_t> hit_count { 0 };
+        auto t_start = std::chrono::high_resolution_clock::now();
+        parallelFor(0, (size_t)blocks_x * blocks_x, CHUNK_SIZE, [&](size_t first, size_t last) {
+            uint32_t local_hits = 0;
+            for (size_t block = first; block < last; block++) {
+                uint32_t x0 = (block % blocks_x) * RayPacket::WIDTH, y0 = (block / blocks_x) * RayPacket::WIDTH;
+                RayPacket packet;
+                for (uint32_t lane = 0; lane < RayPacket::SIZE; lane++) {
+                    uint32_t x = x0 + lane % RayPacket::WIDTH, y = y0 + lane / RayPacket::WIDTH;
+                    if (x < resolution && y < resolution) packet.set(lane, rays[(size_t)y * resolution + x]);
+                }
+
+                Hit hits[RayPacket::SIZE];
+                intersectPacket(data, packet, hits);
+                for (uint32_t lane = 0; lane < RayPacket::SIZE; lane++)
+                    local_hits += hits[lane].valid;
+            }
+            hit_count += local_hits;
+        });
+        double seconds = millisecondsSince(t_start) / 1000.;
+
+        stats.hits = hit_count;
+        if (run > 0 && seconds > 0.)
+            stats.rays_per_second = std::max(stats.rays_per_second, rays.size() / seconds);
+    }
+    return stats;
+}
+
+/*
+ * Moves every instance and refits the TLAS in place. A TLAS built from scratch over the moved
+ * instances is traced as well, both have to report the same hits.
+ */
+static std::vector<TraceStats>
+refitAccel(const BenchScene& scene, BVHLayout layout, Accel& accel, const std::vector<Ray>& rays, BuildStats& stats) {
+    glm::vec3 extent = accel.tlas->getNodes()[0].aabb.extent();
+    std::vector<ObjectInstance> moved = scene.instances;
+    for (size_t i = 0; i < moved.size(); i++) {
+        glm::vec3 offset = .05f * extent * glm::vec3(std::sin((float)i), std::cos((float)i), 0.f);
+        moved[i].world_to_instance = moved[i].world_to_instance * glm::translate(glm::mat4(1.f), -offset);
+    }
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+    accel.tlas->refit(moved);
+    stats.tlas_refit_ms = millisecondsSince(t_start);
+    for (size_t i = 0; i < accel.instance_to_world.size(); i++)
+        accel.instance_to_world[i] = glm::inverse(accel.tlas->getInstances()[i].world_to_instance);
+
+    t_start = std::chrono::high_resolution_clock::now();
+    TLAS rebuilt(moved, accel.blas_info);
+    rebuilt.reorderNodes(layout);
+    stats.tlas_rebuild_ms = millisecondsSince(t_start);
+
+    std::vector<glm::mat4> rebuilt_instance_to_world;
+    for (auto& instance : rebuilt.getInstances())
+        rebuilt_instance_to_world.push_back(glm::inverse(instance.world_to_instance));
+    SceneData rebuilt_data = accel.data;
+    rebuilt_data.tlas = rebuilt.getNodes().data();
+    rebuilt_data.blas_offsets = rebuilt.getBLASOffsets().data();
+    rebuilt_data.instances = rebuilt.getInstances().data();
+    rebuilt_data.instance_to_world = rebuilt_instance_to_world.data();
+
+    std::vector<TraceStats> traces = {
+        trace(accel.data, rays, "primary_refit"),
+        trace(rebuilt_data, rays, "primary_rebuilt"),
+    };
+    if (traces[0].hits != traces[1].hits)
+        ERR(scene.name + ": refit TLAS hits " + std::to_string(traces[0].hits) + " rays, rebuilt TLAS " + std::to_string(traces[1].hits));
+    return traces;
+}
+
+static void
+writeBuild(JsonWriter& json, BVHSplitMethod split_method, const BuildStats& build, const std::vector<TraceStats>& traces) {
+    json.beginObject();
+    json.value("split_method", splitMethodName(split_method));
+    json.value("blas_build_ms", build.blas_build_ms);
+    json.value("tlas_build_ms", build.tlas_build_ms);
+    json.value("tlas_refit_ms", build.tlas_refit_ms);
+    json.value("tlas_rebuild_ms", build.tlas_rebuild_ms);
+    json.value("blas_nodes", (uint64_t)build.blas_nodes);
+    json.value("tlas_nodes", (uint64_t)build.tlas_nodes);
+    json.value("sah_cost", build.sah_cost);
+    json.value("duplication_factor", build.duplication_factor);
+    json.beginObject("memory_bytes");
+    json.value("vertices", (uint64_t)build.vertex_bytes);
+    json.value("indices", (uint64_t)build.index_bytes);
+    json.value("triangles", (uint64_t)build.triangle_bytes);
+    json.value("blas", (uint64_t)build.blas_bytes);
+    json.value("tlas", (uint64_t)build.tlas_bytes);
+    json.endObject();
+    json.beginArray("traversal");
+    for (auto& trace : traces) {
+        json.beginObject();
+        json.value("rays", trace.ray_type);
+        json.value("count", (uint64_t)trace.rays);
+        json.value("hits", (uint64_t)trace.hits);
+        json.value("mrays_per_second", trace.rays_per_second / 1e6);
+        json.endObject();
+    }
+    json.endArray();
+    json.endObject();
+}
+
+int
+main(int argc, char** argv) {
+    CmdArgs args;
+    parseCmdArgs(argc, argv, args);
+
+    const uint32_t resolution = args.quick ? 256 : 1024;
+    const uint32_t incoherent_count = args.quick ? (1 << 16) : (1 << 20);
+    const uint32_t n_threads = JobSystem::get().threadCount();
+
+    std::ofstream out(args.out);
+    if (!out) {
+        ERR("Could not open " + args.out);
+        return 1;
+    }
+    JsonWriter json(out);
+    json.beginObject();
+    json.value("bvh_width", (uint64_t)BVH_WIDTH);
+    json.value("layout", bvhLayoutName(args.layout));
+    json.value("triangle_layout", triangleLayoutName(args.triangle_layout));
+    json.value("threads", (uint64_t)n_threads);
+    json.value("quick", args.quick);
+    json.beginArray("scenes");
+
+    LOG("BVH width " + std::to_string(BVH_WIDTH) + ", " + triangleLayoutName(args.triangle_layout) + " triangles, " + std::to_string(n_threads) + " threads");
+    for (BenchScene& scene : makeScenes(args.quick, args.teapot)) {
+        json.beginObject();
+        json.value("name", scene.name);
+        json.value("instances", (uint64_t)scene.instances.size());
+        json.beginArray("builds");
+
+        // Rays are generated from the first build, so that every split method traces the same rays
+        std::vector<Ray> primary, diffuse, incoherent;
+        size_t triangles = 0;
+        for (BVHSplitMethod split_method : args.split_methods) {
+            Accel accel;
+            BuildStats build = buildAccel(scene, split_method, args.layout, args.triangle_layout, accel);
+            triangles = build.triangles;
+            if (primary.empty()) {
+                AABB bounds = accel.tlas->getNodes()[0].aabb;
+                primary = primaryRays(bounds, resolution);
+                diffuse = diffuseRays(accel.data, bounds, primary);
+                incoherent = incoherentRays(bounds, incoherent_count);
+            }
+
+            std::vector<TraceStats> traces = {
+                trace(accel.data, primary, "primary"),
+                tracePackets(accel.data, primary, resolution, "primary_packets"),
+                trace(accel.data, diffuse, "diffuse"),
+                trace(accel.data, incoherent, "incoherent"),
+            };
+            // Moves the instances, so it has to come last
+            for (TraceStats& refit : refitAccel(scene, args.layout, accel, primary, build))
+                traces.push_back(refit);
+
+            std::string prefix = scene.name + " " + splitMethodName(split_method) + ": ";
+            SUCC(prefix + "BLAS " + std::to_string(build.blas_build_ms) + " ms, TLAS " + std::to_string(build.tlas_build_ms) + " ms, "
+                 + std::to_string(build.blas_nodes) + " nodes, SAH cost " + std::to_string(build.sah_cost) + ", "
+                 + std::to_string((build.blas_bytes + build.tlas_bytes) >> 10) + " KiB, TLAS refit " + std::to_string(build.tlas_refit_ms) + " ms");
+            for (auto& trace : traces)
+                SUCC(prefix + trace.ray_type + " " + std::to_string(trace.rays_per_second / 1e6) + " MRays/s (" + std::to_string(trace.hits) + " hits)");
+
+            writeBuild(json, split_method, build, traces);
+        }
+
+        json.endArray();
+        json.value("triangles", (uint64_t)triangles);
+        json.endObject();
+    }
+
+    json.endArray();
+    json.endObject();
+
+    LOG("Wrote " + args.out);
+    return 0;
+}
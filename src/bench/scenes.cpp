@@ -0,0 +1,147 @@
+#include "scenes.h"
+
+#include <cmath>
+#include <random>
+
+#include <glm/ext.hpp>
+
+#include "common/defs.h"
+
+namespace fart {
+
+Geometry
+makeSphere(uint32_t rings, uint32_t segments) {
+    Geometry geometry;
+    for (uint32_t r = 0; r <= rings; r++) {
+        float theta = glm::pi<float>() * r / rings;
+        for (uint32_t s = 0; s <= segments; s++) {
+            float phi = 2.f * glm::pi<float>() * s / segments;
+            AligendVertex vertex;
+            vertex.position = glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+            vertex.normal = vertex.position;
+            vertex.uv = glm::vec2((float)s / segments, (float)r / rings);
+            geometry.vertices.push_back(vertex);
+        }
+    }
+    for (uint32_t r = 0; r < rings; r++) {
+        for (uint32_t s = 0; s < segments; s++) {
+            uint32_t i0 = r * (segments + 1) + s;
+            uint32_t i1 = i0 + segments + 1;
+            geometry.indices.insert(geometry.indices.end(), { i0, i0 + 1, i1, i0 + 1, i1 + 1, i1 });
+        }
+    }
+    return geometry;
+}
+
+Geometry
+makeSoup(uint32_t tri_count, float tri_size, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+
+    Geometry geometry;
+    for (uint32_t i = 0; i < tri_count; i++) {
+        glm::vec3 center(uniform(rng), uniform(rng), uniform(rng));
+        for (uint32_t corner = 0; corner < 3; corner++) {
+            glm::vec3 offset = glm::vec3(uniform(rng), uniform(rng), uniform(rng)) - .5f;
+            AligendVertex vertex;
+            vertex.position = center + offset * tri_size;
+            vertex.normal = glm::vec3(0.f, 1.f, 0.f);
+            vertex.uv = glm::vec2(0.f);
+            geometry.vertices.push_back(vertex);
+            geometry.indices.push_back(3 * i + corner);
+        }
+    }
+    return geometry;
+}
+
+Geometry
+makeSlivers(uint32_t tri_count, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+
+    Geometry geometry;
+    for (uint32_t i = 0; i < tri_count; i++) {
+        glm::vec3 a(uniform(rng), uniform(rng), uniform(rng));
+        glm::vec3 b = a + glm::normalize(glm::vec3(uniform(rng), uniform(rng), uniform(rng)) - .5f) * .25f;
+        glm::vec3 width = glm::vec3(uniform(rng), uniform(rng), uniform(rng)) * .002f;
+        for (glm::vec3 position : { a, b, a + width }) {
+            AligendVertex vertex;
+            vertex.position = position;
+            vertex.normal = glm::normalize(glm::cross(b - a, width));
+            vertex.uv = glm::vec2(0.f);
+            geometry.vertices.push_back(vertex);
+        }
+        geometry.indices.insert(geometry.indices.end(), { 3 * i, 3 * i + 1, 3 * i + 2 });
+    }
+    return geometry;
+}
+
+static BenchScene
+singleObjectScene(const std::string& name, Geometry geometry) {
+    BenchScene scene;
+    scene.name = name;
+    scene.objects.resize(1);
+    scene.objects[0].geometries.push_back(std::move(geometry));
+    scene.instances.resize(1);
+    scene.instances[0].world_to_instance = glm::mat4(1.f);
+    scene.instances[0].object_id = 0;
+    scene.materials.resize(1);
+    return scene;
+}
+
+// A grid of randomly rotated and scaled spheres and soups
+static BenchScene
+instancedGridScene(uint32_t grid_size, Geometry sphere, Geometry soup) {
+    BenchScene scene;
+    scene.name = "instanced_grid";
+    scene.objects.resize(2);
+    scene.objects[0].geometries.push_back(std::move(sphere));
+    scene.objects[1].geometries.push_back(std::move(soup));
+    scene.materials.resize(1);
+
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    for (uint32_t x = 0; x < grid_size; x++) {
+        for (uint32_t z = 0; z < grid_size; z++) {
+            glm::mat4 instance_to_world = glm::translate(glm::mat4(1.f), glm::vec3(x * 3.f, uniform(rng), z * 3.f));
+            instance_to_world = glm::rotate(instance_to_world, uniform(rng) * glm::two_pi<float>(), glm::normalize(glm::vec3(uniform(rng), 1.f, uniform(rng))));
+            instance_to_world = glm::scale(instance_to_world, glm::vec3(1.f + uniform(rng)));
+
+            ObjectInstance instance;
+            instance.world_to_instance = glm::inverse(instance_to_world);
+            instance.object_id = (x + z) % 2;
+            scene.instances.push_back(instance);
+        }
+    }
+    return scene;
+}
+
+std::vector<BenchScene>
+makeScenes(bool quick, const std::string& teapot_path) {
+    std::vector<BenchScene> scenes;
+    scenes.push_back(singleObjectScene("sphere", quick ? makeSphere(64, 128) : makeSphere(512, 1024)));
+    scenes.push_back(singleObjectScene("soup", quick ? makeSoup(50000, .05f, 7) : makeSoup(1000000, .02f, 7)));
+    scenes.push_back(singleObjectScene("slivers", quick ? makeSlivers(20000, 5) : makeSlivers(100000, 5)));
+    scenes.push_back(quick
+        ? instancedGridScene(8, makeSphere(32, 64), makeSoup(10000, .05f, 9))
+        : instancedGridScene(32, makeSphere(128, 256), makeSoup(100000, .02f, 9)));
+
+    Config config = {};
+    config.vertex_alignment = 8;
+    Scene teapot(teapot_path, config);
+    if (teapot.isValid()) {
+        BenchScene scene;
+        scene.name = "teapot";
+        scene.objects = teapot.getObjects();
+        scene.instances = teapot.getInstances();
+        scene.materials = teapot.getMaterials();
+        if (scene.materials.empty()) scene.materials.resize(1);
+        scenes.push_back(std::move(scene));
+    } else {
+        WARN("Could not load " + teapot_path + ", skipping the teapot scene");
+    }
+
+    return scenes;
+}
+
+}
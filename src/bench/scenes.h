@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <stage.h>
+
+using namespace stage;
+
+namespace fart {
+
+struct BenchScene {
+    std::string name;
+    std::vector<Object> objects;
+    std::vector<ObjectInstance> instances;
+    std::vector<OpenPBRMaterial> materials;
+};
+
+// Unit sphere with rings * segments * 2 triangles
+Geometry makeSphere(uint32_t rings, uint32_t segments);
+
+// Triangles of roughly tri_size scattered in the unit cube
+Geometry makeSoup(uint32_t tri_count, float tri_size, uint32_t seed);
+
+// Long, thin triangles at random orientations, the worst case for object splits
+Geometry makeSlivers(uint32_t tri_count, uint32_t seed);
+
+/*
+ * The procedural scenes and resources/teapot.obj. quick shrinks every
+ * scene so that a full run finishes in seconds, e.g. to test the suite itself.
+ */
+std::vector<BenchScene> makeScenes(bool quick, const std::string& teapot_path);
+
+}
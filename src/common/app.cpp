@@ -1,35 +1,109 @@
 #include "app.h"
+#include "image.h"
+#include "job_system.h"
+#include "json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace fart {
 
-App::App(std::string scene) {
+static std::string
+traversalSummary(const TraversalStats& stats, double rays) {
+    auto perRay = [&](uint64_t count) { return std::to_string(count / std::max(rays, 1.)); };
+    return perRay(stats.nodes) + " nodes, " + perRay(stats.aabb_tests) + " AABB tests, "
+        + perRay(stats.triangle_tests) + " triangle tests, " + perRay(stats.instance_transforms) + " instance transforms per ray";
+}
+
+App::App(const AppOptions& options) : m_options(options) {
+#if FART_PROFILER
+    Profiler::get().setRecording(!options.trace.empty());
+#else
+    if (!options.trace.empty()) WARN("Built without FART_PROFILER, ignoring --trace");
+#endif
+    JobSystem::configure(options.threads, options.pin_threads);
+
     m_renderer = std::make_unique<DeviceRenderer>();
     Config config = {};
     config.vertex_alignment = m_renderer->preferredVertexAlignment();
-    m_scene = std::make_shared<Scene>(scene, config);
+    {
+        FART_PROFILE_ZONE("Scene load");
+        m_scene = std::make_shared<Scene>(options.scene, config);
+    }
     if (!m_scene->isValid()) return;
 
-    m_camera = std::make_shared<FirstPersonCamera>(
-            glm::vec3( 0.f, 0.f, -m_scene->getSceneScale() ), 
-            glm::vec3( 0.f, 0.f, 0.f ), 
-            glm::vec3( 0.f, 1.f, 0.f ));
-    if (m_scene->getCamera())  
-        m_camera = std::make_shared<FirstPersonCamera>(glm::make_vec3(m_scene->getCamera()->position.v),
-                                                       glm::make_vec3(m_scene->getCamera()->lookat.v), 
-                                                       glm::make_vec3(m_scene->getCamera()->up.v));
-    m_window = std::make_shared<Window>(WIDTH, HEIGHT, "FaRT - " + scene + " @ " + m_renderer->name());
+    glm::vec3 eye = glm::vec3( 0.f, 0.f, -m_scene->getSceneScale() );
+    glm::vec3 lookat = glm::vec3( 0.f, 0.f, 0.f );
+    glm::vec3 up = glm::vec3( 0.f, 1.f, 0.f );
+    if (m_scene->getCamera()) {
+        eye = glm::make_vec3(m_scene->getCamera()->position.v);
+        lookat = glm::make_vec3(m_scene->getCamera()->lookat.v);
+        up = glm::make_vec3(m_scene->getCamera()->up.v);
+    }
+    m_camera = std::make_shared<FirstPersonCamera>(options.eye.value_or(eye),
+                                                   options.lookat.value_or(lookat),
+                                                   options.up.value_or(up));
+    // Headless runs of backends that only need GL to present get no window, so they run without a display
+    if (!(options.headless && m_renderer->supportsWindowless())) {
+        m_window = std::make_shared<Window>(options.resolution.x, options.resolution.y, 
+                                            "FaRT - " + options.scene + " @ " + m_renderer->name(),
+                                            /*visible=*/!options.headless);
+        if (!m_window->isValid()) {
+            std::string hint = m_renderer->supportsWindowless() ? ", --headless renders without one" : "";
+            ERR("The " + m_renderer->name() + " needs a window" + hint);
+            return;
+        }
+    }
 
-    m_renderer->init(m_scene, m_window);
+    {
+        FART_PROFILE_ZONE("Renderer init");
+        m_renderer->setTriangleLayout(options.triangle_layout);
+        m_renderer->setSplitMethod(options.split_method);
+        m_renderer->setNodeLayout(options.node_layout);
+        m_renderer->setSceneCacheDirectory(options.scene_cache ? options.cache_dir : "");
+        m_renderer->setResolution(options.resolution);
+        m_renderer->init(m_scene, m_window);
+    }
+    m_renderer->setPresentEnabled(!options.headless);
+    m_renderer->setHeatmapScale(options.heatmap_scale);
+    if (m_renderer->supportsRenderMode(options.render_mode))
+        m_renderer->setRenderMode(options.render_mode);
+    else
+        WARN(std::string("Render mode ") + renderModeName(options.render_mode) + " is not supported by the " + m_renderer->name());
+    if (m_renderer->supportsWavefront())
+        m_renderer->setWavefront(options.wavefront);
+    else if (options.wavefront)
+        WARN("Wavefront pathtracing is not supported by the " + m_renderer->name());
+    if (m_renderer->supportsAdaptiveSampling())
+        m_renderer->setAdaptiveSampling(options.adaptive_error);
+    else if (options.adaptive_error > 0.f)
+        WARN("Adaptive sampling is not supported by the " + m_renderer->name());
 
     SUCC("Finished initializing renderer (" + m_renderer->name() + ")");
+    m_initialized = true;
 }
 
-void
+int
 App::run() {
-    if (!m_scene->isValid()) return;
+    if (!m_initialized) return 1;
+
+    int result;
+    if (!m_options.replay.empty())
+        result = runReplay();
+    else if (m_options.headless)
+        result = runHeadless();
+    else
+        result = runInteractive();
+    writeTrace();
+    return result;
+}
 
+int
+App::runInteractive() {
     while(!m_window->shouldClose()) {
         // update window
         m_window->update();
@@ -56,17 +130,42 @@ App::run() {
             if (!m_window->isKeyPressed(GLFW_KEY_C)) {
                 m_camera_mode_changed = false;
             }
+
+            // render mode
+            if (!m_render_mode_changed && m_window->isKeyPressed(GLFW_KEY_H)) {
+                m_render_mode_changed = true;
+                RenderMode mode = m_renderer->getRenderMode();
+                do {
+                    mode = RenderMode(((uint32_t)mode + 1) % RENDER_MODE_COUNT);
+                } while (!m_renderer->supportsRenderMode(mode));
+                m_renderer->setRenderMode(mode);
+            }
+            if (!m_window->isKeyPressed(GLFW_KEY_H)) {
+                m_render_mode_changed = false;
+            }
         }
 
+        if (!m_options.record.empty()) m_camera_path.record(*m_camera);
+
         // render pass
         RenderStats render_stats;
-        m_renderer->render(m_camera->eye(), m_camera->dir(), m_camera->up(), render_stats);
+        {
+            FART_PROFILE_ZONE("Frame");
+            m_renderer->render(m_camera->eye(), m_camera->dir(), m_camera->up(), render_stats);
+        }
 
+        m_frame_stats.add(render_stats.frame_time_ms);
         m_fps = (1000.f / render_stats.frame_time_ms);
         if (m_fps_ema < 0.f) m_fps_ema = m_fps; 
         m_fps_ema = 0.05f * m_fps + 0.95f * m_fps_ema;
         if (m_fps_ema / ( m_frame_count + 1 ) < 5.f) {
-            m_window->setWindowTitle("FaRT - " + m_renderer->name() + " @ " + std::to_string(int(m_fps_ema)) + " fps");
+            std::string title = "FaRT - " + m_renderer->name() + " @ " + std::to_string(int(m_fps_ema)) + " fps";
+            if (m_renderer->getRenderMode() != RenderMode::Pathtracing) {
+                glm::u32vec2 viewport_size = m_window->getViewportSize();
+                title += std::string(" - ") + renderModeName(m_renderer->getRenderMode()) + " heatmap - "
+                    + traversalSummary(render_stats.traversal, (double)viewport_size.x * viewport_size.y);
+            }
+            m_window->setWindowTitle(title);
             m_frame_count = 0;
         }
 
@@ -74,6 +173,197 @@ App::run() {
 
         m_frame_count += 1;
     }
+
+    FrameTimeSummary summary = m_frame_stats.summarize();
+    LOG("Frame times over " + std::to_string(summary.frames) + " frames: mean " + std::to_string(summary.mean_ms) 
+        + " ms, p50 " + std::to_string(summary.p50_ms) + " ms, p99 " + std::to_string(summary.p99_ms) + " ms");
+    if (!m_options.record.empty() && !m_camera_path.save(m_options.record)) return 1;
+
+    return 0;
+}
+
+/*
+ * Renders frames_per_keyframe frames at every keyframe of a recorded camera path.
+ * Each keyframe restarts accumulation, so every run renders the identical workload.
+ * Frames are synchronized with the device to time them individually.
+ */
+int
+App::runReplay() {
+    CameraPath path;
+    if (!path.load(m_options.replay)) return 1;
+
+    const uint32_t frames_per_keyframe = m_options.frames_per_keyframe;
+    const glm::u32vec2 resolution = imageSize();
+    LOG("Replaying " + std::to_string(path.size()) + " keyframes with " + std::to_string(frames_per_keyframe) 
+        + " frames each at " + std::to_string(resolution.x) + "x" + std::to_string(resolution.y));
+
+    auto renderFrame = [&]() {
+        RenderStats render_stats;
+        auto t_start = std::chrono::high_resolution_clock::now();
+        {
+            FART_PROFILE_ZONE("Frame");
+            m_renderer->render(m_camera->eye(), m_camera->dir(), m_camera->up(), render_stats);
+            m_renderer->synchronize();
+        }
+        if (m_window) glfwPollEvents();
+        return std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t_start).count();
+    };
+
+    // Untimed warm-up frame, the first frame pays for lazy driver and shader initialization
+    const CameraKeyframe& first = path.getKeyframes().front();
+    m_camera = std::make_shared<FirstPersonCamera>(first.eye, first.center, first.up);
+    renderFrame();
+
+    FrameStats frame_stats;
+    for (const CameraKeyframe& keyframe : path.getKeyframes()) {
+        m_camera = std::make_shared<FirstPersonCamera>(keyframe.eye, keyframe.center, keyframe.up);
+        for (uint32_t i = 0; i < frames_per_keyframe && !(m_window && m_window->shouldClose()); i++)
+            frame_stats.add(renderFrame());
+    }
+
+    // The window can be closed before the first timed frame
+    FrameTimeSummary summary = frame_stats.summarize();
+    if (summary.frames == 0) {
+        ERR("Replay ended before any frame was timed");
+        return 1;
+    }
+    double samples_per_s = (double)resolution.x * resolution.y / (summary.mean_ms * 1e-3);
+
+    SUCC("Replayed " + std::to_string(summary.frames) + " frames");
+    LOG("  min:          " + std::to_string(summary.min_ms) + " ms");
+    LOG("  mean:         " + std::to_string(summary.mean_ms) + " ms");
+    LOG("  p50:          " + std::to_string(summary.p50_ms) + " ms");
+    LOG("  p95:          " + std::to_string(summary.p95_ms) + " ms");
+    LOG("  p99:          " + std::to_string(summary.p99_ms) + " ms");
+    LOG("  max:          " + std::to_string(summary.max_ms) + " ms");
+    LOG("  throughput:   " + std::to_string(samples_per_s * 1e-6) + " Msamples/s");
+
+    if (!m_options.stats.empty() && !writeReplayStats(path, summary, samples_per_s)) return 1;
+    return 0;
+}
+
+bool
+App::writeReplayStats(const CameraPath& path, const FrameTimeSummary& summary, double samples_per_s) {
+    std::ofstream file(m_options.stats, std::ios::trunc);
+    JsonWriter json(file);
+    json.beginObject();
+    json.value("scene", m_options.scene);
+    json.value("renderer", m_renderer->name());
+#ifdef BVH_WIDTH
+    json.value("bvh_width", (uint64_t)BVH_WIDTH);
+#endif
+    json.value("width", (uint64_t)imageSize().x);
+    json.value("height", (uint64_t)imageSize().y);
+    json.value("camera_path", m_options.replay);
+    json.value("keyframes", (uint64_t)path.size());
+    json.value("frames_per_keyframe", (uint64_t)m_options.frames_per_keyframe);
+    json.value("frames", (uint64_t)summary.frames);
+    json.value("samples_per_s", samples_per_s);
+    json.beginObject("frame_time_ms");
+    json.value("min", (double)summary.min_ms);
+    json.value("mean", (double)summary.mean_ms);
+    json.value("p50", (double)summary.p50_ms);
+    json.value("p95", (double)summary.p95_ms);
+    json.value("p99", (double)summary.p99_ms);
+    json.value("max", (double)summary.max_ms);
+    json.endObject();
+    json.endObject();
+
+    if (!file) {
+        ERR("Could not write " + m_options.stats);
+        return false;
+    }
+    SUCC("Wrote " + m_options.stats);
+    return true;
+}
+
+int
+App::runHeadless() {
+    const uint32_t spp = m_options.spp;
+    const glm::u32vec2 resolution = imageSize();
+    LOG("Rendering " + std::to_string(spp) + " spp at " + std::to_string(resolution.x) + "x" + std::to_string(resolution.y));
+
+    // Frame times only cover command submission for asynchronous renderers, the
+    // wall time includes reading back the result
+    auto t_start = std::chrono::high_resolution_clock::now();
+    float frame_time_sum_ms = 0.f;
+    std::vector<PassStats> pass_sums;
+    std::vector<uint32_t> gpu_counts;
+    TraversalStats traversal;
+    uint32_t frames = 0;
+    for (uint32_t i = 0; i < spp; i++) {
+        RenderStats render_stats;
+        {
+            FART_PROFILE_ZONE("Frame");
+            m_renderer->render(m_camera->eye(), m_camera->dir(), m_camera->up(), render_stats);
+        }
+        frame_time_sum_ms += render_stats.frame_time_ms;
+        traversal += render_stats.traversal;
+
+        // Passes have the same order every frame, GPU timings are missing for the first frames
+        pass_sums.resize(render_stats.passes.size(), { nullptr, 0.f, 0.f });
+        gpu_counts.resize(render_stats.passes.size(), 0);
+        for (size_t p = 0; p < render_stats.passes.size(); p++) {
+            const PassStats& pass = render_stats.passes[p];
+            pass_sums[p].name = pass.name;
+            pass_sums[p].cpu_ms += pass.cpu_ms;
+            if (pass.gpu_ms >= 0.f) {
+                pass_sums[p].gpu_ms += pass.gpu_ms;
+                gpu_counts[p] += 1;
+            }
+        }
+
+        frames = i + 1;
+        if (frames % std::max(spp / 10, 1u) == 0)
+            LOG("  " + std::to_string(frames) + "/" + std::to_string(spp) + " spp");
+
+        // Reading back the tile errors stalls asynchronous renderers, so only check now and then
+        if (m_options.adaptive_error > 0.f && frames % ADAPTIVE_CHECK_INTERVAL == 0 && m_renderer->isConverged()) {
+            LOG("  converged after " + std::to_string(frames) + " frames");
+            break;
+        }
+    }
+
+    std::vector<glm::vec4> pixels;
+    if (!m_renderer->readAccumulation(pixels)) {
+        ERR("Headless rendering is not supported by the " + m_renderer->name());
+        return 1;
+    }
+    double total_s = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t_start).count();
+
+    if (!writeImage(m_options.out, resolution.x, resolution.y, pixels)) return 1;
+
+    // Adaptive sampling skips converged tiles, so frames can trace fewer paths than there are pixels
+    double n_pixels = (double)resolution.x * resolution.y;
+    uint64_t samples = m_renderer->sampleCount();
+    double paths = samples ? (double)samples : (double)frames * n_pixels;
+    SUCC("Wrote " + m_options.out);
+    LOG("  total:        " + std::to_string(total_s) + " s");
+    LOG("  per sample:   " + std::to_string(1000. * total_s / frames) + " ms");
+    LOG("  submission:   " + std::to_string(frame_time_sum_ms / frames) + " ms/spp");
+    LOG("  throughput:   " + std::to_string(paths / total_s * 1e-6) + " Mpaths/s");
+    if (m_options.adaptive_error > 0.f)
+        LOG("  samples:      " + std::to_string(paths / n_pixels) + " spp on average, " + std::to_string(100. * paths / ((double)spp * n_pixels)) + "% of " + std::to_string(spp) + " spp");
+    if (m_renderer->getRenderMode() != RenderMode::Pathtracing)
+        LOG("  traversal:    " + traversalSummary(traversal, paths));
+    for (size_t p = 0; p < pass_sums.size(); p++) {
+        std::string gpu = gpu_counts[p] ? ", " + std::to_string(pass_sums[p].gpu_ms / gpu_counts[p]) + " ms GPU" : "";
+        LOG("  " + std::string(pass_sums[p].name) + ": " + std::to_string(pass_sums[p].cpu_ms / frames) + " ms CPU" + gpu);
+    }
+
+    return 0;
+}
+
+void
+App::writeTrace() {
+#if FART_PROFILER
+    if (!m_options.trace.empty()) Profiler::get().writeTrace(m_options.trace);
+#endif
+}
+
+glm::u32vec2
+App::imageSize() {
+    return m_window ? m_window->getViewportSize() : m_options.resolution;
 }
 
 glm::vec3
@@ -7,38 +7,110 @@ using DeviceRenderer = fart::OpenGlRenderer;
 #elif METAL_RENDERER
 #include "metal/renderer.h"
 using DeviceRenderer = fart::MetalRenderer;
+#elif CPU_RENDERER
+#include "cpu/renderer.h"
+using DeviceRenderer = fart::CpuRenderer;
 #endif
 
 #include "camera.h"
+#include "camera_path.h"
+#include "frame_stats.h"
 #include "renderer.h"
 #include "defs.h"
 #include "window.h"
 #include <stage.h>
 #include <memory>
+#include <optional>
 
 using namespace stage;
 
 namespace fart {
 
+struct AppOptions {
+    std::string scene;
+
+    // Offline rendering of a fixed number of samples per pixel into out
+    bool headless { false };
+    uint32_t spp { 1024 };
+    glm::u32vec2 resolution { 1280, 720 };
+    std::string out { "frame.exr" };
+
+    // Override the scene camera
+    std::optional<glm::vec3> eye;
+    std::optional<glm::vec3> lookat;
+    std::optional<glm::vec3> up;
+
+    // Chrome trace output, needs a build with FART_PROFILER
+    std::string trace;
+
+    // Camera path recorded during interactive runs
+    std::string record;
+    // Benchmark replaying a recorded camera path, statistics are written to stats as JSON
+    std::string replay;
+    uint32_t frames_per_keyframe { 8 };
+    std::string stats;
+
+    // Pathtracing or one of the traversal heatmaps
+    RenderMode render_mode { RenderMode::Pathtracing };
+    float heatmap_scale { 64.f };
+
+    // Memory/speed trade-off of the triangle data, see TriangleLayout
+    TriangleLayout triangle_layout { TriangleLayout::Indexed };
+    // BLAS builder, see BVHSplitMethod
+    BVHSplitMethod split_method { BVHSplitMethod::SAH };
+    // Node order of the BLAS and TLAS, see BVHLayout
+    BVHLayout node_layout { BVHLayout::DFS };
+
+    // Acceleration structures are cached in cache_dir unless scene_cache is off
+    bool scene_cache { true };
+    std::string cache_dir { "fartcache" };
+
+    // Stage by stage pathtracing over path queues, see Renderer::setWavefront
+    bool wavefront { false };
+
+    // Target relative error of adaptive sampling, 0 samples every pixel every frame.
+    // Headless runs stop before spp once every tile reaches it.
+    float adaptive_error { 0.f };
+
+    // Size of the job system shared by BVH builds and CPU rendering, 0 uses all hardware threads
+    uint32_t threads { 0 };
+    bool pin_threads { false };
+};
+
 struct App {
     
     public:
-        static constexpr uint32_t WIDTH = 1280;
-        static constexpr uint32_t HEIGHT = 720;
-
-        App(std::string scene);
+        App(const AppOptions& options);
         ~App() = default;
 
-        void run();
+        // Returns the process exit code
+        int run();
 
     private:
+        // Frames between the convergence checks of headless adaptive sampling
+        static constexpr uint32_t ADAPTIVE_CHECK_INTERVAL = 16;
+
+        int runInteractive();
+        int runHeadless();
+        int runReplay();
+        void writeTrace();
+        bool writeReplayStats(const CameraPath& path, const FrameTimeSummary& summary, double samples_per_s);
         glm::vec3 keyboardInputToMovementVector();
+        // Size of the rendered image, follows the window if there is one
+        glm::u32vec2 imageSize();
+
+        AppOptions m_options;
+        // False if the scene, the window or the renderer failed to initialize
+        bool m_initialized { false };
 
         bool m_camera_mode_changed { false };
+        bool m_render_mode_changed { false };
         float m_fps { -1.f };
         float m_fps_ema { -1.f };
         long long m_frame_count { 0 };
-        
+        FrameStats m_frame_stats;
+        CameraPath m_camera_path;
+
         std::shared_ptr<Camera> m_camera {nullptr};
         std::shared_ptr<Window> m_window {nullptr};
         std::shared_ptr<Scene> m_scene {nullptr};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+namespace fart {
+
+// Order of the binary BVH and TLAS nodes in memory, chosen per scene.
+// Treelet showed no gain over DFS on the CPU kernels in fart_bench.
+enum BVHLayout : uint32_t {
+    // Child pairs in depth-first order, as the builders emit them
+    DFS,
+    // Child pairs grouped into breadth-first treelets of TREELET_BYTES, treelets in depth-first order
+    Treelet,
+};
+
+inline const char* bvhLayoutName(BVHLayout layout) {
+    return layout == BVHLayout::Treelet ? "treelet" : "dfs";
+}
+
+}
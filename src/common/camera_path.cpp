@@ -0,0 +1,76 @@
+#include "camera_path.h"
+#include "defs.h"
+
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+namespace fart {
+
+static constexpr const char* HEADER = "# fart camera path v1";
+
+void
+CameraPath::record(const Camera& camera) {
+    CameraKeyframe keyframe { camera.eye(), camera.center(), camera.world_up() };
+    if (!m_keyframes.empty()) {
+        const CameraKeyframe& last = m_keyframes.back();
+        if (last.eye == keyframe.eye && last.center == keyframe.center && last.up == keyframe.up) return;
+    }
+    m_keyframes.push_back(keyframe);
+}
+
+bool
+CameraPath::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        ERR("Could not open camera path " + path);
+        return false;
+    }
+
+    m_keyframes.clear();
+    std::string line;
+    size_t line_no = 0;
+    while (std::getline(file, line)) {
+        line_no += 1;
+        if (line.empty() || line[0] == '#') continue;
+
+        CameraKeyframe k;
+        std::istringstream stream(line);
+        if (!(stream >> k.eye.x >> k.eye.y >> k.eye.z
+                     >> k.center.x >> k.center.y >> k.center.z
+                     >> k.up.x >> k.up.y >> k.up.z)) {
+            ERR("Invalid keyframe in " + path + ":" + std::to_string(line_no));
+            return false;
+        }
+        m_keyframes.push_back(k);
+    }
+
+    if (m_keyframes.empty()) {
+        ERR("Camera path " + path + " has no keyframes");
+        return false;
+    }
+    return true;
+}
+
+bool
+CameraPath::save(const std::string& path) const {
+    std::ofstream file(path, std::ios::trunc);
+    // Enough digits to read back the exact floats
+    file << std::setprecision(std::numeric_limits<float>::max_digits10);
+    file << HEADER << "\n";
+    for (const CameraKeyframe& k : m_keyframes) {
+        file << k.eye.x << " " << k.eye.y << " " << k.eye.z << " "
+             << k.center.x << " " << k.center.y << " " << k.center.z << " "
+             << k.up.x << " " << k.up.y << " " << k.up.z << "\n";
+    }
+
+    if (!file) {
+        ERR("Could not write camera path " + path);
+        return false;
+    }
+    SUCC("Wrote camera path " + path + " (" + std::to_string(m_keyframes.size()) + " keyframes)");
+    return true;
+}
+
+}
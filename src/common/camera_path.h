@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "camera.h"
+
+namespace fart {
+
+struct CameraKeyframe {
+    glm::vec3 eye;
+    glm::vec3 center;
+    glm::vec3 up;
+};
+
+/*
+ * Sequence of camera poses recorded from interactive input and replayed for
+ * benchmarking. Stored as text, one keyframe "eye center up" (9 floats) per line.
+ */
+struct CameraPath {
+
+    public:
+        // Appends the pose of camera unless it equals the last keyframe
+        void record(const Camera& camera);
+
+        bool load(const std::string& path);
+        bool save(const std::string& path) const;
+
+        const std::vector<CameraKeyframe>& getKeyframes() const { return m_keyframes; }
+        size_t size() const { return m_keyframes.size(); }
+        bool empty() const { return m_keyframes.empty(); }
+
+    private:
+        std::vector<CameraKeyframe> m_keyframes;
+};
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+namespace fart {
+
+struct FrameTimeSummary {
+    size_t frames { 0 };
+    float min_ms { 0.f };
+    float mean_ms { 0.f };
+    float p50_ms { 0.f };
+    float p95_ms { 0.f };
+    float p99_ms { 0.f };
+    float max_ms { 0.f };
+};
+
+// Keeps every frame time so that stutter shows up in the tail percentiles
+struct FrameStats {
+
+    public:
+        void add(float frame_time_ms) { m_frame_times_ms.push_back(frame_time_ms); }
+        void clear() { m_frame_times_ms.clear(); }
+        size_t size() const { return m_frame_times_ms.size(); }
+
+        FrameTimeSummary summarize() const {
+            FrameTimeSummary summary;
+            if (m_frame_times_ms.empty()) return summary;
+
+            std::vector<float> sorted = m_frame_times_ms;
+            std::sort(sorted.begin(), sorted.end());
+            // Nearest-rank percentile
+            auto percentile = [&](float p) {
+                size_t rank = (size_t)std::ceil(p / 100.f * sorted.size());
+                return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+            };
+
+            summary.frames = sorted.size();
+            summary.min_ms = sorted.front();
+            summary.mean_ms = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+            summary.p50_ms = percentile(50.f);
+            summary.p95_ms = percentile(95.f);
+            summary.p99_ms = percentile(99.f);
+            summary.max_ms = sorted.back();
+            return summary;
+        }
+
+    private:
+        std::vector<float> m_frame_times_ms;
+};
+
+}
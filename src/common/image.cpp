@@ -0,0 +1,249 @@
+#include "image.h"
+
+#include "defs.h"
+#include "cpu/common/color.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+
+namespace fart {
+
+static void
+putU8(std::vector<uint8_t>& out, uint8_t v) {
+    out.push_back(v);
+}
+
+static void
+putLE32(std::vector<uint8_t>& out, uint32_t v) {
+    for (int i = 0; i < 4; i++)
+        out.push_back((v >> (8 * i)) & 0xff);
+}
+
+static void
+putLE64(std::vector<uint8_t>& out, uint64_t v) {
+    for (int i = 0; i < 8; i++)
+        out.push_back((v >> (8 * i)) & 0xff);
+}
+
+static void
+putBE32(std::vector<uint8_t>& out, uint32_t v) {
+    for (int i = 3; i >= 0; i--)
+        out.push_back((v >> (8 * i)) & 0xff);
+}
+
+static void
+putFloat(std::vector<uint8_t>& out, float v) {
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(float));
+    putLE32(out, bits);
+}
+
+static void
+putString(std::vector<uint8_t>& out, const std::string& s) {
+    out.insert(out.end(), s.begin(), s.end());
+    out.push_back(0);
+}
+
+static bool
+writeFile(const std::string& path, const std::vector<uint8_t>& data) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    if (!file) {
+        ERR("Could not write " + path);
+        return false;
+    }
+    return true;
+}
+
+static bool
+checkSize(uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels) {
+    if (width == 0 || height == 0 || pixels.size() != (size_t)width * height) {
+        ERR("Image size does not match its pixel count");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Single part scanline EXR with uncompressed 32 bit float B, G and R channels.
+ * References:
+ * "Technical Introduction to OpenEXR" and "OpenEXR File Layout", openexr.com
+ */
+bool
+writeEXR(const std::string& path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels) {
+    if (!checkSize(width, height, pixels)) return false;
+
+    std::vector<uint8_t> out;
+    putLE32(out, 20000630);
+    putLE32(out, 2);
+
+    auto attribute = [&](const std::string& name, const std::string& type, uint32_t size) {
+        putString(out, name);
+        putString(out, type);
+        putLE32(out, size);
+    };
+
+    // Channels have to be sorted by name
+    const char* channels[] = { "B", "G", "R" };
+    attribute("channels", "chlist", 3 * (2 + 16) + 1);
+    for (const char* channel : channels) {
+        putString(out, channel);
+        putLE32(out, 2);    // FLOAT
+        putLE32(out, 0);    // pLinear and reserved bytes
+        putLE32(out, 1);    // xSampling
+        putLE32(out, 1);    // ySampling
+    }
+    putU8(out, 0);
+
+    attribute("compression", "compression", 1);
+    putU8(out, 0);
+    for (const char* window : { "dataWindow", "displayWindow" }) {
+        attribute(window, "box2i", 16);
+        putLE32(out, 0);
+        putLE32(out, 0);
+        putLE32(out, width - 1);
+        putLE32(out, height - 1);
+    }
+    attribute("lineOrder", "lineOrder", 1);
+    putU8(out, 0);
+    attribute("pixelAspectRatio", "float", 4);
+    putFloat(out, 1.f);
+    attribute("screenWindowCenter", "v2f", 8);
+    putFloat(out, 0.f);
+    putFloat(out, 0.f);
+    attribute("screenWindowWidth", "float", 4);
+    putFloat(out, 1.f);
+    putU8(out, 0);
+
+    // Offset table, one block per scanline
+    const uint64_t line_size = 8 + 3 * 4 * (uint64_t)width;
+    const uint64_t first_line = out.size() + 8 * (uint64_t)height;
+    for (uint32_t y = 0; y < height; y++)
+        putLE64(out, first_line + y * line_size);
+
+    out.reserve(first_line + height * line_size);
+    for (uint32_t y = 0; y < height; y++) {
+        putLE32(out, y);
+        putLE32(out, 3 * 4 * width);
+        const glm::vec4* row = &pixels[(size_t)(height - 1 - y) * width];
+        for (int c = 2; c >= 0; c--) {
+            for (uint32_t x = 0; x < width; x++)
+                putFloat(out, row[x][c]);
+        }
+    }
+
+    return writeFile(path, out);
+}
+
+// Little endian RGB floats, PFM stores rows bottom to top as well
+bool
+writePFM(const std::string& path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels) {
+    if (!checkSize(width, height, pixels)) return false;
+
+    std::string header = "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+    std::vector<uint8_t> out(header.begin(), header.end());
+    out.reserve(out.size() + 3 * 4 * pixels.size());
+    for (const glm::vec4& pixel : pixels) {
+        for (int c = 0; c < 3; c++)
+            putFloat(out, pixel[c]);
+    }
+
+    return writeFile(path, out);
+}
+
+static uint32_t
+crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+    static const std::array<uint32_t, 256> table = []() {
+        std::array<uint32_t, 256> table;
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return table;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+/*
+ * 8 bit RGB PNG. The zlib stream only uses stored blocks, which keeps the writer
+ * free of dependencies at the cost of file size.
+ * Reference: https://www.w3.org/TR/png/
+ */
+bool
+writePNG(const std::string& path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels) {
+    if (!checkSize(width, height, pixels)) return false;
+
+    // Filter type 0 followed by the row, top to bottom
+    std::vector<uint8_t> raw;
+    raw.reserve((size_t)height * (1 + 3 * width));
+    for (uint32_t y = 0; y < height; y++) {
+        raw.push_back(0);
+        const glm::vec4* row = &pixels[(size_t)(height - 1 - y) * width];
+        for (uint32_t x = 0; x < width; x++) {
+            glm::vec4 c = gamma(tonemap_ACES(row[x]));
+            for (int i = 0; i < 3; i++)
+                raw.push_back((uint8_t)(std::min(std::max(c[i], 0.f), 1.f) * 255.f + .5f));
+        }
+    }
+
+    std::vector<uint8_t> zlib = { 0x78, 0x01 };
+    const size_t max_block = 65535;
+    for (size_t offset = 0; offset < raw.size() || offset == 0; offset += max_block) {
+        uint16_t size = (uint16_t)std::min(max_block, raw.size() - offset);
+        bool last = offset + size >= raw.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(size & 0xff);
+        zlib.push_back(size >> 8);
+        zlib.push_back(~size & 0xff);
+        zlib.push_back((~size >> 8) & 0xff);
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + size);
+    }
+    uint32_t a = 1, b = 0;
+    for (uint8_t v : raw) {
+        a = (a + v) % 65521;
+        b = (b + a) % 65521;
+    }
+    putBE32(zlib, (b << 16) | a);
+
+    std::vector<uint8_t> out = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    auto chunk = [&](const char* type, const std::vector<uint8_t>& data) {
+        putBE32(out, data.size());
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        putBE32(out, crc32(out.data() + start, out.size() - start));
+    };
+
+    std::vector<uint8_t> ihdr;
+    putBE32(ihdr, width);
+    putBE32(ihdr, height);
+    ihdr.insert(ihdr.end(), { 8, 2, 0, 0, 0 });
+    chunk("IHDR", ihdr);
+    chunk("IDAT", zlib);
+    chunk("IEND", {});
+
+    return writeFile(path, out);
+}
+
+bool
+writeImage(const std::string& path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels) {
+    std::string extension = path.substr(path.find_last_of('.') + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    if (extension == "exr") return writeEXR(path, width, height, pixels);
+    if (extension == "pfm") return writePFM(path, width, height, pixels);
+    if (extension == "png") return writePNG(path, width, height, pixels);
+
+    ERR("Unsupported image format " + path + ", use .exr, .pfm or .png");
+    return false;
+}
+
+}
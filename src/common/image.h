@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace fart {
+
+/*
+ * Writers for linear RGBA images whose rows are stored bottom to top, the way
+ * the renderers accumulate them. Alpha is dropped.
+ *
+ * EXR and PFM keep the linear 32 bit float values. PNG applies the tonemapping and
+ * gamma of the postprocessing pass and is written with uncompressed deflate blocks.
+ */
+bool writeEXR(const std::string& path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels);
+bool writePFM(const std::string& path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels);
+bool writePNG(const std::string& path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels);
+
+// Picks the format from the file extension
+bool writeImage(const std::string& path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels);
+
+}
@@ -0,0 +1,186 @@
+#include "job_system.h"
+
+#include "defs.h"
+
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace fart {
+
+namespace {
+
+struct JobSystemConfig {
+    uint32_t n_threads { 0 };
+    bool pin_threads { false };
+};
+
+JobSystemConfig g_config;
+std::atomic<bool> g_started { false };
+
+// Deque of the calling thread, threads outside the pool share the last one
+thread_local uint32_t t_queue_index = UINT32_MAX;
+
+#ifdef __linux__
+bool
+pinThread(std::thread& thread, uint32_t core) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpus) == 0;
+}
+#endif
+
+}
+
+JobSystem&
+JobSystem::get() {
+    static JobSystem jobs(g_config.n_threads, g_config.pin_threads);
+    return jobs;
+}
+
+void
+JobSystem::configure(uint32_t n_threads, bool pin_threads) {
+    if (g_started) {
+        WARN("Job system is already running, ignoring its new configuration");
+        return;
+    }
+    g_config.n_threads = n_threads;
+    g_config.pin_threads = pin_threads;
+}
+
+JobSystem::JobSystem(uint32_t n_threads, bool pin_threads) {
+    g_started = true;
+
+    uint32_t n_cores = std::max(1u, std::thread::hardware_concurrency());
+    if (n_threads == 0) n_threads = n_cores;
+    uint32_t n_workers = n_threads - 1;
+
+    for (uint32_t i = 0; i <= n_workers; i++)
+        m_queues.push_back(std::make_unique<Queue>());
+
+    m_workers.reserve(n_workers);
+    for (uint32_t i = 0; i < n_workers; i++)
+        m_workers.emplace_back(&JobSystem::workerLoop, this, i);
+
+    if (pin_threads && n_workers > 0) {
+#ifdef __linux__
+        bool pinned = n_threads <= n_cores;
+        for (uint32_t i = 0; i < n_workers && pinned; i++)
+            pinned = pinThread(m_workers[i], i + 1);
+        if (pinned) {
+            LOG("Pinned " + std::to_string(n_workers) + " job system threads to cores 1 to " + std::to_string(n_workers));
+        } else {
+            WARN("Could not pin the job system threads to cores");
+        }
+#else
+        WARN("Pinning threads is only supported on Linux, the job system threads are not pinned");
+#endif
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& worker : m_workers)
+        worker.join();
+}
+
+void
+JobSystem::push(Job job, TaskGroup* group) {
+    uint32_t index = std::min<uint32_t>(t_queue_index, m_queues.size() - 1);
+    {
+        std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+        m_queues[index]->entries.push_back({ std::move(job), group });
+    }
+    m_queued++;
+
+    // Taking the lock orders the push before the check of a worker that is about to sleep
+    { std::lock_guard<std::mutex> lock(m_sleep_mutex); }
+    m_wake.notify_one();
+    // A waiting thread helps with the jobs of nested groups
+    if (m_waiting > 0) m_done.notify_one();
+}
+
+bool
+JobSystem::pop(Entry& entry) {
+    if (m_queued == 0) return false;
+
+    uint32_t n_queues = m_queues.size();
+    uint32_t own = std::min<uint32_t>(t_queue_index, n_queues - 1);
+    {
+        Queue& queue = *m_queues[own];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.entries.empty()) {
+            entry = std::move(queue.entries.back());
+            queue.entries.pop_back();
+            m_queued--;
+            return true;
+        }
+    }
+
+    for (uint32_t i = 1; i < n_queues; i++) {
+        Queue& queue = *m_queues[(own + i) % n_queues];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.entries.empty()) {
+            entry = std::move(queue.entries.front());
+            queue.entries.pop_front();
+            m_queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+JobSystem::runOne() {
+    Entry entry;
+    if (!pop(entry)) return false;
+
+    entry.job();
+    // The group may be destroyed as soon as its count reaches 0, only the job system is touched after
+    if (entry.group->m_pending.fetch_sub(1) == 1 && m_waiting > 0) {
+        { std::lock_guard<std::mutex> lock(m_sleep_mutex); }
+        m_done.notify_all();
+    }
+    return true;
+}
+
+void
+JobSystem::workerLoop(uint32_t index) {
+    t_queue_index = index;
+    while (true) {
+        if (runOne()) continue;
+
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        m_wake.wait(lock, [&]() { return m_stop || m_queued > 0; });
+        if (m_stop) return;
+    }
+}
+
+void
+TaskGroup::run(JobSystem::Job job) {
+    m_pending.fetch_add(1, std::memory_order_relaxed);
+    m_jobs.push(std::move(job), this);
+}
+
+void
+TaskGroup::wait() {
+    while (m_pending > 0) {
+        if (m_jobs.runOne()) continue;
+
+        // The remaining jobs run on other threads, sleep until one of them ends the group or more jobs come in
+        std::unique_lock<std::mutex> lock(m_jobs.m_sleep_mutex);
+        m_jobs.m_waiting++;
+        m_jobs.m_done.wait(lock, [&]() { return m_pending == 0 || m_jobs.m_queued > 0; });
+        m_jobs.m_waiting--;
+    }
+}
+
+}
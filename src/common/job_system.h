@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fart {
+
+struct TaskGroup;
+
+/*
+ * Work-stealing thread pool shared by the BVH and TLAS builds, the texture scans and the
+ * CPU renderer, so that every phase runs on the same threads instead of starting its own.
+ * Each worker owns a deque, pushes and pops its jobs at the back and steals from the front
+ * of the other deques once its own is empty, which hands thieves the oldest and usually
+ * largest jobs. Threads waiting for a TaskGroup run pending jobs meanwhile and sleep once
+ * there are none left, so nested groups neither block a core nor add threads.
+ */
+struct JobSystem {
+
+    public:
+        using Job = std::function<void()>;
+
+        // Started on first use with the settings of the last configure() call
+        static JobSystem& get();
+        // Only has an effect before the first get(), 0 threads uses all hardware threads.
+        // Pinning binds worker i to core i + 1, the calling thread is left as is. Only supported
+        // on Linux, other platforms warn and run unpinned.
+        static void configure(uint32_t n_threads, bool pin_threads);
+
+        ~JobSystem();
+
+        // Workers plus the thread that waits, which takes part in running jobs
+        uint32_t threadCount() const { return (uint32_t)m_workers.size() + 1; }
+
+    private:
+        friend struct TaskGroup;
+
+        struct Entry {
+            Job job;
+            TaskGroup* group;
+        };
+
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Entry> entries;
+        };
+
+        JobSystem(uint32_t n_threads, bool pin_threads);
+
+        void push(Job job, TaskGroup* group);
+        // Takes a job from the deque of the calling thread, or steals one
+        bool pop(Entry& entry);
+        // Runs one pending job, returns false if there was none
+        bool runOne();
+        void workerLoop(uint32_t index);
+
+        // One deque per worker, the last one is shared by all threads outside the pool
+        std::vector<std::unique_ptr<Queue>> m_queues;
+        std::vector<std::thread> m_workers;
+
+        // Jobs pushed and not yet taken, workers sleep while it is 0
+        std::atomic<uint32_t> m_queued { 0 };
+        std::mutex m_sleep_mutex;
+        std::condition_variable m_wake;
+        bool m_stop { false };
+
+        // Threads in TaskGroup::wait() with nothing to run, woken when a group ends or a job is pushed
+        std::atomic<uint32_t> m_waiting { 0 };
+        std::condition_variable m_done;
+};
+
+/*
+ * Jobs that are waited for together. wait() returns once every job run() so far has
+ * finished, including jobs those jobs added to the group.
+ */
+struct TaskGroup {
+
+    public:
+        TaskGroup() : m_jobs(JobSystem::get()) {}
+        ~TaskGroup() { wait(); }
+
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        void run(JobSystem::Job job);
+        void wait();
+
+    private:
+        friend struct JobSystem;
+
+        JobSystem& m_jobs;
+        std::atomic<uint32_t> m_pending { 0 };
+};
+
+// Calls f(chunk_first, chunk_last) on chunks of at most grain items of [first, last) and
+// returns once all of them ran. The first chunk runs on the calling thread.
+template <typename F>
+void
+parallelFor(size_t first, size_t last, size_t grain, const F& f) {
+    if (last <= first) return;
+    grain = std::max<size_t>(grain, 1);
+    if (last - first <= grain) {
+        f(first, last);
+        return;
+    }
+
+    TaskGroup group;
+    for (size_t chunk = first + grain; chunk < last; chunk += grain) {
+        size_t chunk_last = std::min(chunk + grain, last);
+        group.run([&f, chunk, chunk_last]() { f(chunk, chunk_last); });
+    }
+    f(first, first + grain);
+    group.wait();
+}
+
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cmath>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace fart {
+
+/*
+ * Minimal streaming JSON writer for benchmark reports and statistics. Keys are ignored
+ * inside arrays, numbers that are not finite are written as null.
+ */
+struct JsonWriter {
+
+    public:
+        JsonWriter(std::ostream& out) : m_out(out) {}
+
+        void beginObject(const std::string& key = "") { open(key, '{'); }
+        void endObject() { close('}'); }
+        void beginArray(const std::string& key = "") { open(key, '['); }
+        void endArray() { close(']'); }
+
+        void value(const std::string& key, const std::string& value) {
+            prefix(key);
+            m_out << quote(value);
+        }
+        void value(const std::string& key, const char* value) { this->value(key, std::string(value)); }
+        void value(const std::string& key, bool value) {
+            prefix(key);
+            m_out << (value ? "true" : "false");
+        }
+        void value(const std::string& key, double value) {
+            prefix(key);
+            if (std::isfinite(value)) {
+                m_out << value;
+            } else {
+                m_out << "null";
+            }
+        }
+        void value(const std::string& key, uint64_t value) {
+            prefix(key);
+            m_out << value;
+        }
+
+    private:
+        void open(const std::string& key, char bracket) {
+            prefix(key);
+            m_out << bracket;
+            m_first.push_back(true);
+        }
+
+        void close(char bracket) {
+            m_first.pop_back();
+            m_out << "\n" << std::string(2 * m_first.size(), ' ') << bracket;
+            if (m_first.empty()) m_out << "\n";
+        }
+
+        void prefix(const std::string& key) {
+            if (!m_first.empty()) {
+                if (!m_first.back()) m_out << ",";
+                m_first.back() = false;
+                m_out << "\n" << std::string(2 * m_first.size(), ' ');
+                if (!key.empty()) m_out << quote(key) << ": ";
+            }
+        }
+
+        static std::string quote(const std::string& s) {
+            std::string quoted = "\"";
+            for (char c : s) {
+                if (c == '"' || c == '\\') quoted += '\\';
+                quoted += c;
+            }
+            return quoted + "\"";
+        }
+
+        std::ostream& m_out;
+        // One entry per open object or array, whether nothing has been written to it yet
+        std::vector<bool> m_first;
+};
+
+}
@@ -0,0 +1,89 @@
+#include "profiler.h"
+#include "defs.h"
+
+#include <algorithm>
+#include <fstream>
+
+namespace fart {
+
+Profiler&
+Profiler::get() {
+    static Profiler profiler;
+    return profiler;
+}
+
+void
+Profiler::addZone(const char* name, uint64_t start_us, uint64_t duration_us) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    addEvent(name, threadTrack(), start_us, duration_us);
+}
+
+void
+Profiler::addGpuZone(const char* name, uint64_t start_us, uint64_t duration_us) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    addEvent(name, GPU_TRACK, start_us, duration_us);
+}
+
+void
+Profiler::addEvent(const char* name, uint32_t track, uint64_t start_us, uint64_t duration_us) {
+    if (m_events.size() >= MAX_EVENTS) {
+        if (!m_dropped_events) WARN("Profiler reached " + std::to_string(MAX_EVENTS) + " events, dropping the rest");
+        m_dropped_events = true;
+        return;
+    }
+    m_events.push_back({ name, track, start_us, duration_us });
+}
+
+uint32_t
+Profiler::threadTrack() {
+    auto id = std::this_thread::get_id();
+    auto it = std::find(m_threads.begin(), m_threads.end(), id);
+    if (it == m_threads.end()) {
+        m_threads.push_back(id);
+        return (uint32_t)m_threads.size();
+    }
+    return (uint32_t)(it - m_threads.begin()) + 1;
+}
+
+/*
+ * Complete ("X") events plus thread name metadata, see the Trace Event Format:
+ * https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+ */
+bool
+Profiler::writeTrace(const std::string& path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::ofstream file(path, std::ios::trunc);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+    auto trackName = [&](uint32_t track) -> std::string {
+        if (track == GPU_TRACK) return "GPU";
+        if (track == 1) return "Main";
+        return "Worker " + std::to_string(track - 1);
+    };
+    const char* separator = "";
+    for (uint32_t track = 0; track <= m_threads.size(); track++) {
+        file << separator
+             << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << track
+             << ", \"args\": {\"name\": \"" << trackName(track) << "\"}},\n"
+             << "{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << track
+             << ", \"args\": {\"sort_index\": " << (track == GPU_TRACK ? m_threads.size() + 1 : track) << "}}";
+        separator = ",\n";
+    }
+    for (const Event& event : m_events) {
+        file << separator
+             << "{\"name\": \"" << event.name << "\", \"cat\": \"" << (event.track == GPU_TRACK ? "gpu" : "cpu")
+             << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.track
+             << ", \"ts\": " << event.start_us << ", \"dur\": " << event.duration_us << "}";
+    }
+    file << "\n]}\n";
+
+    if (!file) {
+        ERR("Could not write trace " + path);
+        return false;
+    }
+    SUCC("Wrote trace " + path + " (" + std::to_string(m_events.size()) + " events)");
+    return true;
+}
+
+}
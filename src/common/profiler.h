@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fart {
+
+struct PassStats {
+    const char* name;
+    float cpu_ms;
+    // Negative if the pass has no GPU timing (yet)
+    float gpu_ms { -1.f };
+};
+
+/*
+ * Collects named CPU zones from any thread and GPU pass timings and writes them
+ * as a Chrome trace, viewable in chrome://tracing or ui.perfetto.dev. Zones nest
+ * by time on each thread. Events are only kept while recording is enabled.
+ *
+ * Use the FART_PROFILE_* macros, which compile to nothing without FART_PROFILER.
+ */
+struct Profiler {
+
+    public:
+        // About 50 MB of trace, enough for several minutes of interactive frames
+        static constexpr size_t MAX_EVENTS = 1 << 20;
+
+        static Profiler& get();
+
+        void setRecording(bool recording) { m_recording = recording; }
+        bool isRecording() const { return m_recording; }
+
+        // Microseconds since the profiler was created
+        uint64_t now() const {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_t_start).count();
+        }
+
+        // name has to outlive the profiler, i.e. be a string literal
+        void addZone(const char* name, uint64_t start_us, uint64_t duration_us);
+        // GPU zones are shown on their own track, start_us is the CPU time the pass was submitted at
+        void addGpuZone(const char* name, uint64_t start_us, uint64_t duration_us);
+
+        bool writeTrace(const std::string& path);
+
+    private:
+        Profiler() : m_t_start(std::chrono::steady_clock::now()) {}
+
+        struct Event {
+            const char* name;
+            uint32_t track;
+            uint64_t start_us;
+            uint64_t duration_us;
+        };
+
+        static constexpr uint32_t GPU_TRACK = 0;
+
+        void addEvent(const char* name, uint32_t track, uint64_t start_us, uint64_t duration_us);
+        uint32_t threadTrack();
+
+        std::chrono::steady_clock::time_point m_t_start;
+        std::atomic<bool> m_recording { false };
+
+        std::mutex m_mutex;
+        std::vector<Event> m_events;
+        // Track i + 1 belongs to m_threads[i]
+        std::vector<std::thread::id> m_threads;
+        bool m_dropped_events { false };
+};
+
+/*
+ * Measures the CPU time of the enclosing scope. If passes is given, the timing is
+ * also appended to it, e.g. to report it in RenderStats.
+ */
+struct ProfileZone {
+
+    public:
+        ProfileZone(const char* name, std::vector<PassStats>* passes = nullptr)
+            : m_name(name), m_passes(passes), m_start_us(Profiler::get().now()) {}
+        ~ProfileZone() {
+            Profiler& profiler = Profiler::get();
+            uint64_t duration_us = profiler.now() - m_start_us;
+            if (profiler.isRecording()) profiler.addZone(m_name, m_start_us, duration_us);
+            if (m_passes) m_passes->push_back({ m_name, duration_us * 0.001f });
+        }
+
+        ProfileZone(const ProfileZone&) = delete;
+        ProfileZone& operator=(const ProfileZone&) = delete;
+
+    private:
+        const char* m_name;
+        std::vector<PassStats>* m_passes;
+        uint64_t m_start_us;
+};
+
+}
+
+#define FART_PROFILE_CONCAT_IMPL(a, b) a##b
+#define FART_PROFILE_CONCAT(a, b) FART_PROFILE_CONCAT_IMPL(a, b)
+
+#if FART_PROFILER
+#define FART_PROFILE_ZONE(name) fart::ProfileZone FART_PROFILE_CONCAT(fart_profile_zone_, __LINE__)(name)
+#define FART_PROFILE_PASS(name, render_stats) fart::ProfileZone FART_PROFILE_CONCAT(fart_profile_zone_, __LINE__)(name, &(render_stats).passes)
+#else
+#define FART_PROFILE_ZONE(name)
+#define FART_PROFILE_PASS(name, render_stats)
+#endif
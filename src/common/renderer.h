@@ -2,12 +2,18 @@
 
 #include <string>
 #include <memory>
+#include <vector>
 
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 #include <stage.h>
 
+#include "bvh_layout.h"
 #include "defs.h"
+#include "profiler.h"
+#include "split_method.h"
+#include "traversal_stats.h"
+#include "triangle_layout.h"
 #include "window.h"
 
 using namespace stage;
@@ -16,16 +22,76 @@ namespace fart {
 
 struct RenderStats {
     float frame_time_ms;
+    // Per-pass timings, only filled when built with FART_PROFILER
+    std::vector<PassStats> passes;
+    // Summed over all primary rays, only filled in heatmap render modes
+    TraversalStats traversal;
 };
 
 struct Renderer {
     public:
+        // Adaptive sampling estimates the error of square tiles with this many pixels per side
+        static constexpr uint32_t ADAPTIVE_TILE_SIZE = 16;
+        // Samples every pixel takes before the error of its tile is trusted
+        static constexpr uint32_t ADAPTIVE_MIN_SAMPLES = 16;
+
         virtual ~Renderer() = default;
 
         virtual void init(std::shared_ptr<Scene> &scene, std::shared_ptr<Window> &window) = 0;
         virtual void render(const glm::vec3 eye, const glm::vec3 dir, const glm::vec3 up, RenderStats& render_stats) = 0;
         virtual std::string name() = 0;
         virtual size_t preferredVertexAlignment() = 0;
+
+        // Blocks until all submitted work has finished, e.g. to time frames of asynchronous backends
+        virtual void synchronize() {}
+
+        virtual bool supportsRenderMode(RenderMode mode) { return mode == RenderMode::Pathtracing; }
+        void setRenderMode(RenderMode mode) { m_render_mode = mode; }
+        RenderMode getRenderMode() const { return m_render_mode; }
+        // Counter value that maps to the top of the heatmap color ramp
+        void setHeatmapScale(float scale) { m_heatmap_scale = scale; }
+
+        // Takes effect on init, backends without their own traversal ignore it
+        void setTriangleLayout(TriangleLayout layout) { m_triangle_layout = layout; }
+        void setSplitMethod(BVHSplitMethod split_method) { m_split_method = split_method; }
+        void setNodeLayout(BVHLayout layout) { m_node_layout = layout; }
+        // Where built acceleration structures are cached, empty disables the cache
+        void setSceneCacheDirectory(const std::string& directory) { m_scene_cache_directory = directory; }
+
+        // Pathtracing in separate stages over queues of paths instead of one loop per pixel
+        virtual bool supportsWavefront() { return false; }
+        void setWavefront(bool wavefront) { m_wavefront = wavefront; }
+
+        // Tiles whose relative standard error of the mean luminance is at most target_error stop
+        // receiving samples until the accumulation is cleared, 0 samples every pixel every frame
+        virtual bool supportsAdaptiveSampling() { return false; }
+        void setAdaptiveSampling(float target_error) { m_adaptive_error = target_error; }
+        // True once adaptive sampling skips every tile, stalls asynchronous backends
+        virtual bool isConverged() { return false; }
+        // Samples accumulated over all pixels since the last clear, 0 if unknown
+        virtual uint64_t sampleCount() { return 0; }
+
+        // Headless rendering only accumulates and skips presenting frames to the window
+        void setPresentEnabled(bool enabled) { m_present_enabled = enabled; }
+        // Backends that return true accept a null window in init and then render at the
+        // resolution set before, without creating a GL context
+        virtual bool supportsWindowless() { return false; }
+        void setResolution(glm::u32vec2 resolution) { m_resolution = resolution; }
+
+        // Linear radiance accumulated so far, rows bottom to top. Returns false if unsupported
+        virtual bool readAccumulation(std::vector<glm::vec4>& /*pixels*/) { return false; }
+
+    protected:
+        bool m_present_enabled { true };
+        glm::u32vec2 m_resolution { 1280, 720 };
+        RenderMode m_render_mode { RenderMode::Pathtracing };
+        float m_heatmap_scale { 64.f };
+        TriangleLayout m_triangle_layout { TriangleLayout::Indexed };
+        BVHSplitMethod m_split_method { BVHSplitMethod::SAH };
+        BVHLayout m_node_layout { BVHLayout::DFS };
+        std::string m_scene_cache_directory { "fartcache" };
+        bool m_wavefront { false };
+        float m_adaptive_error { 0.f };
 };
 
 }
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+namespace fart {
+
+// How the BLAS builder picks its splits, chosen per scene
+enum BVHSplitMethod : uint32_t {
+    Equal,
+    SAH,
+    // Splits triangles sorted by Morton code, fast to build but lower quality
+    LBVH,
+    // LBVH below SAH split top levels
+    HLBVH,
+    // SAH with spatial splits that duplicate triangle references, best for long, thin triangles
+    SBVH,
+};
+
+inline const char* splitMethodName(BVHSplitMethod split_method) {
+    switch (split_method) {
+        case Equal: return "equal";
+        case SAH: return "sah";
+        case LBVH: return "lbvh";
+        case HLBVH: return "hlbvh";
+        case SBVH: return "sbvh";
+    }
+    return "unknown";
+}
+
+}
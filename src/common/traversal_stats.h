@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+
+namespace fart {
+
+// Work done by ray traversal, per ray or summed over a frame
+struct TraversalStats {
+    // BVH and TLAS nodes popped from the traversal stack
+    uint64_t nodes { 0 };
+    uint64_t aabb_tests { 0 };
+    uint64_t triangle_tests { 0 };
+    // Rays transformed into the object space of an instance
+    uint64_t instance_transforms { 0 };
+
+    TraversalStats& operator+=(const TraversalStats& other) {
+        nodes += other.nodes;
+        aabb_tests += other.aabb_tests;
+        triangle_tests += other.triangle_tests;
+        instance_transforms += other.instance_transforms;
+        return *this;
+    }
+};
+
+/*
+ * Heatmap modes trace primary rays only and show one traversal counter in false
+ * color, scaled by the heatmap scale. The values are shared with the shaders.
+ */
+enum class RenderMode : uint32_t {
+    Pathtracing = 0,
+    HeatmapNodes = 1,
+    HeatmapAABBTests = 2,
+    HeatmapTriangleTests = 3,
+    HeatmapInstanceTransforms = 4,
+};
+
+static constexpr uint32_t RENDER_MODE_COUNT = 5;
+
+inline const char* renderModeName(RenderMode mode) {
+    switch (mode) {
+        case RenderMode::Pathtracing: return "Pathtracing";
+        case RenderMode::HeatmapNodes: return "Nodes";
+        case RenderMode::HeatmapAABBTests: return "AABB tests";
+        case RenderMode::HeatmapTriangleTests: return "Triangle tests";
+        case RenderMode::HeatmapInstanceTransforms: return "Instance transforms";
+    }
+    return "Unknown";
+}
+
+// The counter shown by a heatmap mode
+inline uint64_t heatmapValue(RenderMode mode, const TraversalStats& stats) {
+    switch (mode) {
+        case RenderMode::HeatmapNodes: return stats.nodes;
+        case RenderMode::HeatmapAABBTests: return stats.aabb_tests;
+        case RenderMode::HeatmapTriangleTests: return stats.triangle_tests;
+        case RenderMode::HeatmapInstanceTransforms: return stats.instance_transforms;
+        default: return 0;
+    }
+}
+
+}
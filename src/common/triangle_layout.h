@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+namespace fart {
+
+// How triangle tests read their positions, chosen per scene
+enum class TriangleLayout : uint32_t {
+    // Through the index array into the shared positions, smallest
+    Indexed = 0,
+    // From a stream of v0, edge1 and edge2 per triangle reference without the index
+    // indirection, 36 bytes more per triangle but fewer dependent loads during traversal
+    Precomputed = 1,
+};
+
+inline const char* triangleLayoutName(TriangleLayout layout) {
+    return layout == TriangleLayout::Precomputed ? "precomputed" : "indexed";
+}
+
+}
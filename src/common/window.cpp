@@ -1,13 +1,16 @@
 #include "window.h"
 
+#include "defs.h"
+
 namespace fart {
 
-Window::Window(uint32_t w, uint32_t h, std::string title) : m_width(w), m_height(h), m_window_title(title) {
+Window::Window(uint32_t w, uint32_t h, std::string title, bool visible) 
+    : m_width(w), m_height(h), m_window_title(title), m_visible(visible) {
     initWindow();
 }
 
 Window::~Window() {
-    glfwDestroyWindow(m_window);
+    if (m_window) glfwDestroyWindow(m_window);
     glfwTerminate();
 }
 
@@ -22,19 +25,30 @@ Window::update() {
 
 void
 Window::initWindow() {
-    glfwInit();
+    if (!glfwInit()) {
+        ERR("Could not initialize GLFW");
+        return;
+    }
 
 #if OPENGL_RENDERER
     glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_API);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#elif CPU_RENDERER
+    // The CPU renderer only needs a legacy context to blit its framebuffer
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_API);
 #else 
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 #endif
     glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, m_visible ? GLFW_TRUE : GLFW_FALSE);
 
     m_window = glfwCreateWindow(m_width, m_height, m_window_title.c_str(), nullptr, nullptr);
+    if (!m_window) {
+        ERR("Could not create a window with a rendering context");
+        return;
+    }
 
     glfwSetWindowUserPointer(m_window, this);
     glfwSetWindowSizeCallback(m_window, [](GLFWwindow* window, int width, int height) {
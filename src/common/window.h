@@ -12,7 +12,8 @@ struct Window {
 
     public:
 
-        Window(uint32_t width, uint32_t height, std::string window_title);
+        // Invisible windows still provide a context, e.g. for headless rendering
+        Window(uint32_t width, uint32_t height, std::string window_title, bool visible = true);
         ~Window();
 
         Window(const Window &) = delete;
@@ -20,6 +21,9 @@ struct Window {
 
         void update();
 
+        // False if GLFW or the window failed to initialize, e.g. without a display
+        bool isValid() const { return m_window != nullptr; }
+
         GLFWwindow* getGlfwWindow() { return m_window; }
         void setWindowTitle(std::string window_title) { glfwSetWindowTitle(m_window, window_title.c_str()); }
 
@@ -61,8 +65,9 @@ struct Window {
         uint32_t m_height;
 
         std::string m_window_title;
+        bool m_visible;
 
-        GLFWwindow *m_window;
+        GLFWwindow *m_window { nullptr };
 
         bool m_window_focused;
         glm::vec2 m_mouse_position;
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+namespace fart {
+
+inline glm::vec4 tonemap_Reinhard(glm::vec4 C) {
+    return C / (C + 1.f);
+}
+
+inline glm::vec4 tonemap_Exposure(glm::vec4 C, float exposure) {
+    return glm::vec4(1.0f) - glm::exp(-C * exposure);
+}
+
+inline glm::vec4 tonemap_ACES(glm::vec4 C) {
+    float a = 2.51f;
+    float b = 0.03f;
+    float c = 2.43f;
+    float d = 0.59f;
+    float e = 0.14f;
+    return glm::clamp((C*(a*C + b)) / (C*(c*C + d) + e), 0.0f, 1.0f);
+}
+
+// Rec. 709 luminance of linear RGB
+inline float luminance(glm::vec3 C) {
+    return glm::dot(C, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+inline glm::vec4 gamma(glm::vec4 C) {
+    return glm::pow(C, glm::vec4(0.4545f)); // 1.f / 2.2f = 0.4545f
+}
+
+// False color ramp from blue (0) over green to red (1), white above 1
+inline glm::vec4 heatmap(float t) {
+    if (t > 1.f) return glm::vec4(1.f);
+    glm::vec3 c = glm::vec3(1.5f) - glm::abs(4.f * glm::vec3(t) - glm::vec3(3.f, 2.f, 1.f));
+    return glm::vec4(glm::clamp(c, 0.f, 1.f), 1.f);
+}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <stage.h>
+
+#include "opengl/bvh.h"
+#include "opengl/geometry.h"
+#include "opengl/ggx_albedo.h"
+#include "opengl/wide_bvh.h"
+#include "opengl/tlas.h"
+#include "cpu/texture.h"
+
+using namespace stage;
+
+namespace fart {
+
+/*
+ * Pointers to the flat scene arrays the kernels read from.
+ * Mirrors the storage buffer bindings of the OpenGL renderer.
+ */
+struct SceneData {
+    float scene_scale;
+
+    const glm::vec3* positions;
+    const VertexAttributes* attributes;
+    const uint32_t* indices;
+    // Material id per index triple, by first_index / 3
+    const uint32_t* triangle_materials;
+    // Same order, nullptr unless the scene uses TriangleLayout::Precomputed
+    const TrianglePositions* triangles;
+    const BLASNode* bvh;
+    const TLASNode* tlas;
+    const uint32_t* blas_offsets;
+    const ObjectInstance* instances;
+    const glm::mat4* instance_to_world;
+    const OpenPBRMaterial* materials;
+    // See material_flags.h
+    const uint32_t* material_flags;
+    const Texture* textures;
+    const GGXAlbedoLUT* ggx_albedo;
+};
+
+}
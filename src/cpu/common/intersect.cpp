@@ -0,0 +1,352 @@
+#include "intersect.h"
+#include "isa.h"
+#include "sampling.h"
+#include "opengl/material_flags.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace fart {
+
+glm::vec3
+getNormal(const SceneData& scene, uint32_t first_index, glm::vec3 bary) {
+    glm::vec3 n0 = decodeNormal(scene.attributes[scene.indices[first_index+0]].normal);
+    glm::vec3 n1 = decodeNormal(scene.attributes[scene.indices[first_index+1]].normal);
+    glm::vec3 n2 = decodeNormal(scene.attributes[scene.indices[first_index+2]].normal);
+
+    return glm::normalize(n0 * bary.x + n1 * bary.y + n2 * bary.z);
+}
+
+glm::vec2
+getUV(const SceneData& scene, uint32_t first_index, glm::vec3 bary) {
+    glm::vec2 uv0 = decodeUV(scene.attributes[scene.indices[first_index+0]].uv);
+    glm::vec2 uv1 = decodeUV(scene.attributes[scene.indices[first_index+1]].uv);
+    glm::vec2 uv2 = decodeUV(scene.attributes[scene.indices[first_index+2]].uv);
+
+    return uv0 * bary.x + uv1 * bary.y + uv2 * bary.z;
+}
+
+bool
+anyHit(const SceneData& scene, const OpenPBRMaterial& mat, uint32_t first_index, glm::vec3 bary) {
+    glm::vec2 uv = getUV(scene, first_index, bary);
+    return scene.textures[mat.base_color_texid].sample(uv).w >= ALPHA_CUTOFF;
+}
+
+void
+getTriangle(const SceneData& scene, uint32_t first_index, glm::vec3& v0, glm::vec3& edge1, glm::vec3& edge2) {
+    if (scene.triangles) {
+        const TrianglePositions& triangle = scene.triangles[first_index / 3];
+        v0 = triangle.v0;
+        edge1 = triangle.edge1;
+        edge2 = triangle.edge2;
+    } else {
+        v0 = scene.positions[scene.indices[first_index+0]];
+        edge1 = scene.positions[scene.indices[first_index+1]] - v0;
+        edge2 = scene.positions[scene.indices[first_index+2]] - v0;
+    }
+}
+
+bool
+intersectTriangle(const SceneData& scene, Ray& ray, Hit& hit, uint32_t first_index) {
+    glm::vec3 v0, edge1, edge2;
+    getTriangle(scene, first_index, v0, edge1, edge2);
+
+    const glm::vec3 h = glm::cross( ray.d, edge2 );
+    const float a = glm::dot( edge1, h );
+    if (a > -EPS && a < EPS) return false; // ray parallel to triangle
+    const float f = 1 / a;
+    const glm::vec3 s = ray.o - v0;
+    const float u = f * glm::dot( s, h );
+    if (u < 0 || u > 1) return false;
+    const glm::vec3 q = glm::cross( s, edge1 );
+    const float v = f * glm::dot( ray.d, q );
+    if (v < 0 || u + v > 1) return false;
+    const float t = f * glm::dot( edge2, q );
+    if (t > EPS && t < ray.t) {
+        // Opaque materials never touch their textures here
+        uint32_t material_id = scene.triangle_materials[first_index / 3];
+        if (scene.material_flags[material_id] & MATERIAL_ALPHA_TESTED) {
+            if (!anyHit(scene, scene.materials[material_id], first_index, glm::vec3(1.f - u - v, u, v))) return false;
+        }
+
+        ray.t = t;
+        hit.first_index = first_index;
+        hit.bary = glm::vec2(u, v);
+        hit.valid = true;
+        return true;
+    }
+    return false;
+}
+
+float
+intersectAABB(const Ray& ray, const glm::vec3& bmin, const glm::vec3& bmax) {
+    float tx1 = (bmin.x - ray.o.x) * ray.rD.x, tx2 = (bmax.x - ray.o.x) * ray.rD.x;
+    float tmin = std::min( tx1, tx2 ), tmax = std::max( tx1, tx2 );
+    float ty1 = (bmin.y - ray.o.y) * ray.rD.y, ty2 = (bmax.y - ray.o.y) * ray.rD.y;
+    tmin = std::max( tmin, std::min( ty1, ty2 ) ), tmax = std::min( tmax, std::max( ty1, ty2 ) );
+    float tz1 = (bmin.z - ray.o.z) * ray.rD.z, tz2 = (bmax.z - ray.o.z) * ray.rD.z;
+    tmin = std::max( tmin, std::min( tz1, tz2 ) ), tmax = std::min( tmax, std::max( tz1, tz2 ) );
+
+    if (tmax >= tmin && tmin < ray.t && tmax > 0) return tmin;
+    return 1e30f; 
+}
+
+/*
+ * Tests the triangles of a leaf LEAF_BATCH at a time, so that Möller-Trumbore runs as one
+ * vector loop over the batch. Hits are committed in triangle order, which gives the same
+ * closest hit as calling intersectTriangle for each triangle.
+ */
+FART_TARGET_CLONES
+void
+intersectLeaf(const SceneData& scene, Ray& ray, Hit& hit, uint32_t first_index, uint32_t count) {
+    constexpr uint32_t LEAF_BATCH = 8;
+    if (count == 1) {
+        intersectTriangle(scene, ray, hit, first_index);
+        return;
+    }
+
+    for (uint32_t first = 0; first < count; first += LEAF_BATCH) {
+        uint32_t n = std::min(LEAF_BATCH, count - first);
+
+        // Partial batches repeat their last triangle, which is never committed
+        alignas(32) float v0[3][LEAF_BATCH], edge1[3][LEAF_BATCH], edge2[3][LEAF_BATCH];
+        for (uint32_t i = 0; i < LEAF_BATCH; i++) {
+            glm::vec3 p, e1, e2;
+            getTriangle(scene, first_index + 3 * (first + std::min(i, n - 1)), p, e1, e2);
+            for (uint32_t axis = 0; axis < 3; axis++) {
+                v0[axis][i] = p[axis];
+                edge1[axis][i] = e1[axis];
+                edge2[axis][i] = e2[axis];
+            }
+        }
+
+        alignas(32) float u[LEAF_BATCH], v[LEAF_BATCH], t[LEAF_BATCH];
+        alignas(32) uint32_t hit_mask[LEAF_BATCH];
+        for (uint32_t i = 0; i < LEAF_BATCH; i++) {
+            float hx = ray.d.y * edge2[2][i] - ray.d.z * edge2[1][i];
+            float hy = ray.d.z * edge2[0][i] - ray.d.x * edge2[2][i];
+            float hz = ray.d.x * edge2[1][i] - ray.d.y * edge2[0][i];
+            float a = edge1[0][i] * hx + edge1[1][i] * hy + edge1[2][i] * hz;
+            float f = 1 / a;
+            float sx = ray.o.x - v0[0][i], sy = ray.o.y - v0[1][i], sz = ray.o.z - v0[2][i];
+            u[i] = f * (sx * hx + sy * hy + sz * hz);
+            float qx = sy * edge1[2][i] - sz * edge1[1][i];
+            float qy = sz * edge1[0][i] - sx * edge1[2][i];
+            float qz = sx * edge1[1][i] - sy * edge1[0][i];
+            v[i] = f * (ray.d.x * qx + ray.d.y * qy + ray.d.z * qz);
+            t[i] = f * (edge2[0][i] * qx + edge2[1][i] * qy + edge2[2][i] * qz);
+
+            // Bitwise ands keep the loop free of branches
+            hit_mask[i] = ((a <= -EPS) | (a >= EPS)) &
+                          (u[i] >= 0) & (u[i] <= 1) & (v[i] >= 0) & (u[i] + v[i] <= 1) &
+                          (t[i] > EPS);
+        }
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (!hit_mask[i] || !(t[i] < ray.t)) continue;
+            uint32_t index = first_index + 3 * (first + i);
+            uint32_t material_id = scene.triangle_materials[index / 3];
+            if (scene.material_flags[material_id] & MATERIAL_ALPHA_TESTED) {
+                if (!anyHit(scene, scene.materials[material_id], index, glm::vec3(1.f - u[i] - v[i], u[i], v[i]))) continue;
+            }
+
+            ray.t = t[i];
+            hit.first_index = index;
+            hit.bary = glm::vec2(u[i], v[i]);
+            hit.valid = true;
+        }
+    }
+}
+
+// Same slab test as intersectAABB on all slots in one vector loop, empty slots never hit
+FART_TARGET_CLONES
+void
+intersectChildren(const WideBVHNode& node, const Ray& ray, float* child_dist) {
+    constexpr uint32_t width = WideBVH::WIDTH;
+    glm::vec3 scale;
+    for (uint32_t axis = 0; axis < 3; axis++)
+        scale[axis] = std::ldexp(1.f, (int)((node.exponents >> (8 * axis)) & 0xff) - 127);
+
+    for (uint32_t i = 0; i < width; i++) {
+        float tx1 = (node.origin.x + node.bounds[i] * scale.x - ray.o.x) * ray.rD.x;
+        float tx2 = (node.origin.x + node.bounds[3 * width + i] * scale.x - ray.o.x) * ray.rD.x;
+        float tmin = std::min(tx1, tx2), tmax = std::max(tx1, tx2);
+        float ty1 = (node.origin.y + node.bounds[width + i] * scale.y - ray.o.y) * ray.rD.y;
+        float ty2 = (node.origin.y + node.bounds[4 * width + i] * scale.y - ray.o.y) * ray.rD.y;
+        tmin = std::max(tmin, std::min(ty1, ty2)), tmax = std::min(tmax, std::max(ty1, ty2));
+        float tz1 = (node.origin.z + node.bounds[2 * width + i] * scale.z - ray.o.z) * ray.rD.z;
+        float tz2 = (node.origin.z + node.bounds[5 * width + i] * scale.z - ray.o.z) * ray.rD.z;
+        tmin = std::max(tmin, std::min(tz1, tz2)), tmax = std::min(tmax, std::max(tz1, tz2));
+
+        bool hit_child = (tmax >= tmin) & (tmin < ray.t) & (tmax > 0.f) & (node.children[i] != 0);
+        child_dist[i] = hit_child ? tmin : 1e30f;
+    }
+}
+
+#if BVH_WIDTH > 2
+/*
+ * All child slots are tested against their dequantized bounds at once. Leaf children are
+ * intersected right away, inner children are pushed far to near so that the nearest is visited next.
+ */
+FART_TARGET_CLONES
+void
+intersectBLAS(const SceneData& scene, Ray& ray, Hit& hit, uint32_t bvh_offset, TraversalStats* stats, uint32_t root) {
+    constexpr uint32_t width = WideBVH::WIDTH;
+    // Large enough for any path, see WideBVH::collapse
+    uint32_t stack[WideBVH::MAX_STACK];
+    int current = 0;
+    stack[current] = bvh_offset + root;
+
+    do {
+        const WideBVHNode& node = scene.bvh[stack[current--]];
+        if (stats) stats->nodes++;
+        alignas(32) float child_dist[width];
+        intersectChildren(node, ray, child_dist);
+
+        uint32_t inner[width];
+        float inner_dist[width];
+        int n_inner = 0;
+        for (uint32_t i = 0; i < width; i++) {
+            uint32_t child = node.children[i];
+            if (child == 0) continue;
+            if (stats) stats->aabb_tests++;
+            // Leaves of earlier slots may have shortened the ray since
+            float dist = child_dist[i];
+            if (!(dist < ray.t)) continue;
+
+            if (WideBVH::isLeaf(child)) {
+                if (stats) stats->triangle_tests += WideBVH::leafTriCount(child);
+                intersectLeaf(scene, ray, hit, 3 * WideBVH::leafFirstTriangle(child), WideBVH::leafTriCount(child));
+            } else {
+                int j = n_inner++;
+                while (j > 0 && inner_dist[j - 1] < dist) {
+                    inner[j] = inner[j - 1];
+                    inner_dist[j] = inner_dist[j - 1];
+                    j--;
+                }
+                inner[j] = bvh_offset + child;
+                inner_dist[j] = dist;
+            }
+        }
+
+        for (int i = 0; i < n_inner; i++)
+            stack[++current] = inner[i];
+
+    } while (current >= 0);
+}
+#else
+FART_TARGET_CLONES
+void
+intersectBLAS(const SceneData& scene, Ray& ray, Hit& hit, uint32_t bvh_offset, TraversalStats* stats, uint32_t root) {
+    uint32_t stack[64];
+    int current = 0;
+    stack[current] = bvh_offset + root;
+
+    do {
+        const BVHNode& node = scene.bvh[stack[current--]];
+        if (stats) stats->nodes++;
+
+        if (node.left_child == 0) {
+            // intersect triangles in the node
+            if (stats) stats->triangle_tests += node.tri_count;
+            intersectLeaf(scene, ray, hit, node.first_tri_index_id, node.tri_count);
+        } else {
+            const BVHNode& left = scene.bvh[bvh_offset + node.left_child];
+            const BVHNode& right = scene.bvh[bvh_offset + node.left_child + 1];
+            float left_dist = intersectAABB(ray, left.aabb.min, left.aabb.max);
+            float right_dist = intersectAABB(ray, right.aabb.min, right.aabb.max);
+            if (stats) stats->aabb_tests += 2;
+
+            if (left_dist > right_dist) {
+                if (left_dist < 1e30f) stack[++current] = bvh_offset + node.left_child;
+                if (right_dist < 1e30f) stack[++current] = bvh_offset + node.left_child+1;
+            } else {
+                if (right_dist < 1e30f) stack[++current] = bvh_offset + node.left_child+1;
+                if (left_dist < 1e30f) stack[++current] = bvh_offset + node.left_child;
+            }
+        }
+        
+    } while(current >= 0 && current < 62);
+}
+
+#endif
+
+SurfaceInteraction
+resolveHit(const SceneData& scene, const Ray& ray, const Hit& hit) {
+    SurfaceInteraction si;
+    si.p = ray.o + ray.d * ray.t;
+    if (!hit.valid) return si;
+
+    const uint32_t first_index = hit.first_index;
+    const glm::vec3 v0 = scene.positions[scene.indices[first_index+0]];
+    const glm::vec3 v1 = scene.positions[scene.indices[first_index+1]];
+    const glm::vec3 v2 = scene.positions[scene.indices[first_index+2]];
+    const glm::vec3 bary = glm::vec3(1.f - hit.bary.x - hit.bary.y, hit.bary.x, hit.bary.y);
+
+    // Normals face the ray in object space before they are transformed to world
+    const glm::vec3 d = glm::vec3(scene.instances[hit.instance].world_to_instance * glm::vec4(ray.d, 0.f));
+    glm::vec3 face_normal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+    glm::vec3 vertex_normal = getNormal(scene, first_index, bary);
+    vertex_normal = vertex_normal * (glm::dot(face_normal, -d) < 0.f ? -1.f : 1.f);
+
+    si.uv = getUV(scene, first_index, bary);
+    si.n = glm::normalize(glm::vec3(scene.instance_to_world[hit.instance] * glm::vec4(vertex_normal, 0.f)));
+    si.w_o = -ray.d;
+    si.mat = &scene.materials[scene.triangle_materials[first_index / 3]];
+    si.valid = true;
+    return si;
+}
+
+SurfaceInteraction
+intersect(const SceneData& scene, Ray ray, TraversalStats* stats) {
+    Hit hit = traverse(scene, ray, stats);
+    return resolveHit(scene, ray, hit);
+}
+
+Hit
+traverse(const SceneData& scene, Ray& ray, TraversalStats* stats) {
+    Hit hit;
+
+    uint32_t stack[64];
+    int current = 0;
+    stack[current] = 0;
+
+    do {
+        const TLASNode& node = scene.tlas[stack[current--]];
+        if (stats) stats->nodes++;
+        if (node.left_child == 0) {
+            if (stats) stats->instance_transforms += node.instance_count;
+            for (uint32_t i = 0; i < node.instance_count; i++) {
+                uint32_t instance = node.first_instance_id + i;
+                Ray ray_backup = ray;
+                const glm::mat4& xfm = scene.instances[instance].world_to_instance;
+                ray.o = glm::vec3(xfm * glm::vec4(ray.o, 1));
+                ray.d = glm::vec3(xfm * glm::vec4(ray.d, 0));
+                ray.rD = 1.f / ray.d;
+
+                intersectBLAS(scene, ray, hit, scene.blas_offsets[scene.instances[instance].object_id], stats);
+                if (ray.t < ray_backup.t) hit.instance = instance;
+                ray_backup.t = ray.t;
+                ray = ray_backup;
+            }
+        } else {
+            const TLASNode& left = scene.tlas[node.left_child];
+            const TLASNode& right = scene.tlas[node.left_child + 1];
+            float left_dist = intersectAABB(ray, left.aabb.min, left.aabb.max);
+            float right_dist = intersectAABB(ray, right.aabb.min, right.aabb.max);
+            if (stats) stats->aabb_tests += 2;
+
+            if (left_dist > right_dist) {
+                if (left_dist < 1e30f) stack[++current] = node.left_child;
+                if (right_dist < 1e30f) stack[++current] = node.left_child+1;
+            } else {
+                if (right_dist < 1e30f) stack[++current] = node.left_child+1;
+                if (left_dist < 1e30f) stack[++current] = node.left_child;
+            }
+        }
+    } while (current >= 0 && current < 62);
+
+    return hit;
+}
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "types.h"
+#include "data.h"
+#include "common/traversal_stats.h"
+
+namespace fart {
+
+glm::vec3 getNormal(const SceneData& scene, uint32_t first_index, glm::vec3 bary);
+glm::vec2 getUV(const SceneData& scene, uint32_t first_index, glm::vec3 bary);
+
+// Any-hit test of alpha tested materials, false if the hit falls into a cutout
+bool anyHit(const SceneData& scene, const OpenPBRMaterial& mat, uint32_t first_index, glm::vec3 bary);
+// First vertex and edges, from the precomputed triangles if the scene has them
+void getTriangle(const SceneData& scene, uint32_t first_index, glm::vec3& v0, glm::vec3& edge1, glm::vec3& edge2);
+bool intersectTriangle(const SceneData& scene, Ray& ray, Hit& hit, uint32_t first_index);
+float intersectAABB(const Ray& ray, const glm::vec3& bmin, const glm::vec3& bmax);
+// Closest hit among count triangles from first_index on, same result as intersectTriangle on each in order
+void intersectLeaf(const SceneData& scene, Ray& ray, Hit& hit, uint32_t first_index, uint32_t count);
+// Entry distance of every child slot of a wide node, 1e30f for empty slots and misses.
+// child_dist holds WideBVH::WIDTH floats
+void intersectChildren(const WideBVHNode& node, const Ray& ray, float* child_dist);
+// stats, if given, accumulates the traversal work of the ray. root starts at a subtree, relative to bvh_offset
+void intersectBLAS(const SceneData& scene, Ray& ray, Hit& hit, uint32_t bvh_offset, TraversalStats* stats = nullptr, uint32_t root = 0);
+// Interpolates the attributes of the closest hit, ray is the world space ray that found it
+SurfaceInteraction resolveHit(const SceneData& scene, const Ray& ray, const Hit& hit);
+SurfaceInteraction intersect(const SceneData& scene, Ray ray, TraversalStats* stats = nullptr);
+// Closest hit without resolving it, the t of the ray ends at the hit
+Hit traverse(const SceneData& scene, Ray& ray, TraversalStats* stats = nullptr);
+
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+/*
+ * Compiles a function once per x86-64 vector extension below and lets the dynamic loader pick
+ * the widest one the CPU supports, so one binary runs the ray kernels with AVX-512 or AVX2
+ * where available and with SSE2 elsewhere. Calls between functions that carry the attribute
+ * stay within the chosen extension. The CMake targets turn off FMA contraction, so every
+ * version computes bitwise identical results.
+ *
+ * Needs GCC or Clang with ifunc support. Builds with ENABLE_NATIVE_ISA compile for the build
+ * machine instead and leave it empty, as do all other targets.
+ */
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__) && !defined(FART_NATIVE_ISA)
+#define FART_TARGET_CLONES __attribute__((target_clones("default", "avx2", "avx512f")))
+#else
+#define FART_TARGET_CLONES
+#endif
@@ -0,0 +1,206 @@
+/*
+ * Implementation of the OpenPBR material model
+ * References:
+ * https://academysoftwarefoundation.github.io/OpenPBR/#model/
+ * https://cwyman.org/code/dxrTutors/tutors/Tutor14/tutorial14.md.html
+ *
+ */
+#pragma once
+
+#include <cfloat>
+#include <cmath>
+#include <glm/glm.hpp>
+
+#include "types.h"
+#include "data.h"
+#include "random.h"
+#include "sampling.h"
+
+namespace fart {
+
+/* 
+ * General Functions
+ *
+ */
+inline glm::vec3 fresnelSchlick(glm::vec3 f0, float cos_theta) {
+    return f0 + (glm::vec3(1.f) - f0) * std::pow(1.f - cos_theta, 5.f);
+}
+
+inline float ggxGeomtric(float roughness, float cos_theta_i, float cos_theta_o) {
+    float k = roughness * roughness / 2.f;
+    float g_i = cos_theta_i / std::max(FLT_MIN, (cos_theta_i*(1.f-k) + k));
+    float g_o = cos_theta_o / std::max(FLT_MIN, (cos_theta_o*(1.f-k) + k));
+    return g_o * g_i;
+}
+
+inline float ggxShadowing(float roughness, float cos_theta_h) {
+    float cos_theta_h2 = cos_theta_h * cos_theta_h;
+    float a2 = roughness * roughness;
+    float d = (cos_theta_h2 * (a2 - 1.f)) + 1.f;
+    return a2 / std::max(FLT_MIN, d * d) * ONE_OVER_PI;
+}
+
+inline float pdf_ggx(const SurfaceInteraction&  si, 
+                     glm::vec3                  w_i, 
+                     glm::vec3                  w_o) 
+{
+    float theta_i = glm::dot(si.n, w_i);
+    if (theta_i < 0.f) return 0.f;
+
+    glm::vec3 h = glm::normalize(w_i + w_o);
+    float ndoth = glm::dot(si.n, h);
+    float D = ggxShadowing(si.mat->specular_roughness, ndoth);
+
+    return D * ndoth / std::max(FLT_MIN, 4 * glm::dot(w_o, h));
+}
+
+inline glm::vec3 sample_ggx(const SurfaceInteraction&   si, 
+                            RNG&                        rng) {
+    glm::vec3 h = randomGGXMicrofacet(next_random2f(rng), si.n, si.mat->specular_roughness);
+    glm::vec3 w = glm::reflect(-si.w_o, h);
+
+    return w;
+}
+
+inline glm::vec3 eval_ggx(const SurfaceInteraction& si,
+                          glm::vec3                 w_i,
+                          glm::vec3                 w_o,
+                          glm::vec3                 f0)
+{
+    glm::vec3 h = glm::normalize(w_i + w_o);
+    float hdotl = std::max(0.f, glm::dot(w_i, h));
+    float ndotv = std::max(FLT_MIN, glm::dot(si.n, w_o));
+    float ndotl = std::max(FLT_MIN, glm::dot(si.n, w_i));
+    float ndoth = std::max(0.f, glm::dot(si.n, h));
+
+    // fresnel
+    glm::vec3 F = si.mat->specular_weight * glm::vec3(si.mat->specular_color) * fresnelSchlick(f0, hdotl);
+    
+    // geometric
+    float G = ggxGeomtric(si.mat->specular_roughness, ndotl, ndotv);
+
+    // shadowing
+    float D = ggxShadowing(si.mat->specular_roughness, ndoth);
+
+    return (F * G * D) / (4.f * ndotv /* * ndotl */) /* * ndotl */; // ndotl (theta_i) left out for numerical robustness
+}
+
+
+inline float pdf_lambert(const SurfaceInteraction&  si, 
+                         glm::vec3                  w_i, 
+                         glm::vec3                  w_o) 
+{
+    float theta_i = glm::dot(si.n, w_i);
+    if (theta_i < 0.f) return 0.f;
+    return theta_i * ONE_OVER_PI;
+}
+
+inline glm::vec3 sample_lambert(const SurfaceInteraction&   si, 
+                                RNG&                        rng) 
+{
+    glm::vec3 w = randomCosineHemispherePoint(next_random2f(rng), si.n);
+    return w;
+}
+
+/* 
+ * PBR Components
+ *
+ */
+inline glm::vec3 base_color(const SceneData&            scene,
+                            const SurfaceInteraction&   si)
+{
+    if (si.mat->base_color_texid >= 0)
+        return glm::vec3(scene.textures[si.mat->base_color_texid].sample(si.uv));
+    return glm::vec3(si.mat->base_color);
+}
+
+inline glm::vec3 eval_metal(const SceneData&            scene,
+                            const SurfaceInteraction&   si,
+                            glm::vec3                   w_i,
+                            glm::vec3                   w_o)
+{
+    // base reflectance
+    glm::vec3 f0 = base_color(scene, si) * si.mat->base_weight;
+    return eval_ggx(si, w_i, w_o, f0);
+}
+
+inline glm::vec3 eval_glossy(const SurfaceInteraction&  si, 
+                             glm::vec3                  w_i, 
+                             glm::vec3                  w_o) 
+{
+    // base reflectance
+    glm::vec3 f0 = glm::vec3(1.f) * std::pow((1.f - si.mat->specular_ior) / (1.f + si.mat->specular_ior), 2.f);
+    return eval_ggx(si, w_i, w_o, f0);
+}
+
+inline glm::vec3 eval_diffuse(const SceneData&          scene,
+                              const SurfaceInteraction& si, 
+                              glm::vec3                 w_i, 
+                              glm::vec3                 w_o) 
+{
+    glm::vec3 f = base_color(scene, si);
+    f *= si.mat->base_weight * glm::dot(w_i, si.n) * ONE_OVER_PI;
+    return f;
+}
+
+/* 
+ * GGX Microfacet reflectance from the precomputed directional albedo, see GGXAlbedoLUT.
+ * The geometric term gains energy at grazing angles, so the result is clamped to one.
+ */
+inline glm::vec3 ggx_reflectance(const SceneData&           scene,
+                                 const SurfaceInteraction&  si, 
+                                 glm::vec3                  w_o) {
+    float f0 = std::pow((1.f - si.mat->specular_ior) / (1.f + si.mat->specular_ior), 2.f);
+    glm::vec2 albedo = scene.ggx_albedo->lookup(si.mat->specular_roughness, glm::dot(si.n, w_o));
+    glm::vec3 E = si.mat->specular_weight * glm::vec3(si.mat->specular_color) * (f0 * albedo.x + albedo.y);
+    return glm::min(E, glm::vec3(1.f));
+}
+
+/*
+ * Top-Level BxDF functions called by the renderer
+ *
+ */
+inline float bsdf_pdf(const SurfaceInteraction& si, 
+                      glm::vec3                 w_i, 
+                      glm::vec3                 w_o) 
+{
+    float diffuse = pdf_lambert(si, w_i, w_o);
+    float glossy = pdf_ggx(si, w_i, w_o);
+
+    return (diffuse + glossy) / 2.f;
+}
+
+inline glm::vec3 bsdf_sample(const SurfaceInteraction&  si, 
+                             float&                     pdf, 
+                             RNG&                       rng)
+{
+    glm::vec3 w;
+
+    // TODO: Find better heuristic to choose the sampler
+    int bsdf_component = int(next_randomf(rng) * 2.f);
+    if (bsdf_component == 0) {
+        w = sample_lambert(si, rng);
+    } else {
+        w = sample_ggx(si, rng);
+    } 
+
+    pdf = bsdf_pdf(si, w, si.w_o);
+    return w;
+}
+
+inline glm::vec3 bsdf_eval(const SceneData&             scene,
+                           const SurfaceInteraction&    si, 
+                           glm::vec3                    w_i, 
+                           glm::vec3                    w_o)
+{
+    glm::vec3 E_specular = ggx_reflectance(scene, si, w_o);
+    glm::vec3 diffuse = eval_diffuse(scene, si, w_i, w_o);
+    glm::vec3 glossy = eval_glossy(si, w_i, w_o);
+    glm::vec3 metal = eval_metal(scene, si, w_i, w_o);
+
+    glm::vec3 dielectric = glossy + (glm::vec3(1.f) - E_specular) * diffuse;
+
+    return glm::mix(dielectric, metal, si.mat->base_metalness);
+}
+
+}
@@ -0,0 +1,374 @@
+#include "packet.h"
+#include "intersect.h"
+#include "isa.h"
+#include "sampling.h"
+#include "opengl/material_flags.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace fart {
+
+static constexpr uint32_t N = RayPacket::SIZE;
+
+struct StackEntry {
+    uint32_t node;
+    // Lanes that entered the node
+    uint32_t mask;
+};
+
+/*
+ * Bounds of the origins and reciprocal directions of a set of lanes, which reject a box for
+ * all of them with a single interval test. Only valid if the direction sign of every axis is
+ * the same in all lanes, since the near and far planes of a box differ between lanes otherwise.
+ */
+struct PacketInterval {
+    glm::vec3 o_min { 1e30f };
+    glm::vec3 o_max { -1e30f };
+    glm::vec3 rD_min { 1e30f };
+    glm::vec3 rD_max { -1e30f };
+    float t_max { 0.f };
+    bool valid { true };
+};
+
+RayPacket::RayPacket() {
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        std::fill(o[axis], o[axis] + N, 0.f);
+        std::fill(d[axis], d[axis] + N, 1.f);
+        std::fill(rD[axis], rD[axis] + N, 1.f);
+    }
+    std::fill(t, t + N, 0.f);
+}
+
+void
+RayPacket::set(uint32_t lane, const Ray& ray) {
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        o[axis][lane] = ray.o[axis];
+        d[axis][lane] = ray.d[axis];
+        rD[axis][lane] = ray.rD[axis];
+    }
+    t[lane] = ray.t;
+    active |= 1u << lane;
+}
+
+Ray
+RayPacket::get(uint32_t lane) const {
+    Ray ray;
+    ray.o = glm::vec3(o[0][lane], o[1][lane], o[2][lane]);
+    ray.d = glm::vec3(d[0][lane], d[1][lane], d[2][lane]);
+    ray.rD = glm::vec3(rD[0][lane], rD[1][lane], rD[2][lane]);
+    ray.t = t[lane];
+    return ray;
+}
+
+static uint32_t
+laneCount(uint32_t mask) {
+    uint32_t count = 0;
+    for (; mask; mask &= mask - 1) count++;
+    return count;
+}
+
+static PacketInterval
+packetInterval(const RayPacket& packet, uint32_t mask) {
+    PacketInterval interval;
+    for (uint32_t i = 0; i < N; i++) {
+        if (!(mask & (1u << i))) continue;
+        for (uint32_t axis = 0; axis < 3; axis++) {
+            interval.o_min[axis] = std::min(interval.o_min[axis], packet.o[axis][i]);
+            interval.o_max[axis] = std::max(interval.o_max[axis], packet.o[axis][i]);
+            interval.rD_min[axis] = std::min(interval.rD_min[axis], packet.rD[axis][i]);
+            interval.rD_max[axis] = std::max(interval.rD_max[axis], packet.rD[axis][i]);
+            // Axis parallel rays have no finite bound
+            if (!std::isfinite(packet.rD[axis][i])) interval.valid = false;
+        }
+        interval.t_max = std::max(interval.t_max, packet.t[i]);
+    }
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        if (interval.rD_min[axis] < 0.f && interval.rD_max[axis] > 0.f) interval.valid = false;
+    }
+    return interval;
+}
+
+// Range of a * r for a in [a_lo, a_hi] and r in [r_lo, r_hi]
+static void
+intervalProduct(float a_lo, float a_hi, float r_lo, float r_hi, float& lo, float& hi) {
+    float p0 = a_lo * r_lo, p1 = a_lo * r_hi, p2 = a_hi * r_lo, p3 = a_hi * r_hi;
+    lo = std::min(std::min(p0, p1), std::min(p2, p3));
+    hi = std::max(std::max(p0, p1), std::max(p2, p3));
+}
+
+// False only if no ray within the interval can hit the box
+static bool
+intersectInterval(const PacketInterval& interval, const glm::vec3& bmin, const glm::vec3& bmax) {
+    if (!interval.valid) return true;
+
+    float t_near = -1e30f, t_far = 1e30f;
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        bool positive = interval.rD_min[axis] > 0.f;
+        float near_plane = positive ? bmin[axis] : bmax[axis];
+        float far_plane = positive ? bmax[axis] : bmin[axis];
+
+        float near_lo, near_hi, far_lo, far_hi;
+        intervalProduct(near_plane - interval.o_max[axis], near_plane - interval.o_min[axis],
+                        interval.rD_min[axis], interval.rD_max[axis], near_lo, near_hi);
+        intervalProduct(far_plane - interval.o_max[axis], far_plane - interval.o_min[axis],
+                        interval.rD_min[axis], interval.rD_max[axis], far_lo, far_hi);
+        t_near = std::max(t_near, near_lo);
+        t_far = std::min(t_far, far_hi);
+    }
+    return t_far >= t_near && t_near < interval.t_max && t_far > 0.f;
+}
+
+/*
+ * Slab test of the lanes in mask, same as intersectAABB. Returns the lanes that hit and
+ * the nearest entry distance among them, or 1e30f if none does.
+ */
+FART_TARGET_CLONES
+static uint32_t
+intersectAABBs(const RayPacket& packet, const PacketInterval& interval, uint32_t mask,
+               const glm::vec3& bmin, const glm::vec3& bmax, float& nearest) {
+    nearest = 1e30f;
+    if (!intersectInterval(interval, bmin, bmax)) return 0;
+
+    alignas(64) float t_entry[N];
+    alignas(64) uint32_t hit[N];
+    for (uint32_t i = 0; i < N; i++) {
+        float tx1 = (bmin.x - packet.o[0][i]) * packet.rD[0][i], tx2 = (bmax.x - packet.o[0][i]) * packet.rD[0][i];
+        float tmin = std::min(tx1, tx2), tmax = std::max(tx1, tx2);
+        float ty1 = (bmin.y - packet.o[1][i]) * packet.rD[1][i], ty2 = (bmax.y - packet.o[1][i]) * packet.rD[1][i];
+        tmin = std::max(tmin, std::min(ty1, ty2)), tmax = std::min(tmax, std::max(ty1, ty2));
+        float tz1 = (bmin.z - packet.o[2][i]) * packet.rD[2][i], tz2 = (bmax.z - packet.o[2][i]) * packet.rD[2][i];
+        tmin = std::max(tmin, std::min(tz1, tz2)), tmax = std::min(tmax, std::max(tz1, tz2));
+
+        t_entry[i] = tmin;
+        // Bitwise ands keep the loop free of branches
+        hit[i] = (tmax >= tmin) & (tmin < packet.t[i]) & (tmax > 0.f);
+    }
+
+    uint32_t result = 0;
+    for (uint32_t i = 0; i < N; i++) {
+        if (!hit[i] || !(mask & (1u << i))) continue;
+        result |= 1u << i;
+        nearest = std::min(nearest, t_entry[i]);
+    }
+    return result;
+}
+
+// Möller-Trumbore of the lanes in mask against the triangles of a leaf, same as intersectTriangle
+FART_TARGET_CLONES
+static void
+intersectTriangles(const SceneData& scene, RayPacket& packet, uint32_t mask, Hit hits[N],
+                   uint32_t first_index, uint32_t count, uint32_t instance) {
+    for (uint32_t triangle = 0; triangle < count; triangle++) {
+        uint32_t index = first_index + 3 * triangle;
+        glm::vec3 v0, edge1, edge2;
+        getTriangle(scene, index, v0, edge1, edge2);
+
+        alignas(64) float u[N], v[N], t[N];
+        alignas(64) uint32_t hit[N];
+        for (uint32_t i = 0; i < N; i++) {
+            float dx = packet.d[0][i], dy = packet.d[1][i], dz = packet.d[2][i];
+            float hx = dy * edge2.z - dz * edge2.y;
+            float hy = dz * edge2.x - dx * edge2.z;
+            float hz = dx * edge2.y - dy * edge2.x;
+            float a = edge1.x * hx + edge1.y * hy + edge1.z * hz;
+            float f = 1 / a;
+            float sx = packet.o[0][i] - v0.x, sy = packet.o[1][i] - v0.y, sz = packet.o[2][i] - v0.z;
+            u[i] = f * (sx * hx + sy * hy + sz * hz);
+            float qx = sy * edge1.z - sz * edge1.y;
+            float qy = sz * edge1.x - sx * edge1.z;
+            float qz = sx * edge1.y - sy * edge1.x;
+            v[i] = f * (dx * qx + dy * qy + dz * qz);
+            t[i] = f * (edge2.x * qx + edge2.y * qy + edge2.z * qz);
+
+            // Parallel rays leave a, and with it u, v and t, meaningless
+            hit[i] = ((a <= -EPS) | (a >= EPS)) &
+                     (u[i] >= 0) & (u[i] <= 1) & (v[i] >= 0) & (u[i] + v[i] <= 1) &
+                     (t[i] > EPS) & (t[i] < packet.t[i]);
+        }
+
+        uint32_t material_id = scene.triangle_materials[index / 3];
+        bool alpha_tested = scene.material_flags[material_id] & MATERIAL_ALPHA_TESTED;
+        for (uint32_t i = 0; i < N; i++) {
+            if (!hit[i] || !(mask & (1u << i))) continue;
+            if (alpha_tested && !anyHit(scene, scene.materials[material_id], index, glm::vec3(1.f - u[i] - v[i], u[i], v[i]))) continue;
+
+            packet.t[i] = t[i];
+            hits[i].first_index = index;
+            hits[i].instance = instance;
+            hits[i].bary = glm::vec2(u[i], v[i]);
+            hits[i].valid = true;
+        }
+    }
+}
+
+// Continues the lanes of a diverged packet ray by ray, from a subtree of the BLAS
+static void
+intersectLanes(const SceneData& scene, RayPacket& packet, uint32_t mask, Hit hits[N],
+               uint32_t bvh_offset, uint32_t root, uint32_t instance) {
+    for (uint32_t i = 0; i < N; i++) {
+        if (!(mask & (1u << i))) continue;
+        Ray ray = packet.get(i);
+        intersectBLAS(scene, ray, hits[i], bvh_offset, nullptr, root);
+        if (ray.t < packet.t[i]) {
+            hits[i].instance = instance;
+            packet.t[i] = ray.t;
+        }
+    }
+}
+
+#if BVH_WIDTH > 2
+FART_TARGET_CLONES
+static void
+intersectBLASPacket(const SceneData& scene, RayPacket& packet, uint32_t mask, Hit hits[N],
+                    uint32_t bvh_offset, uint32_t instance) {
+    constexpr uint32_t width = WideBVH::WIDTH;
+    const PacketInterval interval = packetInterval(packet, mask);
+    // Large enough for any path, see WideBVH::collapse
+    StackEntry stack[WideBVH::MAX_STACK];
+    int current = 0;
+    stack[current] = { 0, mask };
+
+    do {
+        StackEntry entry = stack[current--];
+        if (laneCount(entry.mask) < RayPacket::MIN_ACTIVE) {
+            intersectLanes(scene, packet, entry.mask, hits, bvh_offset, entry.node, instance);
+            continue;
+        }
+
+        const WideBVHNode& node = scene.bvh[bvh_offset + entry.node];
+        glm::vec3 scale;
+        for (uint32_t axis = 0; axis < 3; axis++)
+            scale[axis] = std::ldexp(1.f, (int)((node.exponents >> (8 * axis)) & 0xff) - 127);
+
+        StackEntry inner[width];
+        float inner_dist[width];
+        int n_inner = 0;
+        for (uint32_t i = 0; i < width; i++) {
+            uint32_t child = node.children[i];
+            if (child == 0) continue;
+
+            glm::vec3 lo(node.bounds[i], node.bounds[width + i], node.bounds[2 * width + i]);
+            glm::vec3 hi(node.bounds[3 * width + i], node.bounds[4 * width + i], node.bounds[5 * width + i]);
+            float dist;
+            uint32_t child_mask = intersectAABBs(packet, interval, entry.mask, node.origin + lo * scale, node.origin + hi * scale, dist);
+            if (!child_mask) continue;
+
+            if (WideBVH::isLeaf(child)) {
+                intersectTriangles(scene, packet, child_mask, hits, 3 * WideBVH::leafFirstTriangle(child), WideBVH::leafTriCount(child), instance);
+            } else {
+                int j = n_inner++;
+                while (j > 0 && inner_dist[j - 1] < dist) {
+                    inner[j] = inner[j - 1];
+                    inner_dist[j] = inner_dist[j - 1];
+                    j--;
+                }
+                inner[j] = { child, child_mask };
+                inner_dist[j] = dist;
+            }
+        }
+
+        for (int i = 0; i < n_inner; i++)
+            stack[++current] = inner[i];
+
+    } while (current >= 0);
+}
+#else
+FART_TARGET_CLONES
+static void
+intersectBLASPacket(const SceneData& scene, RayPacket& packet, uint32_t mask, Hit hits[N],
+                    uint32_t bvh_offset, uint32_t instance) {
+    const PacketInterval interval = packetInterval(packet, mask);
+    StackEntry stack[64];
+    int current = 0;
+    stack[current] = { 0, mask };
+
+    do {
+        StackEntry entry = stack[current--];
+        if (laneCount(entry.mask) < RayPacket::MIN_ACTIVE) {
+            intersectLanes(scene, packet, entry.mask, hits, bvh_offset, entry.node, instance);
+            continue;
+        }
+
+        const BVHNode& node = scene.bvh[bvh_offset + entry.node];
+        if (node.left_child == 0) {
+            intersectTriangles(scene, packet, entry.mask, hits, node.first_tri_index_id, node.tri_count, instance);
+        } else {
+            const BVHNode& left = scene.bvh[bvh_offset + node.left_child];
+            const BVHNode& right = scene.bvh[bvh_offset + node.left_child + 1];
+            float left_dist, right_dist;
+            uint32_t left_mask = intersectAABBs(packet, interval, entry.mask, left.aabb.min, left.aabb.max, left_dist);
+            uint32_t right_mask = intersectAABBs(packet, interval, entry.mask, right.aabb.min, right.aabb.max, right_dist);
+
+            if (left_dist > right_dist) {
+                if (left_mask) stack[++current] = { node.left_child, left_mask };
+                if (right_mask) stack[++current] = { node.left_child + 1, right_mask };
+            } else {
+                if (right_mask) stack[++current] = { node.left_child + 1, right_mask };
+                if (left_mask) stack[++current] = { node.left_child, left_mask };
+            }
+        }
+
+    } while (current >= 0 && current < 62);
+}
+#endif
+
+// Moves the lanes into the object space of an instance and traverses its BLAS
+FART_TARGET_CLONES
+static void
+intersectInstance(const SceneData& scene, RayPacket& packet, uint32_t mask, Hit hits[N], uint32_t instance) {
+    const glm::mat4& xfm = scene.instances[instance].world_to_instance;
+    RayPacket local;
+    for (uint32_t i = 0; i < N; i++) {
+        float ox = packet.o[0][i], oy = packet.o[1][i], oz = packet.o[2][i];
+        float dx = packet.d[0][i], dy = packet.d[1][i], dz = packet.d[2][i];
+        for (uint32_t axis = 0; axis < 3; axis++) {
+            local.o[axis][i] = xfm[0][axis] * ox + xfm[1][axis] * oy + xfm[2][axis] * oz + xfm[3][axis];
+            local.d[axis][i] = xfm[0][axis] * dx + xfm[1][axis] * dy + xfm[2][axis] * dz;
+            local.rD[axis][i] = 1.f / local.d[axis][i];
+        }
+        local.t[i] = packet.t[i];
+    }
+    local.active = mask;
+
+    intersectBLASPacket(scene, local, mask, hits, scene.blas_offsets[scene.instances[instance].object_id], instance);
+    std::copy(local.t, local.t + N, packet.t);
+}
+
+FART_TARGET_CLONES
+void
+intersectPacket(const SceneData& scene, RayPacket& packet, Hit hits[N]) {
+    for (uint32_t i = 0; i < N; i++)
+        hits[i] = Hit();
+    if (!packet.active) return;
+
+    const PacketInterval interval = packetInterval(packet, packet.active);
+    StackEntry stack[64];
+    int current = 0;
+    stack[current] = { 0, packet.active };
+
+    do {
+        StackEntry entry = stack[current--];
+        const TLASNode& node = scene.tlas[entry.node];
+        if (node.left_child == 0) {
+            for (uint32_t i = 0; i < node.instance_count; i++)
+                intersectInstance(scene, packet, entry.mask, hits, node.first_instance_id + i);
+        } else {
+            const TLASNode& left = scene.tlas[node.left_child];
+            const TLASNode& right = scene.tlas[node.left_child + 1];
+            float left_dist, right_dist;
+            uint32_t left_mask = intersectAABBs(packet, interval, entry.mask, left.aabb.min, left.aabb.max, left_dist);
+            uint32_t right_mask = intersectAABBs(packet, interval, entry.mask, right.aabb.min, right.aabb.max, right_dist);
+
+            if (left_dist > right_dist) {
+                if (left_mask) stack[++current] = { node.left_child, left_mask };
+                if (right_mask) stack[++current] = { node.left_child + 1, right_mask };
+            } else {
+                if (right_mask) stack[++current] = { node.left_child + 1, right_mask };
+                if (left_mask) stack[++current] = { node.left_child, left_mask };
+            }
+        }
+    } while (current >= 0 && current < 62);
+}
+
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+#include "types.h"
+#include "data.h"
+
+namespace fart {
+
+/*
+ * Rays that traverse the TLAS and BLAS together, stored as structure of arrays so that the
+ * per-lane loops compile to vector instructions (4 lanes at a time with SSE or NEON, 8 with
+ * AVX2, 16 with AVX-512, see isa.h). Meant for coherent rays such as a block of camera
+ * rays. Lanes that leave a subtree are masked off rather than reordered.
+ */
+struct RayPacket {
+    static constexpr uint32_t SIZE = 16;
+    // Camera packets cover WIDTH x WIDTH pixels
+    static constexpr uint32_t WIDTH = 4;
+    // Subtrees reached by fewer lanes are traced ray by ray
+    static constexpr uint32_t MIN_ACTIVE = 2;
+
+    alignas(64) float o[3][SIZE];
+    alignas(64) float d[3][SIZE];
+    alignas(64) float rD[3][SIZE];
+    alignas(64) float t[SIZE];
+    // Bit mask of the lanes that hold a ray
+    uint32_t active { 0 };
+
+    RayPacket();
+
+    void set(uint32_t lane, const Ray& ray);
+    Ray get(uint32_t lane) const;
+};
+
+/*
+ * Closest hits of all active lanes, the t of every lane ends at its hit distance.
+ * Same hits as intersect() ray by ray, resolve them with resolveHit(). Traversal
+ * counters are not recorded, heatmaps trace single rays.
+ */
+void intersectPacket(const SceneData& scene, RayPacket& packet, Hit hits[RayPacket::SIZE]);
+
+}
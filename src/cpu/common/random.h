@@ -0,0 +1,81 @@
+/* 
+ * A number of functions to generate LCG random sequences
+ * Reference:
+ * https://www.reedbeta.com/blog/hash-functions-for-gpu-rendering/
+ * https://github.com/ospray/ospray/blob/66fa8108485a8a92ff31ad2e06081bbaf391bc26/modules/cpu/math/random.ih
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <glm/glm.hpp>
+
+#include "types.h"
+
+namespace fart {
+
+inline uint32_t murmurhash3_mix(uint32_t hash, uint32_t k)
+{
+  const uint32_t c1 = 0xcc9e2d51;
+  const uint32_t c2 = 0x1b873593;
+  const uint32_t r1 = 15;
+  const uint32_t r2 = 13;
+  const uint32_t m = 5;
+  const uint32_t n = 0xe6546b64;
+
+  k *= c1;
+  k = (k << r1) | (k >> (32 - r1));
+  k *= c2;
+
+  hash ^= k;
+  hash = ((hash << r2) | (hash >> (32 - r2))) * m + n;
+
+  return hash;
+}
+
+inline uint32_t murmurhash3_finalize(uint32_t hash)
+{
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6b;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35;
+  hash ^= hash >> 16;
+
+  return hash;
+}
+
+inline RNG make_random(uint32_t pixel_id, uint32_t frame_no) {
+    RNG rng;
+    rng.state = murmurhash3_mix(0, pixel_id);
+    rng.state = murmurhash3_mix(rng.state, frame_no);
+    rng.state = murmurhash3_finalize(rng.state);
+
+    return rng;
+}
+
+inline uint32_t next_random(RNG& rng) {
+    rng.state = 1664525u * rng.state + 1013904223u;
+    return rng.state;
+}
+
+inline float next_randomf(RNG& rng) {
+    uint32_t r = (next_random(rng) & 0x007FFFFFu) | 0x3F800000u;
+    float f;
+    std::memcpy(&f, &r, sizeof(float));
+    return f - 1.0f;
+}
+
+inline glm::vec3 next_random3f(RNG& rng) {
+    float x = next_randomf(rng);
+    float y = next_randomf(rng);
+    float z = next_randomf(rng);
+    return glm::vec3(x, y, z);
+}
+
+inline glm::vec2 next_random2f(RNG& rng) {
+    float x = next_randomf(rng);
+    float y = next_randomf(rng);
+    return glm::vec2(x, y);
+}
+
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cmath>
+#include <glm/glm.hpp>
+
+namespace fart {
+
+constexpr float EPS = 0.00000001f;
+constexpr float PI = 3.14159265358979323846f;
+constexpr float ONE_OVER_PI = 0.31830988618379067154f;
+constexpr float ONE_OVER_TWO_PI = 0.15915494309189533577f;
+constexpr float ONE_OVER_FOUR_PI = 0.07957747154594766788f;
+constexpr float PI_OVER_TWO = 1.57079632679489661923f;
+constexpr float PI_OVER_FOUR = 0.78539816339744830961f;
+
+/* 
+ * Reorients a vector around a normal
+ * References:
+ * https://www.tandfonline.com/doi/abs/10.1080/2151237X.2009.10129274
+ * https://graphics.pixar.com/library/OrthonormalB/paper.pdf
+ *
+ */
+inline glm::vec3 reorient(glm::vec3 dir, glm::vec3 normal) {
+    float sign = normal.z < 0.f ? -1.f : 1.f;
+    float a = -1.f / (sign + normal.z);
+    float b = normal.x * normal.y * a;
+    glm::vec3 tangent = glm::vec3(1.f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+    glm::vec3 bitangent = glm::vec3(b, sign + normal.y * normal.y * a, -normal.y);
+
+    // Orient towards normal
+    return dir.x * tangent + dir.y * bitangent + dir.z * normal;
+}
+
+/**
+ * Generate a uniformly distributed random point on the unit disk 
+ * 
+ * Reference:
+ * https://www.pbr-book.org/3ed-2018/Monte_Carlo_Integration/2D_Sampling_with_Multidimensional_Transformations
+ */
+inline glm::vec2 randomDiskPoint(glm::vec2 rand) {
+    glm::vec2 u_offset = 2.f * rand - glm::vec2(1.f);
+    if (u_offset.x == 0.f && u_offset.y == 0.f)
+        return glm::vec2(0.f);
+    
+    float theta, r;
+    if (std::abs(u_offset.x) > std::abs(u_offset.y)) {
+        r = u_offset.x;
+        theta = PI_OVER_FOUR * (u_offset.y / u_offset.x);
+    } else { 
+        r = u_offset.y;
+        theta = PI_OVER_TWO - PI_OVER_FOUR * (u_offset.x / u_offset.y);
+    }
+    return r * glm::vec2(std::cos(theta), std::sin(theta));
+}
+
+/**
+* Generate a uniformly distributed random point on the unit-hemisphere
+* Reference:
+* https://www.pbr-book.org/3ed-2018/Monte_Carlo_Integration/2D_Sampling_with_Multidimensional_Transformations
+*
+*/
+inline glm::vec3 randomHemispherePoint(glm::vec2 rand, glm::vec3 n) {
+    float z = rand.x;
+    float r = std::sqrt(std::max(0.f, 1.f - z * z));
+    float phi = 2.f * PI * rand.y;
+
+    glm::vec3 dir = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+    return reorient(dir, n);
+}
+
+/**
+* Generate a cosine weighted random point on the unit-hemisphere
+* Reference:
+* https://www.pbr-book.org/3ed-2018/Monte_Carlo_Integration/2D_Sampling_with_Multidimensional_Transformations
+*
+*/ 
+inline glm::vec3 randomCosineHemispherePoint(glm::vec2 rand, glm::vec3 n) {
+    glm::vec2 p = randomDiskPoint(rand);
+    float z = std::sqrt(std::max(0.f, 1.f - p.x*p.x - p.y*p.y));
+    glm::vec3 dir = glm::vec3(p, z);
+
+    return reorient(dir, n);
+}
+
+/**
+* Generates a random sample from the GGX NDF to get a microfacet
+* Reference:
+* https://cwyman.org/code/dxrTutors/tutors/Tutor14/tutorial14.md.html
+*
+*/ 
+inline glm::vec3 randomGGXMicrofacet(glm::vec2 rand, glm::vec3 n, float roughness) {
+    // GGX NDF sampling
+    float a2 = roughness * roughness;
+    float cos_theta_h = std::sqrt(std::max(0.f, (1.f-rand.x)/((a2-1.f)*rand.x+1.f) ));
+    float sin_theta_h = std::sqrt(std::max(0.f, 1.f - cos_theta_h * cos_theta_h));
+    float phi_h = rand.y * PI * 2.f;
+
+    glm::vec3 dir = glm::vec3(sin_theta_h * std::cos(phi_h), sin_theta_h * std::sin(phi_h), cos_theta_h);
+    return reorient(dir, n);
+}
+
+}
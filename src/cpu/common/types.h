@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <stage.h>
+
+using namespace stage;
+
+namespace fart {
+
+struct Ray {
+    glm::vec3 o;
+    glm::vec3 d;
+    glm::vec3 rD;
+    float t;
+};
+
+// What traversal records for the closest hit so far, resolved into a SurfaceInteraction once at the end
+struct Hit {
+    uint32_t first_index { 0 };
+    uint32_t instance { 0 };
+    // Barycentrics of the second and third vertex
+    glm::vec2 bary { 0.f };
+    bool valid { false };
+};
+
+struct SurfaceInteraction {
+    glm::vec3 p;
+    glm::vec3 n;
+    glm::vec3 w_i;
+    glm::vec3 w_o;
+    glm::vec2 uv;
+    const OpenPBRMaterial* mat { nullptr };
+    bool valid { false };
+};
+
+struct RNG {
+    uint32_t state;
+};
+
+}
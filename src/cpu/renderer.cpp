@@ -0,0 +1,534 @@
+#include "opengl/gldefs.h"
+#include "renderer.h"
+#include "common/color.h"
+#include "common/intersect.h"
+#include "common/packet.h"
+#include "opengl/material_flags.h"
+#include "common/material.h"
+#include "common/random.h"
+#include "common/job_system.h"
+
+#include <memory>
+#include <mutex>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#define MIN_RR_DEPTH 3
+#define MAX_BOUNCES 5
+// Dark pixels are measured against this luminance, so their noise is not amplified without bound
+#define ADAPTIVE_MIN_LUMINANCE 0.01f
+
+namespace fart {
+
+// Standard error of the mean luminance relative to the mean, infinite until there are enough samples
+static float
+relativeError(const glm::vec4& mean, const glm::vec2& moments) {
+    float n = moments.y;
+    if (n < (float)Renderer::ADAPTIVE_MIN_SAMPLES) return std::numeric_limits<float>::infinity();
+
+    float y = luminance(glm::vec3(mean));
+    float variance = std::max(moments.x - y * y, 0.f) * n / (n - 1.f);
+    return std::sqrt(variance / n) / std::max(y, ADAPTIVE_MIN_LUMINANCE);
+}
+
+void
+CpuRenderer::init(std::shared_ptr<Scene> &scene, std::shared_ptr<Window> &window) {
+    m_scene = scene;
+    m_window = window;
+    m_n_threads = JobSystem::get().threadCount();
+
+    if (m_window) { FART_PROFILE_ZONE("initGl"); initGl(); }
+    { FART_PROFILE_ZONE("initAccelerationStructures"); initAccelerationStructures(); }
+    { FART_PROFILE_ZONE("initTextures"); initTextures(); }
+    { FART_PROFILE_ZONE("initGGXAlbedo"); m_ggx_albedo = std::make_unique<GGXAlbedoLUT>(); }
+    { FART_PROFILE_ZONE("initSceneData"); initSceneData(); }
+
+    LOG("Rendering on " + std::to_string(m_n_threads) + " threads");
+}
+
+void
+CpuRenderer::initAccelerationStructures() {
+    // Loads the flattened scene and its BVHs from disk, or builds and caches them
+    m_scene_cache = std::make_unique<SceneCache>(*m_scene, m_triangle_layout, m_split_method, m_node_layout, m_scene_cache_directory);
+
+    // The TLAS reorders instances, so object-to-world transforms are derived afterwards
+    m_instance_to_world.reserve(m_scene_cache->getInstanceCount());
+    for (size_t i = 0; i < m_scene_cache->getInstanceCount(); i++) {
+        m_instance_to_world.push_back(glm::inverse(m_scene_cache->getInstances()[i].world_to_instance));
+    }
+}
+
+void
+CpuRenderer::initTextures() {
+    for (auto& image : m_scene->getTextures()) {
+        m_textures.emplace_back(image.getWidth(), 
+                                image.getHeight(), 
+                                image.getData(), 
+                                image.isHDR());
+    }
+    m_material_flags = computeMaterialFlags(m_scene_cache->getMaterials(), m_scene_cache->getMaterialCount(), m_scene->getTextures());
+}
+
+void
+CpuRenderer::initSceneData() {
+    m_scene_data.scene_scale = m_scene->getSceneScale();
+    m_scene_data.positions = m_scene_cache->getPositions();
+    m_scene_data.attributes = m_scene_cache->getAttributes();
+    m_scene_data.indices = m_scene_cache->getIndices();
+    m_scene_data.triangle_materials = m_scene_cache->getTriangleMaterials();
+    m_scene_data.triangles = m_scene_cache->getTriangles();
+    m_scene_data.bvh = m_scene_cache->getBLASNodes();
+    m_scene_data.tlas = m_scene_cache->getTLASNodes();
+    m_scene_data.blas_offsets = m_scene_cache->getBLASOffsets();
+    m_scene_data.instances = m_scene_cache->getInstances();
+    m_scene_data.instance_to_world = m_instance_to_world.data();
+    m_scene_data.materials = m_scene_cache->getMaterials();
+    m_scene_data.material_flags = m_material_flags.data();
+    m_scene_data.textures = m_textures.data();
+    m_scene_data.ggx_albedo = m_ggx_albedo.get();
+}
+
+void
+CpuRenderer::initGl() {
+    glfwMakeContextCurrent(m_window->getGlfwWindow());
+    glfwSwapInterval(0);
+    gladLoadGL();
+
+    glViewport(0, 0, m_window->getWidth(), m_window->getHeight());
+}
+
+bool
+CpuRenderer::shouldClear(const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up) {
+    bool clear = glm::any(glm::epsilonNotEqual(eye, m_prev_eye, 0.00001f)) ||
+                 glm::any(glm::epsilonNotEqual(dir, m_prev_dir, 0.00001f)) ||
+                 glm::any(glm::epsilonNotEqual(up, m_prev_up, 0.00001f)) ||
+                 m_render_mode != m_prev_render_mode;
+
+    m_prev_eye = eye;
+    m_prev_dir = dir;
+    m_prev_up = up;
+    m_prev_render_mode = m_render_mode;
+
+    return clear;
+}
+
+glm::vec4
+CpuRenderer::miss(const Ray& ray) {
+    glm::vec4 sky = glm::vec4(70.f/255.f, 169.f/255.f, 235.f/255.f, 1.f);
+    glm::vec4 haze = glm::vec4(127.f/255.f, 108.f/255.f, 94.f/255.f, 1.f);
+    glm::vec4 background = glm::mix(sky, haze, (ray.d.x + 1.f) / 2.f);
+    return background;
+}
+
+glm::vec4
+CpuRenderer::closestHit(SurfaceInteraction si, RNG& rng) {
+
+    glm::vec3 L = glm::vec3(0.f);
+    glm::vec3 throughput = glm::vec3(1.f);
+
+    glm::vec3 f;
+    float f_pdf;
+    for (int i = 0; i < MAX_BOUNCES; i++) {
+        si.w_i = bsdf_sample(si, f_pdf, rng);
+        if (f_pdf <= 0.f) break;
+        f = bsdf_eval(m_scene_data, si, si.w_i, si.w_o);
+        throughput = f * throughput / f_pdf;
+
+        Ray ray;
+        ray.o = si.p + 0.00001f * m_scene_data.scene_scale * si.n;
+        ray.d = si.w_i;
+        ray.rD = 1.f / si.w_i;
+        ray.t = 1e30f;
+
+        si = intersect(m_scene_data, ray);
+
+        // Ray left the scene, apply miss shader
+        if (!si.valid) {
+            L = throughput * glm::vec3(miss(ray));
+            break;
+        }
+
+        // Russian roulette termination
+        if (i > MIN_RR_DEPTH) {
+            float q = std::max(throughput.x, std::max(throughput.y, throughput.z));
+
+            if (next_randomf(rng) > q) {
+                break;
+            } else {
+                throughput = throughput / (1 - q);
+            }
+        }
+    }
+
+    return glm::vec4(L, 1.f);
+}
+
+Ray
+CpuRenderer::spawnRay(uint32_t x, uint32_t y, const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up, RNG& rng) {
+    glm::vec2 viewport_size = glm::vec2(m_viewport_size.x, m_viewport_size.y);
+    glm::vec2 uv = glm::vec2(x + .5f, y + .5f) / viewport_size;
+    glm::vec2 d = uv + (next_random2f(rng) / viewport_size);
+    float aspect_ratio = viewport_size.x / viewport_size.y;
+
+    Ray ray;
+    ray.o = eye;
+    ray.d = glm::normalize(dir + 
+                           aspect_ratio * (d.x-.5f) * glm::cross(dir, up) +
+                           (d.y-.5f) * up);
+    ray.rD = 1.f / ray.d;
+    ray.t = 1e30f;
+    return ray;
+}
+
+glm::vec4
+CpuRenderer::renderPixel(uint32_t x, uint32_t y, const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up, TraversalStats& traversal) {
+    uint32_t pixel_id = y * m_viewport_size.x + x;
+    RNG rng = make_random(pixel_id, m_frame_no);
+    Ray ray = spawnRay(x, y, eye, dir, up, rng);
+
+    if (m_render_mode != RenderMode::Pathtracing) {
+        TraversalStats stats;
+        intersect(m_scene_data, ray, &stats);
+        traversal += stats;
+        return heatmap(heatmapValue(m_render_mode, stats) / m_heatmap_scale);
+    }
+
+    SurfaceInteraction si = intersect(m_scene_data, ray);
+    glm::vec4 L = si.valid ? closestHit(si, rng) : miss(ray);
+    return glm::clamp(L, 0.f, 10.f);
+}
+
+void
+CpuRenderer::renderPacket(uint32_t x0, uint32_t y0, uint32_t x_end, uint32_t y_end, const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up) {
+    RayPacket packet;
+    RNG rngs[RayPacket::SIZE];
+    for (uint32_t lane = 0; lane < RayPacket::SIZE; lane++) {
+        uint32_t x = x0 + lane % RayPacket::WIDTH, y = y0 + lane / RayPacket::WIDTH;
+        if (x >= x_end || y >= y_end) continue;
+        rngs[lane] = make_random(y * m_viewport_size.x + x, m_frame_no);
+        packet.set(lane, spawnRay(x, y, eye, dir, up, rngs[lane]));
+    }
+
+    Hit hits[RayPacket::SIZE];
+    intersectPacket(m_scene_data, packet, hits);
+
+    // Bounces are incoherent and continue ray by ray
+    for (uint32_t lane = 0; lane < RayPacket::SIZE; lane++) {
+        if (!(packet.active & (1u << lane))) continue;
+        Ray ray = packet.get(lane);
+        SurfaceInteraction si = resolveHit(m_scene_data, ray, hits[lane]);
+        glm::vec4 L = si.valid ? closestHit(si, rngs[lane]) : miss(ray);
+        accumulate(x0 + lane % RayPacket::WIDTH, y0 + lane / RayPacket::WIDTH, glm::clamp(L, 0.f, 10.f));
+    }
+}
+
+void
+CpuRenderer::accumulate(uint32_t x, uint32_t y, const glm::vec4& L) {
+    size_t pixel = (size_t)y * m_viewport_size.x + x;
+    glm::vec2& moments = m_moments[pixel];
+    float n = moments.y;
+    float l = luminance(glm::vec3(L));
+    m_accum[pixel] = (n * m_accum[pixel] + L) / (n + 1.f);
+    moments = glm::vec2((n * moments.x + l * l) / (n + 1.f), n + 1.f);
+
+    // Postprocessing, heatmaps are shown as they are
+    if (!m_present_enabled) return;
+    glm::vec4 c = m_render_mode == RenderMode::Pathtracing ? gamma(tonemap_ACES(m_accum[pixel])) : m_accum[pixel];
+    for (int i = 0; i < 4; i++)
+        m_framebuffer[4 * pixel + i] = (uint8_t)(std::min(std::max(c[i], 0.f), 1.f) * 255.f + .5f);
+}
+
+bool
+CpuRenderer::isAdaptive() const {
+    return m_adaptive_error > 0.f && m_render_mode == RenderMode::Pathtracing;
+}
+
+bool
+CpuRenderer::isTileConverged(uint32_t tile) const {
+    return m_tile_errors[tile] <= m_adaptive_error;
+}
+
+void
+CpuRenderer::updateTileError(uint32_t tile_x, uint32_t tile_y) {
+    uint32_t x_end = std::min(m_viewport_size.x, (tile_x + 1) * TILE_SIZE);
+    uint32_t y_end = std::min(m_viewport_size.y, (tile_y + 1) * TILE_SIZE);
+
+    float error = 0.f;
+    for (uint32_t y = tile_y * TILE_SIZE; y < y_end; y++) {
+        for (uint32_t x = tile_x * TILE_SIZE; x < x_end; x++) {
+            size_t pixel = (size_t)y * m_viewport_size.x + x;
+            error = std::max(error, relativeError(m_accum[pixel], m_moments[pixel]));
+        }
+    }
+    m_tile_errors[tile_y * ((m_viewport_size.x + TILE_SIZE - 1) / TILE_SIZE) + tile_x] = error;
+}
+
+void
+CpuRenderer::renderTile(uint32_t tile_x, uint32_t tile_y, const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up, TraversalStats& traversal) {
+    uint32_t x_end = std::min(m_viewport_size.x, (tile_x + 1) * TILE_SIZE);
+    uint32_t y_end = std::min(m_viewport_size.y, (tile_y + 1) * TILE_SIZE);
+
+    // Camera rays of a block are coherent enough to traverse as a packet, heatmaps count the work of single rays
+    if (m_render_mode == RenderMode::Pathtracing) {
+        for (uint32_t y = tile_y * TILE_SIZE; y < y_end; y += RayPacket::WIDTH) {
+            for (uint32_t x = tile_x * TILE_SIZE; x < x_end; x += RayPacket::WIDTH)
+                renderPacket(x, y, x_end, y_end, eye, dir, up);
+        }
+        return;
+    }
+
+    for (uint32_t y = tile_y * TILE_SIZE; y < y_end; y++) {
+        for (uint32_t x = tile_x * TILE_SIZE; x < x_end; x++)
+            accumulate(x, y, renderPixel(x, y, eye, dir, up, traversal));
+    }
+}
+
+void
+CpuRenderer::renderTiles(const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up, TraversalStats& traversal) {
+    uint32_t tiles_x = (m_viewport_size.x + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t tiles_y = (m_viewport_size.y + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t n_tiles = tiles_x * tiles_y;
+
+    // One job per tile, idle threads steal tiles to balance uneven tile costs
+    FART_PROFILE_ZONE("Tiles");
+    bool adaptive = isAdaptive();
+    std::mutex traversal_mutex;
+    parallelFor(0, n_tiles, 1, [&](size_t first, size_t last) {
+        TraversalStats local_traversal;
+        for (size_t tile = first; tile < last; tile++) {
+            // Converged tiles keep their accumulation and error
+            if (adaptive && isTileConverged(tile)) continue;
+
+            renderTile(tile % tiles_x, tile / tiles_x, eye, dir, up, local_traversal);
+            if (adaptive) updateTileError(tile % tiles_x, tile / tiles_x);
+        }
+
+        std::lock_guard<std::mutex> lock(traversal_mutex);
+        traversal += local_traversal;
+    });
+}
+
+void
+CpuRenderer::renderWavefront(const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up) {
+    if (m_paths.rays.size() < WAVEFRONT_SIZE)
+        m_paths.resize(WAVEFRONT_SIZE);
+
+    uint32_t tiles_x = (m_viewport_size.x + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t tiles_y = (m_viewport_size.y + TILE_SIZE - 1) / TILE_SIZE;
+    bool adaptive = isAdaptive();
+
+    // Every pixel in scanline order, or the pixels of the tiles that have not converged
+    m_wavefront_pixels.clear();
+    if (!adaptive) {
+        m_wavefront_pixels.resize((size_t)m_viewport_size.x * m_viewport_size.y);
+        std::iota(m_wavefront_pixels.begin(), m_wavefront_pixels.end(), 0u);
+    } else {
+        for (uint32_t tile = 0; tile < tiles_x * tiles_y; tile++) {
+            if (isTileConverged(tile)) continue;
+            uint32_t tile_x = tile % tiles_x, tile_y = tile / tiles_x;
+            uint32_t x_end = std::min(m_viewport_size.x, (tile_x + 1) * TILE_SIZE);
+            uint32_t y_end = std::min(m_viewport_size.y, (tile_y + 1) * TILE_SIZE);
+            for (uint32_t y = tile_y * TILE_SIZE; y < y_end; y++) {
+                for (uint32_t x = tile_x * TILE_SIZE; x < x_end; x++)
+                    m_wavefront_pixels.push_back(y * m_viewport_size.x + x);
+            }
+        }
+    }
+
+    size_t n_pixels = m_wavefront_pixels.size();
+    for (size_t first = 0; first < n_pixels; first += WAVEFRONT_SIZE) {
+        generate(m_wavefront_pixels.data() + first, std::min(WAVEFRONT_SIZE, n_pixels - first), eye, dir, up);
+        while (!m_paths.queue.empty()) {
+            extend();
+            shade();
+        }
+    }
+
+    // Converged tiles would measure the same error again
+    if (adaptive) {
+        parallelFor(0, (size_t)tiles_x * tiles_y, 16, [&](size_t first, size_t last) {
+            for (size_t tile = first; tile < last; tile++) {
+                if (!isTileConverged(tile)) updateTileError(tile % tiles_x, tile / tiles_x);
+            }
+        });
+    }
+}
+
+void
+CpuRenderer::generate(const uint32_t* pixels, size_t n, const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up) {
+    FART_PROFILE_ZONE("Generate");
+    m_paths.queue.resize(n);
+    parallelFor(0, n, 4096, [&](size_t first, size_t last) {
+        for (size_t id = first; id < last; id++) {
+            uint32_t pixel = pixels[id];
+            m_paths.rngs[id] = make_random(pixel, m_frame_no);
+            m_paths.rays[id] = spawnRay(pixel % m_viewport_size.x, pixel / m_viewport_size.x, eye, dir, up, m_paths.rngs[id]);
+            m_paths.throughput[id] = glm::vec3(1.f);
+            m_paths.pixels[id] = pixel;
+            m_paths.bounces[id] = 0;
+            m_paths.queue[id] = (uint32_t)id;
+        }
+    });
+}
+
+void
+CpuRenderer::extend() {
+    FART_PROFILE_ZONE("Extend");
+    // Rays into the same octant tend to visit the same nodes
+    for (uint32_t id : m_paths.queue)
+        m_paths.keys[id] = directionOctant(m_paths.rays[id].d);
+    m_paths.binQueue(8);
+
+    parallelFor(0, m_paths.queue.size(), 1024, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            uint32_t id = m_paths.queue[i];
+            m_paths.hits[id] = traverse(m_scene_data, m_paths.rays[id]);
+        }
+    });
+}
+
+void
+CpuRenderer::shade() {
+    FART_PROFILE_ZONE("Shade");
+    // Paths that hit the same material run the same BSDF code and fetch the same textures, misses go last
+    const uint32_t n_materials = (uint32_t)m_scene_cache->getMaterialCount();
+    for (uint32_t id : m_paths.queue) {
+        const Hit& hit = m_paths.hits[id];
+        m_paths.keys[id] = hit.valid ? m_scene_data.triangle_materials[hit.first_index / 3] : n_materials;
+    }
+    m_paths.binQueue(n_materials + 1);
+
+    parallelFor(0, m_paths.queue.size(), 1024, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++)
+            shadePath(m_paths.queue[i]);
+    });
+    m_paths.compactQueue();
+}
+
+// One iteration of the closestHit loop, for a path whose ray was just traced
+void
+CpuRenderer::shadePath(uint32_t id) {
+    Ray& ray = m_paths.rays[id];
+    glm::vec3& throughput = m_paths.throughput[id];
+    RNG& rng = m_paths.rngs[id];
+    uint32_t& bounces = m_paths.bounces[id];
+    m_paths.alive[id] = false;
+
+    // Ray left the scene, apply miss shader
+    if (!m_paths.hits[id].valid) {
+        finishPath(id, throughput * glm::vec3(miss(ray)));
+        return;
+    }
+    SurfaceInteraction si = resolveHit(m_scene_data, ray, m_paths.hits[id]);
+
+    // Russian roulette termination, on the same bounces as closestHit
+    if (bounces > MIN_RR_DEPTH + 1) {
+        float q = std::max(throughput.x, std::max(throughput.y, throughput.z));
+
+        if (next_randomf(rng) > q) {
+            finishPath(id, glm::vec3(0.f));
+            return;
+        } else {
+            throughput = throughput / (1 - q);
+        }
+    }
+
+    if (bounces == MAX_BOUNCES) {
+        finishPath(id, glm::vec3(0.f));
+        return;
+    }
+    float f_pdf;
+    si.w_i = bsdf_sample(si, f_pdf, rng);
+    if (f_pdf <= 0.f) {
+        finishPath(id, glm::vec3(0.f));
+        return;
+    }
+    glm::vec3 f = bsdf_eval(m_scene_data, si, si.w_i, si.w_o);
+    throughput = f * throughput / f_pdf;
+
+    ray.o = si.p + 0.00001f * m_scene_data.scene_scale * si.n;
+    ray.d = si.w_i;
+    ray.rD = 1.f / si.w_i;
+    ray.t = 1e30f;
+    bounces++;
+    m_paths.alive[id] = true;
+}
+
+void
+CpuRenderer::finishPath(uint32_t id, const glm::vec3& L) {
+    uint32_t pixel = m_paths.pixels[id];
+    accumulate(pixel % m_viewport_size.x, pixel / m_viewport_size.x, glm::clamp(glm::vec4(L, 1.f), 0.f, 10.f));
+}
+
+void
+CpuRenderer::present() {
+    glViewport(0, 0, m_viewport_size.x, m_viewport_size.y);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glRasterPos2i(-1, -1);
+    glDrawPixels(m_viewport_size.x, m_viewport_size.y, GL_RGBA, GL_UNSIGNED_BYTE, m_framebuffer.data());
+    glfwSwapBuffers(m_window->getGlfwWindow());
+}
+
+void
+CpuRenderer::render(const glm::vec3 eye, const glm::vec3 dir, const glm::vec3 up, RenderStats& render_stats) {
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    auto viewport_size = m_window ? m_window->getViewportSize() : m_resolution;
+    bool resized = viewport_size.x != m_viewport_size.x || viewport_size.y != m_viewport_size.y;
+    if (resized) {
+        m_viewport_size = viewport_size;
+        m_accum.resize((size_t)m_viewport_size.x * m_viewport_size.y);
+        m_moments.resize(m_accum.size());
+        m_framebuffer.resize(4 * (size_t)m_viewport_size.x * m_viewport_size.y);
+        m_tile_errors.resize(((m_viewport_size.x + TILE_SIZE - 1) / TILE_SIZE) * ((m_viewport_size.y + TILE_SIZE - 1) / TILE_SIZE));
+    }
+
+    if (shouldClear(eye, dir, up) || resized) {
+        m_frame_no = 0;
+        std::fill(m_accum.begin(), m_accum.end(), glm::vec4(0.f));
+        std::fill(m_moments.begin(), m_moments.end(), glm::vec2(0.f));
+        std::fill(m_tile_errors.begin(), m_tile_errors.end(), std::numeric_limits<float>::infinity());
+    }
+
+    { // Pathtracing renderpass
+        FART_PROFILE_PASS("Pathtracing", render_stats);
+        if (m_wavefront && m_render_mode == RenderMode::Pathtracing)
+            renderWavefront(eye, dir, up);
+        else
+            renderTiles(eye, dir, up, render_stats.traversal);
+    }
+
+    if (m_present_enabled && m_window) {
+        FART_PROFILE_PASS("Present", render_stats);
+        present();
+    }
+
+    auto frame_time_mus = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - t_start);
+    render_stats.frame_time_ms = frame_time_mus.count() * 0.001f;
+    m_frame_no += 1;
+}
+
+bool
+CpuRenderer::readAccumulation(std::vector<glm::vec4>& pixels) {
+    pixels = m_accum;
+    return true;
+}
+
+bool
+CpuRenderer::isConverged() {
+    if (!isAdaptive() || m_frame_no == 0) return false;
+    return std::all_of(m_tile_errors.begin(), m_tile_errors.end(), [&](float error) { return error <= m_adaptive_error; });
+}
+
+uint64_t
+CpuRenderer::sampleCount() {
+    uint64_t samples = 0;
+    for (const glm::vec2& moments : m_moments)
+        samples += (uint64_t)moments.y;
+    return samples;
+}
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <vector>
+
+#include "opengl/scene_cache.h"
+#include "cpu/common/data.h"
+#include "cpu/common/types.h"
+#include "common/renderer.h"
+#include "common/window.h"
+#include "texture.h"
+#include "wavefront.h"
+
+namespace fart {
+
+struct CpuRenderer : Renderer {
+    public:
+        static constexpr uint32_t TILE_SIZE = 16;
+        // Paths per wave of the wavefront mode, frames with more pixels take several waves
+        static constexpr size_t WAVEFRONT_SIZE = 1 << 18;
+
+        void init(std::shared_ptr<Scene> &scene, std::shared_ptr<Window> &window) override;
+        void render(const glm::vec3 eye, const glm::vec3 dir, const glm::vec3 up, RenderStats& render_stats) override;
+        virtual std::string name() override {
+            return "CPU Renderer";
+        }
+
+        virtual size_t preferredVertexAlignment() override {
+            return 8;
+        }
+
+        bool readAccumulation(std::vector<glm::vec4>& pixels) override;
+        bool supportsRenderMode(RenderMode /*mode*/) override { return true; }
+        bool supportsWavefront() override { return true; }
+        bool supportsAdaptiveSampling() override { return true; }
+        // GL is only used to present frames
+        bool supportsWindowless() override { return true; }
+        bool isConverged() override;
+        uint64_t sampleCount() override;
+
+    private:
+        uint32_t m_frame_no { 0 };
+        uint32_t m_n_threads { 1 };
+        glm::vec3 m_prev_eye, m_prev_dir, m_prev_up;
+        RenderMode m_prev_render_mode { RenderMode::Pathtracing };
+
+        std::shared_ptr<Scene> m_scene;
+        std::shared_ptr<Window> m_window;
+        std::unique_ptr<SceneCache> m_scene_cache;
+        std::vector<glm::mat4> m_instance_to_world;
+        std::vector<Texture> m_textures;
+        std::vector<uint32_t> m_material_flags;
+        std::unique_ptr<GGXAlbedoLUT> m_ggx_albedo;
+        SceneData m_scene_data;
+
+        glm::u32vec2 m_viewport_size { 0, 0 };
+        std::vector<glm::vec4> m_accum;
+        // Mean squared luminance and sample count per pixel
+        std::vector<glm::vec2> m_moments;
+        // Largest relative error per tile, infinite until its pixels have ADAPTIVE_MIN_SAMPLES
+        std::vector<float> m_tile_errors;
+        std::vector<uint8_t> m_framebuffer;
+        WavefrontPaths m_paths;
+        // Pixels the wavefront mode samples this frame
+        std::vector<uint32_t> m_wavefront_pixels;
+
+        void initAccelerationStructures();
+        void initTextures();
+        void initSceneData();
+        void initGl();
+        bool shouldClear(const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up);
+
+        void renderTiles(const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up, TraversalStats& traversal);
+        void renderTile(uint32_t tile_x, uint32_t tile_y, const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up, TraversalStats& traversal);
+        Ray spawnRay(uint32_t x, uint32_t y, const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up, RNG& rng);
+        glm::vec4 renderPixel(uint32_t x, uint32_t y, const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up, TraversalStats& traversal);
+        // Traces the camera rays of a RayPacket::WIDTH squared block clipped to x_end, y_end as one packet
+        void renderPacket(uint32_t x0, uint32_t y0, uint32_t x_end, uint32_t y_end, const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up);
+        void accumulate(uint32_t x, uint32_t y, const glm::vec4& L);
+        bool isAdaptive() const;
+        bool isTileConverged(uint32_t tile) const;
+        void updateTileError(uint32_t tile_x, uint32_t tile_y);
+        glm::vec4 closestHit(SurfaceInteraction si, RNG& rng);
+        glm::vec4 miss(const Ray& ray);
+
+        // Wavefront mode, the stages of closestHit run over all paths of a wave in turn
+        void renderWavefront(const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up);
+        void generate(const uint32_t* pixels, size_t n, const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up);
+        void extend();
+        void shade();
+        void shadePath(uint32_t id);
+        void finishPath(uint32_t id, const glm::vec3& L);
+        void present();
+};
+
+}
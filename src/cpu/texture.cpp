@@ -0,0 +1,56 @@
+#include "texture.h"
+
+#include <cmath>
+
+namespace fart {
+
+static float
+mirror(float x) {
+    float t = x - 2.f * std::floor(x * 0.5f);
+    return t > 1.f ? 2.f - t : t;
+}
+
+Texture::Texture(const uint32_t width,
+                 const uint32_t height,
+                 const uint8_t* data,
+                 bool is_hdr)
+    : m_width(width),
+      m_height(height),
+      m_data(data),
+      m_is_hdr(is_hdr)
+{
+}
+
+glm::vec4
+Texture::sample(glm::vec2 uv) const {
+    if (!m_data || m_width == 0 || m_height == 0) return glm::vec4(0.f);
+
+    // Bilinear filtering on the mirrored texture coordinates
+    float x = mirror(uv.x) * m_width - 0.5f;
+    float y = mirror(uv.y) * m_height - 0.5f;
+    float x0 = std::floor(x);
+    float y0 = std::floor(y);
+    float fx = x - x0;
+    float fy = y - y0;
+
+    auto clamp_x = [&](float v) { return (uint32_t)std::min(std::max(v, 0.f), (float)m_width - 1.f); };
+    auto clamp_y = [&](float v) { return (uint32_t)std::min(std::max(v, 0.f), (float)m_height - 1.f); };
+    uint32_t ix0 = clamp_x(x0), ix1 = clamp_x(x0 + 1.f);
+    uint32_t iy0 = clamp_y(y0), iy1 = clamp_y(y0 + 1.f);
+
+    glm::vec4 top = fetch(ix0, iy0) * (1.f - fx) + fetch(ix1, iy0) * fx;
+    glm::vec4 bottom = fetch(ix0, iy1) * (1.f - fx) + fetch(ix1, iy1) * fx;
+    return top * (1.f - fy) + bottom * fy;
+}
+
+glm::vec4
+Texture::fetch(uint32_t x, uint32_t y) const {
+    size_t texel = 4 * ((size_t)y * m_width + x);
+    if (m_is_hdr) {
+        const float* data = reinterpret_cast<const float*>(m_data);
+        return glm::vec4(data[texel], data[texel+1], data[texel+2], data[texel+3]);
+    }
+    return glm::vec4(m_data[texel], m_data[texel+1], m_data[texel+2], m_data[texel+3]) / 255.f;
+}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+namespace fart {
+
+/* 
+ * Read-only view of an RGBA image held by the scene. Sampling mirrors the
+ * GL_MIRRORED_REPEAT wrap mode used by the OpenGL renderer.
+ */
+struct Texture {
+
+    public:
+        Texture(const uint32_t width,
+                const uint32_t height,
+                const uint8_t* data,
+                bool is_hdr = false);
+
+        glm::vec4 sample(glm::vec2 uv) const;
+
+        uint32_t getWidth() const { return m_width; }
+        uint32_t getHeight() const { return m_height; }
+
+    private:
+        glm::vec4 fetch(uint32_t x, uint32_t y) const;
+
+        uint32_t m_width;
+        uint32_t m_height;
+        const uint8_t* m_data;
+        bool m_is_hdr;
+};
+
+}
@@ -0,0 +1,42 @@
+#include "wavefront.h"
+
+namespace fart {
+
+void
+WavefrontPaths::resize(size_t n) {
+    rays.resize(n);
+    hits.resize(n);
+    throughput.resize(n);
+    rngs.resize(n);
+    pixels.resize(n);
+    bounces.resize(n);
+    alive.resize(n);
+    keys.resize(n);
+    queue.reserve(n);
+    scratch.reserve(n);
+}
+
+void
+WavefrontPaths::binQueue(uint32_t n_bins) {
+    std::vector<uint32_t> offsets(n_bins + 1, 0);
+    for (uint32_t id : queue)
+        offsets[keys[id] + 1]++;
+    for (uint32_t bin = 0; bin < n_bins; bin++)
+        offsets[bin + 1] += offsets[bin];
+
+    scratch.resize(queue.size());
+    for (uint32_t id : queue)
+        scratch[offsets[keys[id]]++] = id;
+    queue.swap(scratch);
+}
+
+void
+WavefrontPaths::compactQueue() {
+    size_t n_alive = 0;
+    for (uint32_t id : queue) {
+        if (alive[id]) queue[n_alive++] = id;
+    }
+    queue.resize(n_alive);
+}
+
+}
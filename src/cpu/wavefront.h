@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "cpu/common/types.h"
+
+namespace fart {
+
+/*
+ * Paths in flight of the wavefront mode, one array per field and one entry per path.
+ * Stages run over the queue of live path ids, which is binned by a key between stages
+ * so that neighbouring entries share a direction octant (extend) or a material (shade).
+ */
+struct WavefrontPaths {
+    // Ray of the next extend stage, its t ends at the hit
+    std::vector<Ray> rays;
+    std::vector<Hit> hits;
+    std::vector<glm::vec3> throughput;
+    std::vector<RNG> rngs;
+    std::vector<uint32_t> pixels;
+    // Bounce rays cast so far, 0 while the camera ray is traced
+    std::vector<uint32_t> bounces;
+    // Set by shade for paths that continue
+    std::vector<uint8_t> alive;
+
+    // Live path ids in processing order
+    std::vector<uint32_t> queue;
+    // Bin key per path id and scratch space of binQueue
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> scratch;
+
+    void resize(size_t n);
+    // Stable counting sort of the queue by keys[id], all keys must be below n_bins
+    void binQueue(uint32_t n_bins);
+    // Drops the paths that did not survive the last shade stage, keeping the order
+    void compactQueue();
+};
+
+// Sign combination of a direction, 0 to 7
+inline uint32_t directionOctant(const glm::vec3& d) {
+    return (d.x < 0.f ? 1u : 0u) | (d.y < 0.f ? 2u : 0u) | (d.z < 0.f ? 4u : 0u);
+}
+
+}
@@ -1,20 +1,136 @@
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 
 #include "common/defs.h"
 #include "common/app.h"
 
-struct CmdArgs {
-    std::string scene;
-};
+static std::string
+nextArg(int argc, char** argv, int& ac) {
+    if (ac + 1 >= argc) {
+        throw std::runtime_error(std::string("Missing value for ") + argv[ac]);
+    }
+    ac += 1;
+    return argv[ac];
+}
+
+static uint32_t
+parseUInt(const std::string& s, const std::string& name) {
+    try {
+        size_t end;
+        unsigned long value = std::stoul(s, &end);
+        if (end == s.size() && value > 0) return (uint32_t)value;
+    } catch (const std::exception&) {}
+    throw std::runtime_error("Invalid value for " + name + ": " + s);
+}
+
+static float
+parseFloat(const std::string& s, const std::string& name) {
+    try {
+        size_t end;
+        float value = std::stof(s, &end);
+        if (end == s.size() && value > 0.f) return value;
+    } catch (const std::exception&) {}
+    throw std::runtime_error("Invalid value for " + name + ": " + s);
+}
+
+static glm::vec3
+parseVec3(const std::string& s, const std::string& name) {
+    glm::vec3 v;
+    char c0, c1;
+    std::istringstream stream(s);
+    if (!(stream >> v.x >> c0 >> v.y >> c1 >> v.z) || c0 != ',' || c1 != ',' || !stream.eof()) {
+        throw std::runtime_error("Invalid value for " + name + ", expected x,y,z: " + s);
+    }
+    return v;
+}
+
+static fart::RenderMode
+parseRenderMode(const std::string& s) {
+    if (s == "pathtracing") return fart::RenderMode::Pathtracing;
+    if (s == "nodes") return fart::RenderMode::HeatmapNodes;
+    if (s == "aabb") return fart::RenderMode::HeatmapAABBTests;
+    if (s == "triangles") return fart::RenderMode::HeatmapTriangleTests;
+    if (s == "instances") return fart::RenderMode::HeatmapInstanceTransforms;
+    throw std::runtime_error("Invalid value for --mode, expected pathtracing, nodes, aabb, triangles or instances: " + s);
+}
+
+static fart::BVHSplitMethod
+parseSplitMethod(const std::string& s) {
+    for (fart::BVHSplitMethod split_method : { fart::SAH, fart::LBVH, fart::HLBVH, fart::SBVH }) {
+        if (s == fart::splitMethodName(split_method)) return split_method;
+    }
+    throw std::runtime_error("Invalid value for --split, expected sah, lbvh, hlbvh or sbvh: " + s);
+}
 
 void
-parseCmdArgs(int argc, char** argv, CmdArgs& args) {
+parseCmdArgs(int argc, char** argv, fart::AppOptions& args) {
     // parsing
-    int ac = 1; 
+    int ac = 1;
     while (ac < argc) {
-        if (argv[ac][0] != '-') {
-            args.scene = argv[ac];
+        std::string arg = argv[ac];
+        if (arg[0] != '-') {
+            args.scene = arg;
+        } else if (arg == "--headless") {
+            args.headless = true;
+        } else if (arg == "--wavefront") {
+            args.wavefront = true;
+        } else if (arg == "--adaptive") {
+            args.adaptive_error = parseFloat(nextArg(argc, argv, ac), arg);
+        } else if (arg == "--threads") {
+            args.threads = parseUInt(nextArg(argc, argv, ac), arg);
+        } else if (arg == "--pin-threads") {
+            args.pin_threads = true;
+        } else if (arg == "--spp") {
+            args.spp = parseUInt(nextArg(argc, argv, ac), arg);
+        } else if (arg == "--resolution") {
+            std::string value = nextArg(argc, argv, ac);
+            size_t x = value.find('x');
+            if (x == std::string::npos) {
+                throw std::runtime_error("Invalid value for --resolution, expected WxH: " + value);
+            }
+            args.resolution.x = parseUInt(value.substr(0, x), arg);
+            args.resolution.y = parseUInt(value.substr(x + 1), arg);
+        } else if (arg == "--out") {
+            args.out = nextArg(argc, argv, ac);
+        } else if (arg == "--eye") {
+            args.eye = parseVec3(nextArg(argc, argv, ac), arg);
+        } else if (arg == "--lookat") {
+            args.lookat = parseVec3(nextArg(argc, argv, ac), arg);
+        } else if (arg == "--up") {
+            args.up = parseVec3(nextArg(argc, argv, ac), arg);
+        } else if (arg == "--trace") {
+            args.trace = nextArg(argc, argv, ac);
+        } else if (arg == "--record") {
+            args.record = nextArg(argc, argv, ac);
+        } else if (arg == "--replay") {
+            args.replay = nextArg(argc, argv, ac);
+        } else if (arg == "--frames-per-keyframe") {
+            args.frames_per_keyframe = parseUInt(nextArg(argc, argv, ac), arg);
+        } else if (arg == "--stats") {
+            args.stats = nextArg(argc, argv, ac);
+        } else if (arg == "--mode") {
+            args.render_mode = parseRenderMode(nextArg(argc, argv, ac));
+        } else if (arg == "--triangles") {
+            std::string value = nextArg(argc, argv, ac);
+            if (value == "indexed") args.triangle_layout = fart::TriangleLayout::Indexed;
+            else if (value == "precomputed") args.triangle_layout = fart::TriangleLayout::Precomputed;
+            else throw std::runtime_error("Invalid value for --triangles, expected indexed or precomputed: " + value);
+        } else if (arg == "--split") {
+            args.split_method = parseSplitMethod(nextArg(argc, argv, ac));
+        } else if (arg == "--layout") {
+            std::string value = nextArg(argc, argv, ac);
+            if (value == "dfs") args.node_layout = fart::BVHLayout::DFS;
+            else if (value == "treelet") args.node_layout = fart::BVHLayout::Treelet;
+            else throw std::runtime_error("Invalid value for --layout, expected dfs or treelet: " + value);
+        } else if (arg == "--no-cache") {
+            args.scene_cache = false;
+        } else if (arg == "--cache-dir") {
+            args.cache_dir = nextArg(argc, argv, ac);
+        } else if (arg == "--heatmap-scale") {
+            args.heatmap_scale = (float)parseUInt(nextArg(argc, argv, ac), arg);
+        } else {
+            throw std::runtime_error("Unknown option " + arg);
         }
 
         ac += 1;
@@ -24,16 +140,17 @@ parseCmdArgs(int argc, char** argv, CmdArgs& args) {
     if (args.scene.empty()) {
         throw std::runtime_error("No scene name provided");
     }
+    if (!args.record.empty() && !args.replay.empty()) {
+        throw std::runtime_error("--record and --replay cannot be combined");
+    }
 }
 
-int 
+int
 main(int argc, char** argv) {
-    CmdArgs args;
+    fart::AppOptions args;
     parseCmdArgs(argc, argv, args);
-    
-    fart::App app(args.scene);
 
-    app.run();
+    fart::App app(args);
 
-    return 0;
+    return app.run();
 }
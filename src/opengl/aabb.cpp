@@ -33,6 +33,14 @@ AABB::merge(const AABB& other) const {
     };
 }
 
+AABB
+AABB::intersect(const AABB& other) const {
+    return {
+        glm::max(min, other.min),
+        glm::min(max, other.max)
+    };
+}
+
 void
 AABB::extend(const glm::vec3& other) {
     // Inline min/max faster than glm and std equivalents
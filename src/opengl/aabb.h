@@ -10,6 +10,7 @@ struct AABB {
 
     AABB transform(const glm::mat4& xfm) const;
     AABB merge(const AABB& other) const;
+    AABB intersect(const AABB& other) const;
 
     void extend(const glm::vec3& other);
 
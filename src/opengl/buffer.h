@@ -48,6 +48,13 @@ struct Buffer {
             m_size = size;
         }
 
+        // Reads back the first n_elements, e.g. counters written by a shader
+        template <typename T> void getData(T* data, size_t n_elements) {
+            bind();
+            glGetBufferSubData(m_type, 0, sizeof(T) * n_elements, data);
+            unbind();
+        }
+
         GLuint& getBuffer() { return m_buffer; };
         void bind();
         void unbind();
@@ -1,7 +1,11 @@
 #include "bvh.h"
 
 #include "common/defs.h"
+#include "common/job_system.h"
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
 #include <numeric>
 #include <string>
 #include <chrono>
@@ -15,66 +19,267 @@
  */
 namespace fart {
 
-BVH::BVH(const std::vector<Geometry>& geometries, BVHSplitMethod split_method) {
-    size_t index_offset = 0;
+namespace {
 
-    size_t vertices_size = std::accumulate(geometries.begin(), geometries.end(), 0, [](size_t acc, const Geometry& el) { return acc + el.vertices.size(); });
-    m_vertices.reserve(vertices_size);
-    size_t indices_size = std::accumulate(geometries.begin(), geometries.end(), 0, [](size_t acc, const Geometry& el) { return acc + el.indices.size(); });
-    m_indices.reserve(indices_size);
+// Runs f(first, last, chunk) over n_chunks equal parts of [0, n), the first part on the calling thread
+template <typename F>
+void
+forEachChunk(size_t n, size_t n_chunks, F&& f) {
+    TaskGroup tasks;
+    for (size_t c = 1; c < n_chunks; c++)
+        tasks.run([&, c]() { f(n * c / n_chunks, n * (c + 1) / n_chunks, c); });
+    f(0, n / n_chunks, 0);
+    tasks.wait();
+}
 
-    for (auto& geometry : geometries) {
-        m_vertices.insert(m_vertices.end(), geometry.vertices.begin(), geometry.vertices.end());
-        m_indices.insert(m_indices.end(), geometry.indices.begin(), geometry.indices.end());
+bool
+isValid(const AABB& aabb) {
+    return aabb.min.x <= aabb.max.x && aabb.min.y <= aabb.max.y && aabb.min.z <= aabb.max.z;
+}
 
-        std::transform(m_indices.end() - geometry.indices.size(), m_indices.end(), m_indices.end() - geometry.indices.size(), [&](uint32_t index) {
-                return index + index_offset;
+// Inserts two zero bits between each of the lower 21 bits of v
+uint64_t
+expandBits(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffff;
+    v = (v | v << 16) & 0x1f0000ff0000ff;
+    v = (v | v << 8)  & 0x100f00f00f00f00f;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3;
+    v = (v | v << 2)  & 0x1249249249249249;
+    return v;
+}
+
+/*
+ * Stable LSD radix sort of keys along with their values, 8 bits per pass.
+ * Every chunk builds its own histogram, scatter offsets are assigned bucket by bucket
+ * and chunk by chunk so the chunks can scatter concurrently without changing the result.
+ */
+void
+radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, uint32_t key_bits, size_t n_chunks) {
+    size_t n = keys.size();
+    std::vector<uint64_t> keys_tmp(n);
+    std::vector<uint32_t> values_tmp(n);
+    std::vector<std::array<size_t, 256>> histograms(n_chunks);
+
+    for (uint32_t shift = 0; shift < key_bits; shift += 8) {
+        forEachChunk(n, n_chunks, [&](size_t first, size_t last, size_t chunk) {
+            std::array<size_t, 256>& histogram = histograms[chunk];
+            histogram.fill(0);
+            for (size_t i = first; i < last; i++)
+                histogram[(keys[i] >> shift) & 0xff]++;
         });
-        index_offset += geometry.vertices.size();
+
+        // Passes over a byte that all keys share would not move anything
+        bool skip = false;
+        size_t offset = 0;
+        for (size_t b = 0; b < 256; b++) {
+            size_t bucket_count = 0;
+            for (auto& histogram : histograms) {
+                size_t count = histogram[b];
+                histogram[b] = offset + bucket_count;
+                bucket_count += count;
+            }
+            skip |= bucket_count == n;
+            offset += bucket_count;
+        }
+        if (skip) continue;
+
+        forEachChunk(n, n_chunks, [&](size_t first, size_t last, size_t chunk) {
+            std::array<size_t, 256>& histogram = histograms[chunk];
+            for (size_t i = first; i < last; i++) {
+                size_t dst = histogram[(keys[i] >> shift) & 0xff]++;
+                keys_tmp[dst] = keys[i];
+                values_tmp[dst] = values[i];
+            }
+        });
+        std::swap(keys, keys_tmp);
+        std::swap(values, values_tmp);
     }
-    m_split_method = split_method;
+}
 
-    build();
 }
 
-BVH::BVH(std::vector<AligendVertex>& vertices, std::vector<uint32_t>& indices, BVHSplitMethod split_method) {
-    m_vertices = vertices;
-    m_indices = indices;
+BVH::BVH(const std::vector<AligendVertex>& vertices, 
+         std::vector<uint32_t>& indices, 
+         size_t first_index, 
+         size_t index_count, 
+         BVHSplitMethod split_method,
+         float spatial_split_budget) {
+    m_vertices = vertices.data();
+    m_indices = indices.data();
+    m_first_index = first_index;
+    m_index_count = index_count;
     m_split_method = split_method;
+    m_spatial_split_budget = spatial_split_budget;
 
     build();
 }
 
+size_t
+BVH::indexCapacity(size_t index_count, BVHSplitMethod split_method, float spatial_split_budget) {
+    if (split_method != BVHSplitMethod::SBVH) return index_count;
+    size_t tri_count = index_count / 3;
+    return 3 * (tri_count + (size_t)(tri_count * spatial_split_budget));
+}
+
+std::vector<BVH>
+BVH::buildAll(const std::vector<Object>& objects, 
+              std::vector<AligendVertex>& vertices, 
+              std::vector<uint32_t>& indices, 
+              BVHSplitMethod split_method,
+              float spatial_split_budget) {
+    return buildAll(objects, vertices, indices, std::vector<BVHSplitMethod>(objects.size(), split_method), spatial_split_budget);
+}
+
+std::vector<BVH>
+BVH::buildAll(const std::vector<Object>& objects, 
+              std::vector<AligendVertex>& vertices, 
+              std::vector<uint32_t>& indices, 
+              const std::vector<BVHSplitMethod>& split_methods,
+              float spatial_split_budget) {
+    // Size the arena once and record where each object's geometry is placed
+    std::vector<size_t> first_vertex(objects.size() + 1, 0);
+    std::vector<size_t> first_index(objects.size() + 1, 0);
+    std::vector<size_t> index_count(objects.size(), 0);
+    for (size_t i = 0; i < objects.size(); i++) {
+        first_vertex[i + 1] = first_vertex[i];
+        for (auto& geometry : objects[i].geometries) {
+            first_vertex[i + 1] += geometry.vertices.size();
+            index_count[i] += geometry.indices.size();
+        }
+        first_index[i + 1] = first_index[i] + indexCapacity(index_count[i], split_methods[i], spatial_split_budget);
+    }
+    vertices.resize(first_vertex.back());
+    indices.resize(first_index.back());
+
+    std::vector<std::unique_ptr<BVH>> results(objects.size());
+
+    // Objects are built as separate jobs; large objects additionally split their own build into jobs
+    parallelFor(0, objects.size(), 1, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            size_t vertex_offset = first_vertex[i];
+            size_t index_offset = first_index[i];
+            for (auto& geometry : objects[i].geometries) {
+                std::copy(geometry.vertices.begin(), geometry.vertices.end(), vertices.begin() + vertex_offset);
+                std::transform(geometry.indices.begin(), geometry.indices.end(), indices.begin() + index_offset, [&](uint32_t index) {
+                        return index + vertex_offset;
+                });
+                vertex_offset += geometry.vertices.size();
+                index_offset += geometry.indices.size();
+            }
+
+            results[i] = std::make_unique<BVH>(vertices, indices, first_index[i], index_count[i], split_methods[i], spatial_split_budget);
+        }
+    });
+
+    // Close the gaps left by spatial split capacity that was not used
+    if (first_index.back() != std::accumulate(index_count.begin(), index_count.end(), (size_t)0)) {
+        size_t cursor = 0;
+        for (size_t i = 0; i < objects.size(); i++) {
+            BVH& bvh = *results[i];
+            if (cursor != bvh.m_first_index) {
+                std::copy(indices.begin() + bvh.m_first_index, indices.begin() + bvh.m_first_index + bvh.m_index_count, indices.begin() + cursor);
+                for (size_t n = 0; n < bvh.m_nodes_used; n++) {
+                    if (bvh.m_bvh_nodes[n].left_child == 0)
+                        bvh.m_bvh_nodes[n].first_tri_index_id -= bvh.m_first_index - cursor;
+                }
+                bvh.m_first_index = cursor;
+            }
+            cursor += bvh.m_index_count;
+        }
+        indices.resize(cursor);
+    }
+
+    std::vector<BVH> bvhs;
+    bvhs.reserve(objects.size());
+    for (auto& bvh : results)
+        bvhs.push_back(std::move(*bvh));
+    return bvhs;
+}
+
 void
 BVH::build() {
     WARN("Building BVH.. This may take a while.");
     auto t_start = std::chrono::high_resolution_clock::now();
         
-    size_t N = m_indices.size() / 3;
-    m_nodes_used = 1;
-    m_centroids.resize(N);
-    m_bvh_nodes.resize( N * 2 );
+    size_t N = m_index_count / 3;
+    m_triangle_count = N;
+    uint32_t n_threads = JobSystem::get().threadCount();
+
+    bool clamped = false;
+    if (m_split_method == BVHSplitMethod::SBVH) {
+        clamped = buildSpatial( n_threads );
+    } else {
+        m_tri_ids.resize(N);
+        std::iota(m_tri_ids.begin(), m_tri_ids.end(), 0);
+        m_centroids.resize(N);
+        m_bvh_nodes.resize( std::max<size_t>(N * 2, 1) );
+
+        for (size_t i = 0; i < N; ++i) {
+            
+            const glm::vec3& t1 = position(i, 0);
+            const glm::vec3& t2 = position(i, 1);
+            const glm::vec3& t3 = position(i, 2);
+
+            m_centroids[i] = (t1 + t2 + t3) / 3.f;
+        }
 
-    for (size_t i = 0; i < N; ++i) {
-        
-        const glm::vec3& t1 = m_vertices[m_indices[3*i]].position;
-        const glm::vec3& t2 = m_vertices[m_indices[3*i+1]].position;
-        const glm::vec3& t3 = m_vertices[m_indices[3*i+2]].position;
+        uint32_t root_idx = 0;
+        BVHNode& root = m_bvh_nodes[root_idx];
+        root.left_child = 0;
+        root.first_tri_index_id = 0, root.tri_count = N;
 
-        m_centroids[i] = (t1 + t2 + t3) / 3.f;
-    }
+        if (m_split_method == BVHSplitMethod::LBVH || m_split_method == BVHSplitMethod::HLBVH)
+            sortMorton( n_threads );
 
-    uint32_t root_idx = 0;
-    BVHNode& root = m_bvh_nodes[root_idx];
-    root.left_child = 0;
-    root.first_tri_index_id = 0, root.tri_count = N;
+        updateNodeBounds( root_idx );
+        clamped = subdivide( root_idx, root_idx + 1, 0, n_threads );
+        compact();
+        if (!m_morton_codes.empty())
+            refitNodes();
+    }
+    reorderIndices();
 
-    updateNodeBounds( root_idx );
-    subdivide( root_idx );
+    // Build-only state is dropped, the BVH keeps nothing but its nodes
+    m_tri_ids = std::vector<uint32_t>();
+    m_centroids = std::vector<glm::vec3>();
+    m_morton_codes = std::vector<uint64_t>();
+    m_vertices = nullptr;
+    m_indices = nullptr;
 
     auto build_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - t_start);
 
-    LOG("Built BVH over " + std::to_string(N) + " triangles in " + std::to_string(build_time_ms.count() / 1000.f) + " seconds");
+    std::string references = m_split_method == BVHSplitMethod::SBVH 
+        ? " (" + std::to_string(m_index_count / 3) + " references, duplication factor " + std::to_string(getDuplicationFactor()) + ")" 
+        : "";
+    if (clamped)
+        WARN("BVH over " + std::to_string(N) + " triangles exceeds depth " + std::to_string(MAX_DEPTH) + ", deeper nodes were made leaves");
+    LOG("Built BVH over " + std::to_string(N) + " triangles" + references + " in " + std::to_string(build_time_ms.count() / 1000.f) + " seconds");
+}
+
+void
+BVH::reorderNodes( BVHLayout layout ) {
+    fart::reorderNodes(m_bvh_nodes, m_nodes_used, layout);
+}
+
+/*
+ * Applies the triangle order found during the build to the shared index range
+ * and turns leaf offsets into offsets into the full index array.
+ * With spatial splits the range grows by the duplicated triangles.
+ */
+void
+BVH::reorderIndices() {
+    std::vector<uint32_t> original(m_indices + m_first_index, m_indices + m_first_index + m_index_count);
+    m_index_count = 3 * m_tri_ids.size();
+    for (size_t slot = 0; slot < m_tri_ids.size(); slot++) {
+        for (uint32_t corner = 0; corner < 3; corner++)
+            m_indices[m_first_index + 3 * slot + corner] = original[3 * m_tri_ids[slot] + corner];
+    }
+
+    for (size_t i = 0; i < m_nodes_used; i++) {
+        if (m_bvh_nodes[i].left_child == 0)
+            m_bvh_nodes[i].first_tri_index_id += m_first_index;
+    }
 }
 
 void
@@ -83,25 +288,142 @@ BVH::updateNodeBounds( uint32_t node_idx ) {
     node.aabb.min = glm::vec3(1e30f);
     node.aabb.max = glm::vec3(-1e30f);
 
-    for (uint32_t i = node.first_tri_index_id; i < node.first_tri_index_id + 3 * node.tri_count; i++) {
-        const glm::vec3& t1 = m_vertices[m_indices[i]].position;
-        node.aabb.extend(t1);
+    uint32_t first_slot = node.first_tri_index_id / 3;
+    for (uint32_t slot = first_slot; slot < first_slot + node.tri_count; slot++) {
+        node.aabb.extend(position(slot, 0));
+        node.aabb.extend(position(slot, 1));
+        node.aabb.extend(position(slot, 2));
+    }
+}
+
+/*
+ * Orders the triangles along a Morton curve through the centroid bounds.
+ * Small meshes use 30 bit codes, which take half the radix passes of 63 bit codes.
+ */
+void
+BVH::sortMorton( uint32_t n_threads ) {
+    size_t N = m_tri_ids.size();
+    AABB centroid_bounds;
+    for (auto& centroid : m_centroids)
+        centroid_bounds.extend(centroid);
+    glm::vec3 extent = glm::max(centroid_bounds.extent(), glm::vec3(1e-30f));
+
+    uint32_t bits_per_axis = N >= MORTON_63_BIT_THRESHOLD ? 21 : 10;
+    float scale = (float)((1u << bits_per_axis) - 1);
+    size_t n_chunks = N >= PARALLEL_SORT_THRESHOLD ? n_threads : 1;
+
+    m_morton_codes.resize(N);
+    forEachChunk(N, n_chunks, [&](size_t first, size_t last, size_t) {
+        for (size_t i = first; i < last; i++) {
+            glm::vec3 p = glm::clamp((m_centroids[i] - centroid_bounds.min) / extent, 0.f, 1.f) * scale;
+            m_morton_codes[i] = expandBits((uint64_t)p.x) << 2 | expandBits((uint64_t)p.y) << 1 | expandBits((uint64_t)p.z);
+        }
+    });
+
+    std::vector<uint32_t> order(N);
+    std::iota(order.begin(), order.end(), 0);
+    radixSort(m_morton_codes, order, 3 * bits_per_axis, n_chunks);
+
+    std::vector<glm::vec3> centroids(N);
+    for (size_t i = 0; i < N; i++) {
+        centroids[i] = m_centroids[order[i]];
+        m_tri_ids[i] = order[i];
     }
+    m_centroids = std::move(centroids);
 }
 
+/*
+ * Morton split nodes skip bounds during subdivision, they are computed bottom up here instead.
+ * compact() places children after their parents, so a reverse sweep visits children first.
+ */
 void
-BVH::subdivide( uint32_t node_idx ) {
+BVH::refitNodes() {
+    for (size_t i = m_nodes_used; i-- > 0;) {
+        BVHNode& node = m_bvh_nodes[i];
+        if (node.left_child == 0) {
+            updateNodeBounds(i);
+            continue;
+        }
+        node.aabb = m_bvh_nodes[node.left_child].aabb.merge(m_bvh_nodes[node.left_child + 1].aabb);
+    }
+}
+
+/*
+ * Every node owns a block of 2 * tri_count - 2 slots for its descendants, starting at first_child_idx.
+ * Subtrees therefore never compete for node slots and can be built concurrently.
+ * compact() later removes the unused slots.
+ */
+bool
+BVH::subdivide( uint32_t node_idx, uint32_t first_child_idx, uint32_t depth, uint32_t n_threads ) {
     uint32_t axis = 0;
     float split_pos = 0.f;
+    uint32_t left_count = 0;
     switch (m_split_method) {
         case BVHSplitMethod::Equal: 
-            if (!splitEqual(node_idx, split_pos, axis)) return;
+            if (!splitEqual(node_idx, split_pos, axis)) return false;
+            left_count = partition(node_idx, split_pos, axis);
             break;
         case BVHSplitMethod::SAH:
-            if (!splitSAH(node_idx, split_pos, axis)) return;
+            if (!splitSAH(node_idx, split_pos, axis, n_threads)) return false;
+            left_count = partition(node_idx, split_pos, axis);
             break;
+        case BVHSplitMethod::HLBVH:
+            // A stable partition keeps both halves in Morton order for the levels below
+            if (!isMortonNode(m_bvh_nodes[node_idx].tri_count) && splitSAH(node_idx, split_pos, axis, n_threads)) {
+                left_count = partitionStable(node_idx, split_pos, axis);
+                if (left_count != 0 && left_count != m_bvh_nodes[node_idx].tri_count) break;
+            }
+            [[fallthrough]];
+        case BVHSplitMethod::LBVH:
+            if (!splitMorton(node_idx, left_count)) return false;
+            break;
+        case BVHSplitMethod::SBVH:
+            // Built by subdivideSpatial()
+            return false;
+    }
+
+    BVHNode& node = m_bvh_nodes[node_idx];
+    if (left_count == 0 || left_count == node.tri_count) return false;
+    if (depth == MAX_DEPTH) return true;
+
+    uint32_t left_child_idx = first_child_idx;
+    uint32_t right_child_idx = first_child_idx + 1;
+    uint32_t right_count = node.tri_count - left_count;
+
+    node.left_child = left_child_idx;
+
+    m_bvh_nodes[left_child_idx].first_tri_index_id = node.first_tri_index_id;
+    m_bvh_nodes[left_child_idx].tri_count = left_count;
+    m_bvh_nodes[right_child_idx].first_tri_index_id = node.first_tri_index_id + 3 * left_count;
+    m_bvh_nodes[right_child_idx].tri_count = right_count;
+
+    node.tri_count = 0;
+
+    if (!isMortonNode( left_count ))
+        updateNodeBounds( left_child_idx );
+    if (!isMortonNode( right_count ))
+        updateNodeBounds( right_child_idx );
+
+    uint32_t left_first_child_idx = first_child_idx + 2;
+    uint32_t right_first_child_idx = left_first_child_idx + 2 * left_count - 2;
+
+    bool left_clamped = false, right_clamped = false;
+    if (n_threads > 1 && std::min(left_count, right_count) >= PARALLEL_BUILD_THRESHOLD) {
+        TaskGroup left;
+        left.run([&]() {
+            left_clamped = subdivide( left_child_idx, left_first_child_idx, depth + 1, n_threads / 2 );
+        });
+        right_clamped = subdivide( right_child_idx, right_first_child_idx, depth + 1, n_threads - n_threads / 2 );
+        left.wait();
+    } else {
+        left_clamped = subdivide( left_child_idx, left_first_child_idx, depth + 1, n_threads );
+        right_clamped = subdivide( right_child_idx, right_first_child_idx, depth + 1, n_threads );
     }
+    return left_clamped || right_clamped;
+}
 
+uint32_t
+BVH::partition( uint32_t node_idx, float split_pos, uint32_t axis ) {
     BVHNode& node = m_bvh_nodes[node_idx];
     int32_t i = node.first_tri_index_id;
     int32_t j = i + (node.tri_count - 1) * 3;
@@ -110,34 +432,77 @@ BVH::subdivide( uint32_t node_idx ) {
         if (m_centroids[i/3][axis] < split_pos) {
             i+=3;
         } else {
-            std::swap(m_indices[i], m_indices[j]);
-            std::swap(m_indices[i+1], m_indices[j+1]);
-            std::swap(m_indices[i+2], m_indices[j+2]);
+            std::swap(m_tri_ids[i/3], m_tri_ids[j/3]);
             std::swap(m_centroids[i/3], m_centroids[j/3]);
             j-=3;
         }
     }
 
-    uint32_t left_count = (i - node.first_tri_index_id) / 3;
-    if (left_count == 0 || left_count == node.tri_count) return;
+    return (i - node.first_tri_index_id) / 3;
+}
 
-    uint32_t left_child_idx = m_nodes_used++;
-    uint32_t right_child_idx = m_nodes_used++;
+uint32_t
+BVH::partitionStable( uint32_t node_idx, float split_pos, uint32_t axis ) {
+    BVHNode& node = m_bvh_nodes[node_idx];
+    uint32_t first = node.first_tri_index_id / 3;
+    std::vector<uint32_t> slots(node.tri_count);
+    std::iota(slots.begin(), slots.end(), first);
+    auto right = std::stable_partition(slots.begin(), slots.end(), [&](uint32_t slot) {
+        return m_centroids[slot][axis] < split_pos;
+    });
+
+    std::vector<uint32_t> tri_ids(node.tri_count);
+    std::vector<glm::vec3> centroids(node.tri_count);
+    std::vector<uint64_t> morton_codes(node.tri_count);
+    for (uint32_t i = 0; i < node.tri_count; i++) {
+        tri_ids[i] = m_tri_ids[slots[i]];
+        centroids[i] = m_centroids[slots[i]];
+        morton_codes[i] = m_morton_codes[slots[i]];
+    }
+    std::copy(tri_ids.begin(), tri_ids.end(), m_tri_ids.begin() + first);
+    std::copy(centroids.begin(), centroids.end(), m_centroids.begin() + first);
+    std::copy(morton_codes.begin(), morton_codes.end(), m_morton_codes.begin() + first);
 
-    node.left_child = left_child_idx;
+    return right - slots.begin();
+}
 
-    m_bvh_nodes[left_child_idx].first_tri_index_id = node.first_tri_index_id;
-    m_bvh_nodes[left_child_idx].tri_count = left_count;
-    m_bvh_nodes[right_child_idx].first_tri_index_id = i;
-    m_bvh_nodes[right_child_idx].tri_count = node.tri_count - left_count;
+// Whether a node of this size is split by Morton code and gets its bounds only after the build
+bool
+BVH::isMortonNode( uint32_t tri_count ) const {
+    return m_split_method == BVHSplitMethod::LBVH || 
+          (m_split_method == BVHSplitMethod::HLBVH && tri_count < HLBVH_SAH_THRESHOLD);
+}
 
-    node.tri_count = 0;
+/*
+ * Packs the nodes densely. Child pairs are emitted in the order a serial, depth-first build
+ * would have allocated them, which keeps the layout independent of the task schedule.
+ */
+void
+BVH::compact() {
+    std::vector<BVHNode> nodes(m_bvh_nodes.size());
+    nodes[0] = m_bvh_nodes[0];
+    m_nodes_used = 1;
+
+    std::vector<uint32_t> stack { 0 };
+    while (!stack.empty()) {
+        uint32_t node_idx = stack.back();
+        stack.pop_back();
+
+        BVHNode& node = nodes[node_idx];
+        if (node.left_child == 0) continue;
 
-    updateNodeBounds( left_child_idx );
-    updateNodeBounds( right_child_idx );
+        uint32_t left_child_idx = m_nodes_used;
+        m_nodes_used += 2;
+        nodes[left_child_idx] = m_bvh_nodes[node.left_child];
+        nodes[left_child_idx + 1] = m_bvh_nodes[node.left_child + 1];
+        node.left_child = left_child_idx;
 
-    subdivide( left_child_idx );
-    subdivide( right_child_idx );
+        stack.push_back(left_child_idx + 1);
+        stack.push_back(left_child_idx);
+    }
+
+    nodes.resize(m_nodes_used);
+    m_bvh_nodes = std::move(nodes);
 }
 
 bool
@@ -158,7 +523,7 @@ BVH::splitEqual(uint32_t node_idx, float& split_pos, uint32_t& axis) {
  *
  */
 bool
-BVH::splitSAH(uint32_t node_idx, float& split_pos, uint32_t& axis) {
+BVH::splitSAH(uint32_t node_idx, float& split_pos, uint32_t& axis, uint32_t n_threads) {
 
     BVHNode& node = m_bvh_nodes[node_idx];
     const glm::vec3 node_extent = node.aabb.extent();
@@ -166,6 +531,49 @@ BVH::splitSAH(uint32_t node_idx, float& split_pos, uint32_t& axis) {
 
     const int n_buckets = 12;
     const int n_splits = n_buckets - 1;
+    using Buckets = std::array<std::array<BVHSplitBucket, n_buckets>, 3>;
+
+    // Bins a range of triangles into buckets along all three axes
+    auto bin = [&](uint32_t first_tri, uint32_t last_tri, Buckets& buckets) {
+        for (uint32_t t = first_tri; t < last_tri; t++) {
+            AABB bounds;
+            bounds.extend(position(t, 0));
+            bounds.extend(position(t, 1));
+            bounds.extend(position(t, 2));
+
+            for (size_t ax = 0; ax < 3; ax++) {
+                if (node_extent[ax] <= 0.f) continue;
+                int b = n_buckets * std::clamp(((m_centroids[t][ax] - node.aabb.min[ax]) / node_extent[ax]), 0.f, 1.f);
+                if (b == n_buckets) b = n_buckets - 1;
+                buckets[ax][b].count += 1;
+                buckets[ax][b].bounds = buckets[ax][b].bounds.merge(bounds);
+            }
+        }
+    };
+
+    uint32_t first_tri = node.first_tri_index_id / 3;
+    uint32_t n_chunks = node.tri_count >= PARALLEL_BINNING_THRESHOLD ? n_threads : 1;
+
+    // Chunks are binned concurrently and merged in a fixed order, so the result does not depend on n_threads
+    std::vector<Buckets> chunk_buckets(n_chunks);
+    TaskGroup tasks;
+    for (uint32_t c = 1; c < n_chunks; c++) {
+        uint32_t chunk_first = first_tri + (uint64_t)node.tri_count * c / n_chunks;
+        uint32_t chunk_last = first_tri + (uint64_t)node.tri_count * (c + 1) / n_chunks;
+        tasks.run([&, c, chunk_first, chunk_last]() { bin(chunk_first, chunk_last, chunk_buckets[c]); });
+    }
+    bin(first_tri, first_tri + node.tri_count / n_chunks, chunk_buckets[0]);
+    tasks.wait();
+
+    Buckets& buckets = chunk_buckets[0];
+    for (uint32_t c = 1; c < n_chunks; c++) {
+        for (size_t ax = 0; ax < 3; ax++) {
+            for (int b = 0; b < n_buckets; b++) {
+                buckets[ax][b].count += chunk_buckets[c][ax][b].count;
+                buckets[ax][b].bounds = buckets[ax][b].bounds.merge(chunk_buckets[c][ax][b].bounds);
+            }
+        }
+    }
 
     int min_cost_split_bucket = -1;
     uint32_t min_split_axis = 0;
@@ -173,31 +581,21 @@ BVH::splitSAH(uint32_t node_idx, float& split_pos, uint32_t& axis) {
 
     for (size_t ax = 0; ax < 3; ax++) {
         if (node_extent[ax] <= 0.f) continue;
-        std::vector<BVHSplitBucket> buckets (n_buckets);
-
-        for (uint32_t i = node.first_tri_index_id; i < node.first_tri_index_id + 3 * node.tri_count; i+=3) {
-            int b = n_buckets * std::clamp(((m_centroids[i / 3][ax] - node.aabb.min[ax]) / node_extent[ax]), 0.f, 1.f);
-            if (b == n_buckets) b = n_buckets - 1;
-            buckets[b].count += 1;
-            buckets[b].bounds.extend(m_vertices[m_indices[i]].position);
-            buckets[b].bounds.extend(m_vertices[m_indices[i+1]].position);
-            buckets[b].bounds.extend(m_vertices[m_indices[i+2]].position);
-        }
 
         std::vector<float> costs (n_splits);
         int count_below = 0;
         AABB bound_below;
         for (int i = 0; i < n_splits; i++) {
-            bound_below = bound_below.merge(buckets[i].bounds);
-            count_below += buckets[i].count;
+            bound_below = bound_below.merge(buckets[ax][i].bounds);
+            count_below += buckets[ax][i].count;
             costs[i] += count_below * bound_below.surfaceArea();
         }
 
         int count_above = 0;
         AABB bound_above;
         for (int i = n_splits; i >= 1; i--) {
-            bound_above = bound_above.merge(buckets[i].bounds);
-            count_above += buckets[i].count;
+            bound_above = bound_above.merge(buckets[ax][i].bounds);
+            count_above += buckets[ax][i].count;
             costs[i - 1] += count_above * bound_above.surfaceArea();
         }
 
@@ -220,4 +618,319 @@ BVH::splitSAH(uint32_t node_idx, float& split_pos, uint32_t& axis) {
     
     return node.tri_count > 16 || min_cost < leaf_cost;
 }
+/*
+ * Splits a Morton sorted range where the highest bit that differs within it flips from 0 to 1.
+ * Reference:
+ * https://developer.nvidia.com/blog/thinking-parallel-part-iii-tree-construction-gpu/
+ */
+bool
+BVH::splitMorton(uint32_t node_idx, uint32_t& left_count) {
+    BVHNode& node = m_bvh_nodes[node_idx];
+    if (node.tri_count <= MORTON_MAX_LEAF_SIZE) return false;
+
+    auto first = m_morton_codes.begin() + node.first_tri_index_id / 3;
+    auto last = first + node.tri_count;
+    uint64_t diff = *first ^ *(last - 1);
+
+    // Identical codes carry no more spatial information, split the range in half
+    if (diff == 0) {
+        left_count = node.tri_count / 2;
+        return true;
+    }
+
+    uint32_t bit = 63;
+    while (!((diff >> bit) & 1)) bit--;
+    left_count = std::partition_point(first, last, [&](uint64_t code) { return !((code >> bit) & 1); }) - first;
+
+    return true;
+}
+struct BVH::SpatialBuildState {
+    std::atomic<uint32_t> next_node { 1 };
+    std::atomic<uint32_t> next_ref { 0 };
+    float root_area { 0.f };
+};
+
+/*
+ * Reference:
+ * Stich et al. 2009, "Spatial Splits in Bounding Volume Hierarchies"
+ *
+ * The reference budget is handed down the tree in proportion to the size of each child,
+ * which keeps the result independent of the task schedule. Nodes and leaf references are
+ * taken from shared counters; compact() and the gather below put them in a deterministic order.
+ */
+bool
+BVH::buildSpatial( uint32_t n_threads ) {
+    size_t N = m_triangle_count;
+    uint32_t budget = N * m_spatial_split_budget;
+    m_tri_ids.resize(N + budget);
+    m_bvh_nodes.resize( std::max<size_t>(2 * (N + budget), 1) );
+
+    std::vector<BVHReference> refs(N);
+    AABB root_bounds;
+    for (uint32_t i = 0; i < N; i++) {
+        refs[i].tri_id = i;
+        for (uint32_t corner = 0; corner < 3; corner++)
+            refs[i].bounds.extend(vertex(i, corner));
+        root_bounds = root_bounds.merge(refs[i].bounds);
+    }
+
+    SpatialBuildState state;
+    state.root_area = root_bounds.surfaceArea();
+    bool clamped = subdivideSpatial( state, 0, refs, budget, 0, n_threads );
+    compact();
+
+    std::vector<uint32_t> tri_ids;
+    tri_ids.reserve(state.next_ref);
+    for (size_t i = 0; i < m_nodes_used; i++) {
+        BVHNode& node = m_bvh_nodes[i];
+        if (node.left_child != 0) continue;
+
+        uint32_t first = node.first_tri_index_id / 3;
+        node.first_tri_index_id = 3 * tri_ids.size();
+        tri_ids.insert(tri_ids.end(), m_tri_ids.begin() + first, m_tri_ids.begin() + first + node.tri_count);
+    }
+    m_tri_ids = std::move(tri_ids);
+    return clamped;
+}
+
+bool
+BVH::subdivideSpatial( SpatialBuildState& state, uint32_t node_idx, std::vector<BVHReference>& refs, uint32_t budget, uint32_t depth, uint32_t n_threads ) {
+    BVHNode& node = m_bvh_nodes[node_idx];
+    node.aabb = AABB();
+    for (auto& ref : refs)
+        node.aabb = node.aabb.merge(ref.bounds);
+    uint32_t n = refs.size();
+
+    BVHSplitCandidate object_split, split;
+    if (n > 4) {
+        AABB left_bounds, right_bounds;
+        object_split = findObjectSplit(refs, left_bounds, right_bounds);
+        split = object_split;
+
+        // Spatial splits only pay off where the object split children overlap
+        if (budget > 0 && left_bounds.intersect(right_bounds).surfaceArea() > SBVH_MIN_OVERLAP * state.root_area) {
+            BVHSplitCandidate spatial_split = findSpatialSplit(refs, node.aabb, budget);
+            if (spatial_split.cost < split.cost)
+                split = spatial_split;
+        }
+    }
+
+    std::vector<BVHReference> left, right;
+    if (split.spatial) {
+        uint32_t axis = split.axis;
+        for (auto& ref : refs) {
+            if (ref.bounds.max[axis] <= split.split_pos) {
+                left.push_back(ref);
+            } else if (ref.bounds.min[axis] >= split.split_pos) {
+                right.push_back(ref);
+            } else {
+                AABB left_part = clipTriangle(ref.tri_id, axis, ref.bounds.min[axis], split.split_pos).intersect(ref.bounds);
+                AABB right_part = clipTriangle(ref.tri_id, axis, split.split_pos, ref.bounds.max[axis]).intersect(ref.bounds);
+                if (isValid(left_part) || !isValid(right_part))
+                    left.push_back({ isValid(left_part) ? left_part : ref.bounds, ref.tri_id });
+                if (isValid(right_part))
+                    right.push_back({ right_part, ref.tri_id });
+            }
+        }
+
+        // Binning only estimates the duplicates, the budget is a hard limit
+        if (left.size() + right.size() - n > budget) {
+            left.clear();
+            right.clear();
+            split = object_split;
+        }
+    }
+    if (!split.spatial && split.cost < std::numeric_limits<float>::infinity()) {
+        for (auto& ref : refs)
+            (ref.bounds.centroid()[split.axis] < split.split_pos ? left : right).push_back(ref);
+    }
+
+    // Priced after the budget check, which may have fallen back to the object split
+    float leaf_cost = n;
+    float split_cost = 1.f / 2.f + split.cost / node.aabb.surfaceArea();
+    bool make_leaf = n <= 4 || left.empty() || right.empty() || (n <= 16 && !(split_cost < leaf_cost));
+    bool clamped = !make_leaf && depth == MAX_DEPTH;
+    if (make_leaf || clamped) {
+        uint32_t first = state.next_ref.fetch_add(n);
+        for (uint32_t i = 0; i < n; i++)
+            m_tri_ids[first + i] = refs[i].tri_id;
+
+        node.left_child = 0;
+        node.first_tri_index_id = 3 * first;
+        node.tri_count = n;
+        return clamped;
+    }
+
+    uint32_t duplicates = left.size() + right.size() - n;
+    uint32_t remaining_budget = budget - duplicates;
+    uint32_t left_budget = (uint64_t)remaining_budget * left.size() / (left.size() + right.size());
+    uint32_t right_budget = remaining_budget - left_budget;
+
+    refs = std::vector<BVHReference>();
+
+    uint32_t left_child_idx = state.next_node.fetch_add(2);
+    uint32_t right_child_idx = left_child_idx + 1;
+    node.left_child = left_child_idx;
+    node.tri_count = 0;
+
+    bool left_clamped = false, right_clamped = false;
+    if (n_threads > 1 && std::min(left.size(), right.size()) >= PARALLEL_BUILD_THRESHOLD) {
+        TaskGroup left_task;
+        left_task.run([&]() {
+            left_clamped = subdivideSpatial( state, left_child_idx, left, left_budget, depth + 1, n_threads / 2 );
+        });
+        right_clamped = subdivideSpatial( state, right_child_idx, right, right_budget, depth + 1, n_threads - n_threads / 2 );
+        left_task.wait();
+    } else {
+        left_clamped = subdivideSpatial( state, left_child_idx, left, left_budget, depth + 1, n_threads );
+        right_clamped = subdivideSpatial( state, right_child_idx, right, right_budget, depth + 1, n_threads );
+    }
+    return left_clamped || right_clamped;
+}
+
+// Binned SAH over reference centroids
+BVHSplitCandidate
+BVH::findObjectSplit( const std::vector<BVHReference>& refs, AABB& left_bounds, AABB& right_bounds ) const {
+    const int n_buckets = 12;
+
+    AABB centroid_bounds;
+    for (auto& ref : refs)
+        centroid_bounds.extend(ref.bounds.centroid());
+    const glm::vec3 extent = centroid_bounds.extent();
+
+    BVHSplitCandidate best;
+    for (uint32_t ax = 0; ax < 3; ax++) {
+        if (extent[ax] <= 0.f) continue;
+
+        std::array<BVHSplitBucket, n_buckets> buckets;
+        for (auto& ref : refs) {
+            int b = n_buckets * ((ref.bounds.centroid()[ax] - centroid_bounds.min[ax]) / extent[ax]);
+            b = std::clamp(b, 0, n_buckets - 1);
+            buckets[b].count += 1;
+            buckets[b].bounds = buckets[b].bounds.merge(ref.bounds);
+        }
+
+        std::array<AABB, n_buckets> bounds_above;
+        std::array<uint32_t, n_buckets> count_above;
+        AABB bound_above;
+        uint32_t n_above = 0;
+        for (int i = n_buckets - 1; i >= 1; i--) {
+            bound_above = bound_above.merge(buckets[i].bounds);
+            n_above += buckets[i].count;
+            bounds_above[i - 1] = bound_above;
+            count_above[i - 1] = n_above;
+        }
+
+        AABB bound_below;
+        uint32_t n_below = 0;
+        for (int i = 0; i < n_buckets - 1; i++) {
+            bound_below = bound_below.merge(buckets[i].bounds);
+            n_below += buckets[i].count;
+            if (n_below == 0 || count_above[i] == 0) continue;
+
+            float cost = n_below * bound_below.surfaceArea() + count_above[i] * bounds_above[i].surfaceArea();
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = ax;
+                best.split_pos = centroid_bounds.min[ax] + (extent[ax] / n_buckets) * (i + 1);
+                left_bounds = bound_below;
+                right_bounds = bounds_above[i];
+            }
+        }
+    }
+
+    return best;
+}
+
+/*
+ * Bins clipped reference bounds into equally sized slabs of the node. References enter
+ * the bin holding their minimum and exit the bin holding their maximum, so a split
+ * between two bins sends references that straddle it to both sides.
+ */
+BVHSplitCandidate
+BVH::findSpatialSplit( const std::vector<BVHReference>& refs, const AABB& bounds, uint32_t budget ) const {
+    const int n_bins = 16;
+    const glm::vec3 extent = bounds.extent();
+
+    BVHSplitCandidate best;
+    best.spatial = true;
+    for (uint32_t ax = 0; ax < 3; ax++) {
+        if (extent[ax] <= 0.f) continue;
+
+        float bin_width = extent[ax] / n_bins;
+        auto binOf = [&](float x) {
+            return std::clamp((int)((x - bounds.min[ax]) / bin_width), 0, n_bins - 1);
+        };
+
+        std::array<BVHSpatialBin, n_bins> bins;
+        for (auto& ref : refs) {
+            int first_bin = binOf(ref.bounds.min[ax]);
+            int last_bin = binOf(ref.bounds.max[ax]);
+            bins[first_bin].entries += 1;
+            bins[last_bin].exits += 1;
+
+            if (first_bin == last_bin) {
+                bins[first_bin].bounds = bins[first_bin].bounds.merge(ref.bounds);
+                continue;
+            }
+            for (int b = first_bin; b <= last_bin; b++) {
+                float min = b == first_bin ? ref.bounds.min[ax] : bounds.min[ax] + bin_width * b;
+                float max = b == last_bin ? ref.bounds.max[ax] : bounds.min[ax] + bin_width * (b + 1);
+                AABB part = clipTriangle(ref.tri_id, ax, min, max).intersect(ref.bounds);
+                if (isValid(part))
+                    bins[b].bounds = bins[b].bounds.merge(part);
+            }
+        }
+
+        std::array<AABB, n_bins> bounds_above;
+        std::array<uint32_t, n_bins> count_above;
+        AABB bound_above;
+        uint32_t n_above = 0;
+        for (int i = n_bins - 1; i >= 1; i--) {
+            bound_above = bound_above.merge(bins[i].bounds);
+            n_above += bins[i].exits;
+            bounds_above[i - 1] = bound_above;
+            count_above[i - 1] = n_above;
+        }
+
+        AABB bound_below;
+        uint32_t n_below = 0;
+        for (int i = 0; i < n_bins - 1; i++) {
+            bound_below = bound_below.merge(bins[i].bounds);
+            n_below += bins[i].entries;
+            if (n_below == 0 || count_above[i] == 0) continue;
+            if (n_below + count_above[i] - refs.size() > budget) continue;
+
+            float cost = n_below * bound_below.surfaceArea() + count_above[i] * bounds_above[i].surfaceArea();
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = ax;
+                best.split_pos = bounds.min[ax] + bin_width * (i + 1);
+            }
+        }
+    }
+
+    return best;
+}
+
+// Bounds of the part of a triangle between two planes orthogonal to axis
+AABB
+BVH::clipTriangle( uint32_t tri_id, uint32_t axis, float min, float max ) const {
+    AABB bounds;
+    for (uint32_t i = 0; i < 3; i++) {
+        const glm::vec3& a = vertex(tri_id, i);
+        const glm::vec3& b = vertex(tri_id, (i + 1) % 3);
+        if (a[axis] >= min && a[axis] <= max)
+            bounds.extend(a);
+
+        for (float plane : { min, max }) {
+            if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane)) {
+                glm::vec3 p = glm::mix(a, b, (plane - a[axis]) / (b[axis] - a[axis]));
+                p[axis] = plane;
+                bounds.extend(p);
+            }
+        }
+    }
+    return bounds;
+}
 }
@@ -1,8 +1,11 @@
 #pragma once
 
 #include "common/mesh.h"
+#include "common/split_method.h"
 #include "aabb.h"
+#include "node_layout.h"
 
+#include <limits>
 #include <vector>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
@@ -14,41 +17,146 @@ struct BVHSplitBucket {
     uint32_t count { 0 };
 };
 
+struct BVHSpatialBin {
+    AABB bounds;
+    uint32_t entries { 0 };
+    uint32_t exits { 0 };
+};
+
+// A triangle, or the part of it that lies within bounds after spatial splits
+struct BVHReference {
+    AABB bounds;
+    uint32_t tri_id;
+};
+
+struct BVHSplitCandidate {
+    float cost { std::numeric_limits<float>::infinity() };
+    uint32_t axis { 0 };
+    float split_pos { 0.f };
+    bool spatial { false };
+};
+
 struct BVHNode {
     AABB aabb;
     uint32_t left_child { 0 };
     uint32_t first_tri_index_id, tri_count, filler;
 };
 
-enum BVHSplitMethod {
-    Equal,
-    SAH,
-};
-
 struct BVH {
 
     public:
-        BVH( const std::vector<Geometry>& geometries, BVHSplitMethod split_method = BVHSplitMethod::SAH );
-        BVH( std::vector<AligendVertex>& vertices, std::vector<uint32_t>& indices, BVHSplitMethod split_method = BVHSplitMethod::SAH );
+        // Subtrees with at least this many triangles are built as separate tasks
+        static constexpr uint32_t PARALLEL_BUILD_THRESHOLD = 8192;
+        // Nodes with at least this many triangles bin their SAH buckets in parallel
+        static constexpr uint32_t PARALLEL_BINNING_THRESHOLD = 65536;
+        // Meshes with at least this many triangles are sorted in parallel
+        static constexpr uint32_t PARALLEL_SORT_THRESHOLD = 65536;
+        // Meshes with at least this many triangles use 63 bit instead of 30 bit Morton codes
+        static constexpr uint32_t MORTON_63_BIT_THRESHOLD = 1 << 20;
+        // Morton splits stop at leaves of this size
+        static constexpr uint32_t MORTON_MAX_LEAF_SIZE = 4;
+        // HLBVH nodes with at least this many triangles are split with SAH
+        static constexpr uint32_t HLBVH_SAH_THRESHOLD = 16384;
+        // Deepest leaf level, the BVH_WIDTH=2 GLSL traversal stack holds MAX_DEPTH + 1 nodes.
+        // Nodes at this depth become leaves, however many triangles they hold.
+        static constexpr uint32_t MAX_DEPTH = 31;
+        // Default number of additional SBVH triangle references, relative to the triangle count
+        static constexpr float SBVH_DEFAULT_BUDGET = 0.3f;
+        // Spatial splits are only tried where object split children overlap by at least this fraction of the root area
+        static constexpr float SBVH_MIN_OVERLAP = 1e-5f;
+
+        /*
+         * Builds a BVH over the triangles in indices[first_index, first_index + index_count).
+         * Index values refer to the shared vertex array. The geometry is not copied; instead, the
+         * index range is reordered in place so that every leaf references a contiguous run of triangles.
+         * Leaf nodes store offsets into the full index array.
+         *
+         * SBVH leaves reference duplicated triangles, which need up to indexCapacity() indices
+         * starting at first_index. spatial_split_budget limits the duplicates relative to the triangle count.
+         */
+        BVH( const std::vector<AligendVertex>& vertices, 
+             std::vector<uint32_t>& indices, 
+             size_t first_index, 
+             size_t index_count, 
+             BVHSplitMethod split_method = BVHSplitMethod::SAH,
+             float spatial_split_budget = SBVH_DEFAULT_BUDGET );
+
+        static size_t indexCapacity( size_t index_count, BVHSplitMethod split_method, float spatial_split_budget = SBVH_DEFAULT_BUDGET );
+
+        /*
+         * Writes the geometry of all objects once into a contiguous vertex and index arena
+         * and builds one BVH per object over it, processing several objects concurrently.
+         */
+        static std::vector<BVH> buildAll( const std::vector<Object>& objects, 
+                                          std::vector<AligendVertex>& vertices, 
+                                          std::vector<uint32_t>& indices, 
+                                          BVHSplitMethod split_method = BVHSplitMethod::SAH,
+                                          float spatial_split_budget = SBVH_DEFAULT_BUDGET );
+
+        // Same as above, with one split method per object
+        static std::vector<BVH> buildAll( const std::vector<Object>& objects, 
+                                          std::vector<AligendVertex>& vertices, 
+                                          std::vector<uint32_t>& indices, 
+                                          const std::vector<BVHSplitMethod>& split_methods,
+                                          float spatial_split_budget = SBVH_DEFAULT_BUDGET );
+
+        // Reorders the nodes, builds emit DFS
+        void reorderNodes( BVHLayout layout );
 
         size_t getNodesUsed() { return m_nodes_used; }
+        // Number of indices the leaves reference, including duplicated triangles
+        size_t getIndexCount() { return m_index_count; }
+        // Triangle references per triangle, 1 unless spatial splits duplicated triangles
+        float getDuplicationFactor() { return m_triangle_count ? (float)(m_index_count / 3) / m_triangle_count : 1.f; }
         std::vector<BVHNode>& getNodes() { return m_bvh_nodes; }
-        std::vector<AligendVertex>& getVertices() { return m_vertices; }
-        std::vector<uint32_t>& getIndices() { return m_indices; }
 
     private:
+        struct SpatialBuildState;
+
         void build();
+        bool buildSpatial( uint32_t n_threads );
+        // Return true if a node below was made a leaf at MAX_DEPTH
+        bool subdivideSpatial( SpatialBuildState& state, uint32_t node_idx, std::vector<BVHReference>& refs, uint32_t budget, uint32_t depth, uint32_t n_threads );
+        BVHSplitCandidate findObjectSplit( const std::vector<BVHReference>& refs, AABB& left_bounds, AABB& right_bounds ) const;
+        BVHSplitCandidate findSpatialSplit( const std::vector<BVHReference>& refs, const AABB& bounds, uint32_t budget ) const;
+        AABB clipTriangle( uint32_t tri_id, uint32_t axis, float min, float max ) const;
+        void reorderIndices();
+        void sortMorton( uint32_t n_threads );
         void updateNodeBounds( uint32_t node_idx );
-        void subdivide( uint32_t node_idx );
+        void refitNodes();
+        bool subdivide( uint32_t node_idx, uint32_t first_child_idx, uint32_t depth, uint32_t n_threads );
+        uint32_t partition( uint32_t node_idx, float split_pos, uint32_t axis );
+        uint32_t partitionStable( uint32_t node_idx, float split_pos, uint32_t axis );
+        bool isMortonNode( uint32_t tri_count ) const;
+        void compact();
         bool splitEqual(uint32_t node_idx, float& split_pos, uint32_t& axis );
-        bool splitSAH(uint32_t node_idx, float& split_pos, uint32_t& axis );
+        bool splitSAH(uint32_t node_idx, float& split_pos, uint32_t& axis, uint32_t n_threads );
+        bool splitMorton(uint32_t node_idx, uint32_t& left_count );
+
+        // Position of a triangle corner, by triangle id within this BVH's index range
+        const glm::vec3& vertex( uint32_t tri_id, uint32_t corner ) const {
+            return m_vertices[m_indices[m_first_index + 3 * tri_id + corner]].position;
+        }
+
+        // Position of a triangle corner, where slot is the triangle's current place in the build order
+        const glm::vec3& position( uint32_t slot, uint32_t corner ) const {
+            return vertex(m_tri_ids[slot], corner);
+        }
 
         BVHSplitMethod m_split_method;
-        std::vector<AligendVertex> m_vertices;
-        std::vector<uint32_t> m_indices;
+        float m_spatial_split_budget;
+        size_t m_triangle_count { 0 };
+
+        // Shared geometry, only referenced during construction
+        const AligendVertex* m_vertices { nullptr };
+        uint32_t* m_indices { nullptr };
+        size_t m_first_index { 0 };
+        size_t m_index_count { 0 };
 
         std::vector<BVHNode> m_bvh_nodes;
+        std::vector<uint32_t> m_tri_ids;
         std::vector<glm::vec3> m_centroids;
+        std::vector<uint64_t> m_morton_codes;
         size_t m_nodes_used;
 
 };
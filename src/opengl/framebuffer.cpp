@@ -34,6 +34,13 @@ FrameBuffer::addAttachment(Texture& texture, GLenum attachment_point) {
     unbind();
 }
 
+void
+FrameBuffer::setDrawBuffers(const std::vector<GLenum>& attachment_points) {
+    bind();
+    glDrawBuffers((GLsizei)attachment_points.size(), attachment_points.data());
+    unbind();
+}
+
 void
 FrameBuffer::bind() {
     glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
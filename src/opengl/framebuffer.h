@@ -5,6 +5,8 @@
 
 #include "texture.h"
 
+#include <vector>
+
 namespace fart {
 
 struct FrameBuffer {
@@ -18,6 +20,8 @@ struct FrameBuffer {
         ~FrameBuffer();
 
         void addAttachment(Texture& texture, GLenum attachment_point);
+        // Attachment points written by fragment outputs 0, 1, .., only GL_COLOR_ATTACHMENT0 by default
+        void setDrawBuffers(const std::vector<GLenum>& attachment_points);
 
         GLuint& getFrameBuffer() { return m_framebuffer; }
         void bind();
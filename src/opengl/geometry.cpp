@@ -0,0 +1,100 @@
+#include "geometry.h"
+
+#include <cstring>
+#include <unordered_map>
+
+namespace fart {
+
+// A vertex as stored in the streams, equal keys are merged
+struct VertexKey {
+    glm::vec3 position;
+    VertexAttributes attributes;
+
+    bool operator==(const VertexKey& other) const {
+        return std::memcmp(&position, &other.position, sizeof(glm::vec3)) == 0 &&
+               attributes.normal == other.attributes.normal &&
+               attributes.uv == other.attributes.uv;
+    }
+};
+
+struct VertexKeyHash {
+    size_t operator()(const VertexKey& key) const {
+        uint32_t words[5];
+        std::memcpy(words, &key.position, sizeof(glm::vec3));
+        words[3] = key.attributes.normal;
+        words[4] = key.attributes.uv;
+
+        size_t hash = 0xcbf29ce484222325ull;
+        for (uint32_t word : words) {
+            hash ^= word;
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+};
+
+void
+splitVertices(const std::vector<AligendVertex>& vertices,
+              std::vector<uint32_t>& indices,
+              std::vector<glm::vec3>& positions,
+              std::vector<VertexAttributes>& attributes,
+              std::vector<uint32_t>& materials) {
+    materials.resize(indices.size() / 3);
+    for (size_t i = 0; i < materials.size(); i++)
+        materials[i] = vertices[indices[3 * i]].material_id;
+
+    // Vertices keep the order of their first occurrence
+    std::unordered_map<VertexKey, uint32_t, VertexKeyHash> unique;
+    unique.reserve(vertices.size());
+    std::vector<uint32_t> remap(vertices.size());
+    positions.clear();
+    attributes.clear();
+    for (size_t i = 0; i < vertices.size(); i++) {
+        VertexKey key { vertices[i].position, { encodeNormal(vertices[i].normal), encodeUV(vertices[i].uv) } };
+        auto inserted = unique.emplace(key, (uint32_t)positions.size());
+        if (inserted.second) {
+            positions.push_back(key.position);
+            attributes.push_back(key.attributes);
+        }
+        remap[i] = inserted.first->second;
+    }
+
+    for (uint32_t& index : indices)
+        index = remap[index];
+}
+
+void
+reorderVertices(std::vector<uint32_t>& indices,
+                std::vector<glm::vec3>& positions,
+                std::vector<VertexAttributes>& attributes) {
+    constexpr uint32_t UNUSED = ~0u;
+    std::vector<uint32_t> remap(positions.size(), UNUSED);
+    std::vector<glm::vec3> reordered_positions;
+    std::vector<VertexAttributes> reordered_attributes;
+    reordered_positions.reserve(positions.size());
+    reordered_attributes.reserve(attributes.size());
+
+    for (uint32_t& index : indices) {
+        if (remap[index] == UNUSED) {
+            remap[index] = (uint32_t)reordered_positions.size();
+            reordered_positions.push_back(positions[index]);
+            reordered_attributes.push_back(attributes[index]);
+        }
+        index = remap[index];
+    }
+
+    positions = std::move(reordered_positions);
+    attributes = std::move(reordered_attributes);
+}
+
+std::vector<TrianglePositions>
+precomputeTriangles(const std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions) {
+    std::vector<TrianglePositions> triangles(indices.size() / 3);
+    for (size_t i = 0; i < triangles.size(); i++) {
+        const glm::vec3& v0 = positions[indices[3 * i + 0]];
+        triangles[i] = { v0, positions[indices[3 * i + 1]] - v0, positions[indices[3 * i + 2]] - v0 };
+    }
+    return triangles;
+}
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "common/mesh.h"
+#include "common/triangle_layout.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace fart {
+
+/*
+ * Shading attributes of a vertex. They live in their own stream next to the positions,
+ * so that traversal only pulls positions into cache. Normals are octahedral encoded into
+ * two snorm16 and UVs are stored as two halfs, see encodeNormal and encodeUV. Materials
+ * are assigned per triangle, so vertices on material boundaries are shared.
+ *
+ * Reference:
+ * Cigolle et al. 2014, "A Survey of Efficient Representations for Independent Unit Vectors"
+ */
+struct VertexAttributes {
+    uint32_t normal;
+    uint32_t uv;
+};
+
+// What intersectTriangle reads for TriangleLayout::Precomputed
+struct TrianglePositions {
+    glm::vec3 v0;
+    glm::vec3 edge1;
+    glm::vec3 edge2;
+};
+
+inline uint32_t encodeNormal(glm::vec3 n) {
+    glm::vec2 p = glm::vec2(n.x, n.y) / std::max(std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z), 1e-20f);
+    if (n.z < 0.f) {
+        // Fold the lower hemisphere over the diagonals
+        p = glm::vec2((1.f - std::fabs(p.y)) * (p.x >= 0.f ? 1.f : -1.f),
+                      (1.f - std::fabs(p.x)) * (p.y >= 0.f ? 1.f : -1.f));
+    }
+    return glm::packSnorm2x16(p);
+}
+
+inline glm::vec3 decodeNormal(uint32_t encoded) {
+    glm::vec2 p = glm::unpackSnorm2x16(encoded);
+    glm::vec3 n = glm::vec3(p.x, p.y, 1.f - std::fabs(p.x) - std::fabs(p.y));
+    float t = std::max(-n.z, 0.f);
+    n.x += n.x >= 0.f ? -t : t;
+    n.y += n.y >= 0.f ? -t : t;
+    return glm::normalize(n);
+}
+
+inline uint32_t encodeUV(glm::vec2 uv) { return glm::packHalf2x16(uv); }
+inline glm::vec2 decodeUV(uint32_t encoded) { return glm::unpackHalf2x16(encoded); }
+
+/*
+ * Splits the interleaved loader vertices into a position and an attribute stream. Vertices
+ * that only differed by their material id are merged and indices remapped accordingly, the
+ * material of every triangle, by first index / 3, goes to materials.
+ */
+void splitVertices(const std::vector<AligendVertex>& vertices,
+                   std::vector<uint32_t>& indices,
+                   std::vector<glm::vec3>& positions,
+                   std::vector<VertexAttributes>& attributes,
+                   std::vector<uint32_t>& materials);
+
+/*
+ * Renumbers the vertices in the order the indices first reference them and drops unreferenced
+ * ones. The index ranges of the BVH leaves are laid out depth first, so the vertices of a leaf
+ * and of neighbouring leaves end up next to each other instead of in loader order.
+ */
+void reorderVertices(std::vector<uint32_t>& indices,
+                     std::vector<glm::vec3>& positions,
+                     std::vector<VertexAttributes>& attributes);
+
+// One entry per index triple, by first index / 3
+std::vector<TrianglePositions> precomputeTriangles(const std::vector<uint32_t>& indices,
+                                                   const std::vector<glm::vec3>& positions);
+
+}
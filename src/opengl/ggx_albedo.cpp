@@ -0,0 +1,86 @@
+#include "ggx_albedo.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace fart {
+
+// Lowest cos_theta_o in the table, the lobe is undefined at exactly grazing angles
+static constexpr float MIN_COS_THETA = 1e-3f;
+
+// Hammersley point set, the table is the same on every run
+static glm::vec2
+hammersley(uint32_t i, uint32_t n) {
+    uint32_t bits = i;
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return glm::vec2((float)i / (float)n, (float)bits * 2.3283064365386963e-10f);
+}
+
+GGXAlbedoLUT::GGXAlbedoLUT() {
+    m_data.resize(SIZE * SIZE);
+    for (uint32_t y = 0; y < SIZE; y++) {
+        float roughness = (float)y / (SIZE - 1);
+        for (uint32_t x = 0; x < SIZE; x++) {
+            float cos_theta = std::max(MIN_COS_THETA, (float)x / (SIZE - 1));
+            m_data[y * SIZE + x] = integrate(roughness, cos_theta, SAMPLES);
+        }
+    }
+}
+
+glm::vec2
+GGXAlbedoLUT::lookup(float roughness, float cos_theta) const {
+    float x = std::min(std::max(cos_theta, 0.f), 1.f) * (SIZE - 1);
+    float y = std::min(std::max(roughness, 0.f), 1.f) * (SIZE - 1);
+    uint32_t x0 = std::min((uint32_t)x, SIZE - 2);
+    uint32_t y0 = std::min((uint32_t)y, SIZE - 2);
+    float fx = x - x0;
+    float fy = y - y0;
+
+    const glm::vec2* row0 = &m_data[y0 * SIZE];
+    const glm::vec2* row1 = &m_data[(y0 + 1) * SIZE];
+    glm::vec2 top = row0[x0] * (1.f - fx) + row0[x0 + 1] * fx;
+    glm::vec2 bottom = row1[x0] * (1.f - fx) + row1[x0 + 1] * fx;
+    return top * (1.f - fy) + bottom * fy;
+}
+
+/*
+ * Microfacet normals are drawn from D(h) * cos_theta_h like randomGGXMicrofacet, which turns
+ * eval_ggx / pdf into F * G * v.h / (n.v * n.h). The geometric term is the one of ggxGeomtric.
+ */
+glm::vec2
+GGXAlbedoLUT::integrate(float roughness, float cos_theta, uint32_t samples) {
+    const glm::vec3 n = glm::vec3(0.f, 0.f, 1.f);
+    const glm::vec3 v = glm::vec3(std::sqrt(std::max(0.f, 1.f - cos_theta * cos_theta)), 0.f, cos_theta);
+    const float a2 = roughness * roughness;
+    const float k = roughness * roughness / 2.f;
+
+    glm::vec2 sum = glm::vec2(0.f);
+    for (uint32_t i = 0; i < samples; i++) {
+        glm::vec2 rand = hammersley(i, samples);
+        float cos_theta_h = std::sqrt(std::max(0.f, (1.f - rand.x) / ((a2 - 1.f) * rand.x + 1.f)));
+        float sin_theta_h = std::sqrt(std::max(0.f, 1.f - cos_theta_h * cos_theta_h));
+        float phi_h = rand.y * 2.f * 3.14159265358979323846f;
+        glm::vec3 h = glm::vec3(sin_theta_h * std::cos(phi_h), sin_theta_h * std::sin(phi_h), cos_theta_h);
+        glm::vec3 l = glm::reflect(-v, h);
+
+        float ndotl = glm::dot(n, l);
+        float vdoth = glm::dot(v, h);
+        if (ndotl <= 0.f || vdoth <= 0.f) continue;
+
+        float g_i = ndotl / std::max(FLT_MIN, ndotl * (1.f - k) + k);
+        float g_o = cos_theta / std::max(FLT_MIN, cos_theta * (1.f - k) + k);
+        float weight = g_i * g_o * vdoth / std::max(FLT_MIN, cos_theta * cos_theta_h);
+
+        // Schlick's Fresnel with the half vector, split into the parts scaled by f0 and the rest
+        float fc = std::pow(1.f - vdoth, 5.f);
+        sum += weight * glm::vec2(1.f - fc, fc);
+    }
+    return sum / (float)samples;
+}
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace fart {
+
+/*
+ * Directional albedo of the GGX specular lobe, i.e. the energy eval_glossy reflects for a
+ * given roughness and cos_theta_o integrated over all incident directions. The dielectric
+ * base layer is scaled by one minus this value.
+ *
+ * Schlick's Fresnel term is linear in f0, so every entry holds a scale and a bias with
+ * E = f0 * scale + bias, which covers every IOR with a 2D table. Entries sit on a regular
+ * grid including both ends of the roughness and cos_theta_o ranges, lookups interpolate
+ * bilinearly just like a GL_LINEAR fetch at (x * (SIZE - 1) + 0.5) / SIZE.
+ *
+ * References:
+ * Karis 2013, "Real Shading in Unreal Engine 4"
+ * Kulla and Conty 2017, "Revisiting Physically Based Shading at Imageworks"
+ */
+struct GGXAlbedoLUT {
+
+    public:
+        static constexpr uint32_t SIZE = 32;
+        static constexpr uint32_t SAMPLES = 1024;
+
+        // Integrates the table, takes a few milliseconds
+        GGXAlbedoLUT();
+
+        // Scale and bias to f0
+        glm::vec2 lookup(float roughness, float cos_theta) const;
+
+        // Monte Carlo estimate with importance sampled microfacet normals
+        static glm::vec2 integrate(float roughness, float cos_theta, uint32_t samples);
+
+        // SIZE x SIZE entries, cos_theta_o along rows and roughness along columns
+        const glm::vec2* getData() const { return m_data.data(); }
+
+    private:
+        std::vector<glm::vec2> m_data;
+};
+
+}
@@ -15,6 +15,18 @@ vec4 tonemap_ACES(vec4 C) {
     return clamp((C*(a*C + b)) / (C*(c*C + d) + e), 0.0f, 1.0f);
 }
 
+// Rec. 709 luminance of linear RGB
+float luminance(vec3 C) {
+    return dot(C, vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
 vec4 gamma(vec4 C) {
     return pow(C, vec4(0.4545f)); // 1.f / 2.2f = 0.4545f
 }
+
+// False color ramp from blue (0) over green to red (1), white above 1
+vec4 heatmap(float t) {
+    if (t > 1.f) return vec4(1.f);
+    vec3 c = vec3(1.5f) - abs(4.f * vec3(t) - vec3(3.f, 2.f, 1.f));
+    return vec4(clamp(c, 0.f, 1.f), 1.f);
+}
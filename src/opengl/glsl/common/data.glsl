@@ -3,17 +3,42 @@ uniform float u_scene_scale;
 uniform uvec2 u_viewport_size;
 uniform float u_aspect_ratio;
 uniform Camera u_camera;
+uniform uint u_render_mode;
+uniform float u_heatmap_scale;
+// Read triangles from the triangles buffer instead of through the indices, see TriangleLayout
+uniform bool u_precomputed_triangles;
+// Scale and bias to f0 of the GGX directional albedo, see GGXAlbedoLUT
+uniform sampler2D u_ggx_albedo;
 
+// Tightly packed xyz, see getPosition
 layout(std430, binding = 0) buffer geometry0 {
-    Vertex vertices [];
+    float positions [];
 };
 
 layout(std430, binding = 1) buffer geometry1 {
     uint indices [];
 };
 
+layout(std430, binding = 10) buffer geometry2 {
+    VertexAttributes attributes [];
+};
+
+// Material id per index triple, by first_index / 3
+layout(std430, binding = 11) buffer geometry3 {
+    uint triangle_materials [];
+};
+
+// Tightly packed v0, edge1 and edge2 per index triple, see getTriangle
+layout(std430, binding = 12) buffer geometry4 {
+    float triangles [];
+};
+
 layout(std430, binding = 2) buffer accel0 {
+#if BVH_WIDTH > 2
+    WideBVHNode bvh [];
+#else
     BVHNode bvh [];
+#endif
 };
 
 layout(std430, binding = 3) buffer accel1 {
@@ -35,3 +60,24 @@ layout(std430, binding = 6) buffer mat0 {
 layout(std430, binding = 7) buffer tex0 {
     sampler2D textures [];
 };
+
+// See material_flags.h
+#define MATERIAL_ALPHA_TESTED 1u
+#define ALPHA_CUTOFF 0.001f
+
+layout(std430, binding = 9) buffer matflags0 {
+    uint material_flags [];
+};
+
+// Traversal counters summed over all primary rays in heatmap render modes
+layout(std430, binding = 8) buffer stats0 {
+    uint traversal_stats [4];
+};
+
+// Largest relative error per adaptive sampling tile as float bits. Frames alternate between
+// two halves of u_tile_count entries, one is filled while the other holds the previous frame.
+uniform uint u_tile_count;
+
+layout(std430, binding = 13) buffer adaptive0 {
+    uint tile_errors [];
+};
@@ -1,27 +1,64 @@
+// Traversal counters of the current invocation, read by the heatmap render modes
+uint stats_nodes = 0u;
+uint stats_aabb_tests = 0u;
+uint stats_triangle_tests = 0u;
+uint stats_instance_transforms = 0u;
+
+vec3 getPosition(uint vertex) {
+    return vec3(positions[3*vertex+0], positions[3*vertex+1], positions[3*vertex+2]);
+}
+
+// See TrianglePositions in geometry.h
+void getTriangle(uint triangle, out vec3 v0, out vec3 edge1, out vec3 edge2) {
+    uint base = 9u * triangle;
+    v0 = vec3(triangles[base+0u], triangles[base+1u], triangles[base+2u]);
+    edge1 = vec3(triangles[base+3u], triangles[base+4u], triangles[base+5u]);
+    edge2 = vec3(triangles[base+6u], triangles[base+7u], triangles[base+8u]);
+}
+
+// See encodeNormal in geometry.h
+vec3 decodeNormal(uint encoded) {
+    vec2 p = unpackSnorm2x16(encoded);
+    vec3 n = vec3(p, 1.f - abs(p.x) - abs(p.y));
+    float t = max(-n.z, 0.f);
+    n.x += n.x >= 0.f ? -t : t;
+    n.y += n.y >= 0.f ? -t : t;
+    return normalize(n);
+}
+
 vec3 getNormal(uint first_index, vec3 bary) {
-    vec3 n0 = vertices[indices[first_index+0]].normal.xyz;
-    vec3 n1 = vertices[indices[first_index+1]].normal.xyz;
-    vec3 n2 = vertices[indices[first_index+2]].normal.xyz;
+    vec3 n0 = decodeNormal(attributes[indices[first_index+0]].normal);
+    vec3 n1 = decodeNormal(attributes[indices[first_index+1]].normal);
+    vec3 n2 = decodeNormal(attributes[indices[first_index+2]].normal);
 
     return normalize(n0 * bary.x + n1 * bary.y + n2 * bary.z);
 }
 
 vec2 getUV(uint first_index, vec3 bary) {
-    vec2 uv0 = vertices[indices[first_index+0]].uv.xy;
-    vec2 uv1 = vertices[indices[first_index+1]].uv.xy;
-    vec2 uv2 = vertices[indices[first_index+2]].uv.xy;
+    vec2 uv0 = unpackHalf2x16(attributes[indices[first_index+0]].uv);
+    vec2 uv1 = unpackHalf2x16(attributes[indices[first_index+1]].uv);
+    vec2 uv2 = unpackHalf2x16(attributes[indices[first_index+2]].uv);
 
     return uv0 * bary.x + uv1 * bary.y + uv2 * bary.z;
 }
 
-bool intersectTriangle(inout Ray ray, inout SurfaceInteraction si, uint first_index) {
-    uint material_id = vertices[indices[first_index+0]].material_id;
-    vec3 v0 = vertices[indices[first_index+0]].position.xyz;
-    vec3 v1 = vertices[indices[first_index+1]].position.xyz;
-    vec3 v2 = vertices[indices[first_index+2]].position.xyz;
+// Any-hit test of alpha tested materials, false if the hit falls into a cutout
+bool anyHit(uint material_id, uint first_index, vec3 bary) {
+    vec2 uv = getUV(first_index, bary);
+    return texture(textures[materials[material_id].base_color_texid], uv).a >= ALPHA_CUTOFF;
+}
+
+bool intersectTriangle(inout Ray ray, inout Hit hit, uint first_index) {
+    stats_triangle_tests++;
+    vec3 v0, edge1, edge2;
+    if (u_precomputed_triangles) {
+        getTriangle(first_index / 3u, v0, edge1, edge2);
+    } else {
+        v0 = getPosition(indices[first_index+0]);
+        edge1 = getPosition(indices[first_index+1]) - v0;
+        edge2 = getPosition(indices[first_index+2]) - v0;
+    }
 
-    const vec3 edge1 = v1 - v0;
-    const vec3 edge2 = v2 - v0;
     const vec3 h = cross( ray.d, edge2 );
     const float a = dot( edge1, h );
     if (a > -EPS && a < EPS) return false; // ray parallel to triangle
@@ -33,32 +70,24 @@ bool intersectTriangle(inout Ray ray, inout SurfaceInteraction si, uint first_in
     const float v = f * dot( ray.d, q );
     if (v < 0 || u + v > 1) return false;
     const float t = f * dot( edge2, q );
-    if (t > EPS) {
-        // update ray and SurfaceInteraction
-        // TODO: This could be moved to somewhere nicer with less divergence
-        if (t < ray.t) {
-            vec3 bary = vec3(1.f - u - v, u, v);
-            vec2 uv = getUV(first_index, bary);
-            OpenPBRMaterial mat = materials[material_id];
-            vec3 face_normal = normalize(cross(edge1, edge2));
-            vec3 vertex_normal = getNormal(first_index, bary);
-            vertex_normal = vertex_normal * (dot(face_normal, -ray.d) < 0.f ? -1.f : 1.f);
-            face_normal = face_normal * (dot(face_normal, -ray.d) < 0.f ? -1.f : 1.f);
-
-            if (mat.base_color_texid >= 0 && texture(textures[mat.base_color_texid], uv).a < 0.001f) return false;
-            si.uv = uv;
-            si.n = vertex_normal;
-            si.mat = mat;
-            ray.t = min( ray.t, t );
-
-            si.valid = true;
-            return true;
+    if (t > EPS && t < ray.t) {
+        // Opaque materials never touch their textures here
+        uint material_id = triangle_materials[first_index / 3u];
+        if ((material_flags[material_id] & MATERIAL_ALPHA_TESTED) != 0u) {
+            if (!anyHit(material_id, first_index, vec3(1.f - u - v, u, v))) return false;
         }
+
+        ray.t = t;
+        hit.first_index = first_index;
+        hit.bary = vec2(u, v);
+        hit.valid = true;
+        return true;
     }
     return false;
 }
 
 float intersectAABB(Ray ray, vec3 bmin, vec3 bmax) {
+    stats_aabb_tests++;
     float tx1 = (bmin.x - ray.o.x) * ray.rD.x, tx2 = (bmax.x - ray.o.x) * ray.rD.x;
     float tmin = min( tx1, tx2 ), tmax = max( tx1, tx2 );
     float ty1 = (bmin.y - ray.o.y) * ray.rD.y, ty2 = (bmax.y - ray.o.y) * ray.rD.y;
@@ -70,18 +99,76 @@ float intersectAABB(Ray ray, vec3 bmin, vec3 bmax) {
     return 1e30f; 
 }
 
-void intersectBLAS(inout Ray ray, inout SurfaceInteraction si, uint bvh_offset) {
+#if BVH_WIDTH > 2
+uint boundsByte(WideBVHNode node, uint i) {
+    return (node.bounds[i >> 2] >> ((i & 3u) << 3)) & 0xffu;
+}
+
+void intersectBLAS(inout Ray ray, inout Hit hit, uint bvh_offset) {
+    uint stack[BVH_MAX_STACK];
+    int current = 0;
+    stack[current] = bvh_offset;
+
+    do {
+        WideBVHNode node = bvh[stack[current--]];
+        stats_nodes++;
+        vec3 scale = vec3(uintBitsToFloat((node.exponents & 0xffu) << 23),
+                          uintBitsToFloat(((node.exponents >> 8) & 0xffu) << 23),
+                          uintBitsToFloat(((node.exponents >> 16) & 0xffu) << 23));
+
+        // Leaf children are intersected right away, inner children are pushed far to near
+        uint inner[BVH_WIDTH];
+        float inner_dist[BVH_WIDTH];
+        int n_inner = 0;
+        for (uint i = 0; i < BVH_WIDTH; i++) {
+            uint child = node.children[i];
+            if (child == 0) continue;
+
+            vec3 lo = vec3(boundsByte(node, i), boundsByte(node, BVH_WIDTH + i), boundsByte(node, 2 * BVH_WIDTH + i));
+            vec3 hi = vec3(boundsByte(node, 3 * BVH_WIDTH + i), boundsByte(node, 4 * BVH_WIDTH + i), boundsByte(node, 5 * BVH_WIDTH + i));
+            float dist = intersectAABB(ray, node.origin + lo * scale, node.origin + hi * scale);
+            if (dist >= 1e30f) continue;
+
+            if ((child & BVH_LEAF_FLAG) != 0) {
+                uint first_tri = child & 0x3ffffffu;
+                uint tri_count = (child >> 26) & 0x1fu;
+                for (uint t = 0; t < tri_count; t++) {
+                    intersectTriangle(ray, hit, 3 * (first_tri + t));
+                }
+            } else {
+                int j = n_inner++;
+                while (j > 0 && inner_dist[j - 1] < dist) {
+                    inner[j] = inner[j - 1];
+                    inner_dist[j] = inner_dist[j - 1];
+                    j--;
+                }
+                inner[j] = bvh_offset + child;
+                inner_dist[j] = dist;
+            }
+        }
+
+        for (int i = 0; i < n_inner; i++) {
+            stack[++current] = inner[i];
+        }
+
+    } while (current >= 0);
+
+}
+#else
+void intersectBLAS(inout Ray ray, inout Hit hit, uint bvh_offset) {
+    // Holds BVH::MAX_DEPTH + 1 nodes, deeper BVHs are clamped at build time
     uint stack[32];
     int current = 0;
     stack[current] = bvh_offset;
 
     do {
         BVHNode node = bvh[stack[current--]];
+        stats_nodes++;
 
         if (node.left_child <= 0) {
             // intersect triangles in the node
             for (int i = 0; i < node.tri_count; i++) {
-                intersectTriangle(ray, si, node.first_tri_index_id + (3*i));
+                intersectTriangle(ray, hit, node.first_tri_index_id + (3*i));
             }
         } else {
             float left_dist = intersectAABB(ray, bvh[bvh_offset + node.left_child].aabb_min.xyz, bvh[bvh_offset + node.left_child].aabb_max.xyz);
@@ -99,10 +186,39 @@ void intersectBLAS(inout Ray ray, inout SurfaceInteraction si, uint bvh_offset)
     } while(current >= 0 && current < 32);
 
 }
+#endif
 
-SurfaceInteraction intersect(Ray ray) {
+// Interpolates the attributes of the closest hit, ray is the world space ray that found it
+SurfaceInteraction resolveHit(Ray ray, Hit hit) {
     SurfaceInteraction si;
     si.valid = false;
+    si.p = ray.o + ray.d * ray.t;
+    if (!hit.valid) return si;
+
+    uint first_index = hit.first_index;
+    vec3 v0 = getPosition(indices[first_index+0]);
+    vec3 v1 = getPosition(indices[first_index+1]);
+    vec3 v2 = getPosition(indices[first_index+2]);
+    vec3 bary = vec3(1.f - hit.bary.x - hit.bary.y, hit.bary.x, hit.bary.y);
+
+    // Normals face the ray in object space before they are transformed to world
+    mat4 xfm = instances[hit.instance].world_to_instance;
+    vec3 d = vec3(xfm * vec4(ray.d, 0));
+    vec3 face_normal = normalize(cross(v1 - v0, v2 - v0));
+    vec3 vertex_normal = getNormal(first_index, bary);
+    vertex_normal = vertex_normal * (dot(face_normal, -d) < 0.f ? -1.f : 1.f);
+
+    si.uv = getUV(first_index, bary);
+    si.n = normalize((inverse(xfm) * vec4(vertex_normal, 0.f)).xyz);
+    si.w_o = -ray.d;
+    si.mat = materials[triangle_materials[first_index / 3u]];
+    si.valid = true;
+    return si;
+}
+
+SurfaceInteraction intersect(Ray ray) {
+    Hit hit;
+    hit.valid = false;
 
     uint stack[32];
     int current = 0;
@@ -110,22 +226,19 @@ SurfaceInteraction intersect(Ray ray) {
 
     do {
         TLASNode node = tlas[stack[current--]];
+        stats_nodes++;
         if (node.left_child <= 0) {
             for (int i = 0; i < node.instance_count; i++) {
                 uint instance = node.first_instance_id + i;
+                stats_instance_transforms++;
                 Ray ray_backup = ray;
                 mat4 xfm = instances[instance].world_to_instance;
                 ray.o = vec3(xfm * vec4(ray.o, 1));
                 ray.d = vec3(xfm * vec4(ray.d, 0));
                 ray.rD = 1.f / ray.d;
 
-                intersectBLAS(ray, si, blas_offsets[instances[instance].object_id]);
-                if (ray.t < ray_backup.t) {
-                    si.w_o = -ray_backup.d;
-
-                    // transform object-space normal to world
-                    si.n = normalize((inverse(xfm) * vec4(si.n, 0.f)).xyz);
-                }
+                intersectBLAS(ray, hit, blas_offsets[instances[instance].object_id]);
+                if (ray.t < ray_backup.t) hit.instance = instance;
                 ray_backup.t = ray.t;
                 ray = ray_backup;
             }
@@ -143,6 +256,5 @@ SurfaceInteraction intersect(Ray ray) {
         }
     } while (current >= 0 && current < 32);
 
-    si.p = ray.o + ray.d * ray.t;
-    return si;
+    return resolveHit(ray, hit);
 }
@@ -128,18 +128,18 @@ vec3 eval_diffuse(const SurfaceInteraction  si,
     return f;
 }
 
-/* Estimator for GGX Microfacet reflectanace */
+/* 
+ * GGX Microfacet reflectance from the precomputed directional albedo, see GGXAlbedoLUT.
+ * The geometric term gains energy at grazing angles, so the result is clamped to one.
+ */
 vec3 ggx_reflectance(const SurfaceInteraction   si, 
-                     vec3                       w_o, 
-                     inout RNG                  rng) {
-    vec3 reflectance = vec3(0.f);
-    vec3 w_i;
-    const uint samples = 8;
-    for (uint i = 0; i < samples; i++) {
-        w_i = randomHemispherePoint(next_random2f(rng), si.n);
-        reflectance += eval_glossy(si, w_i, w_o);
-    }
-    return reflectance / samples;
+                     vec3                       w_o) {
+    float f0 = pow((1.f - si.mat.specular_ior) / (1.f + si.mat.specular_ior), 2.f);
+    float size = float(textureSize(u_ggx_albedo, 0).x);
+    vec2 coords = vec2(clamp(dot(si.n, w_o), 0.f, 1.f), clamp(si.mat.specular_roughness, 0.f, 1.f));
+    vec2 albedo = textureLod(u_ggx_albedo, (coords * (size - 1.f) + 0.5f) / size, 0.f).rg;
+    vec3 E = si.mat.specular_weight * si.mat.specular_color * (f0 * albedo.x + albedo.y);
+    return min(E, vec3(1.f));
 }
 
 /*
@@ -176,10 +176,9 @@ vec3 bsdf_sample(const SurfaceInteraction   si,
 
 vec3 bsdf_eval(const SurfaceInteraction     si, 
                vec3                         w_i, 
-               vec3                         w_o, 
-               inout RNG                    rng)
+               vec3                         w_o)
 {
-    vec3 E_specular = ggx_reflectance(si, w_o, rng);
+    vec3 E_specular = ggx_reflectance(si, w_o);
     vec3 diffuse = eval_diffuse(si, w_i, w_o);
     vec3 glossy = eval_glossy(si, w_i, w_o);
     vec3 metal = eval_metal(si, w_i, w_o);
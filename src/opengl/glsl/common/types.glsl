@@ -1,8 +1,7 @@
-struct Vertex {
-    vec3 position;
-    vec3 normal;
-    vec2 uv;
-    uint material_id;
+// See VertexAttributes in geometry.h
+struct VertexAttributes {
+    uint normal;
+    uint uv;
 };
 
 struct Camera {
@@ -39,6 +38,15 @@ struct OpenPBRMaterial {
     int   geometry_opacity_texid;
 };
 
+// What traversal records for the closest hit so far, resolved into a SurfaceInteraction once at the end
+struct Hit {
+    uint first_index;
+    uint instance;
+    // Barycentrics of the second and third vertex
+    vec2 bary;
+    bool valid;
+};
+
 struct SurfaceInteraction {
     vec3 p;
     vec3 n;
@@ -58,6 +66,25 @@ struct BVHNode {
     uint filler; // TODO: Figure out a better way to deal with alignments
 };
 
+// Branching factor of the BLAS, set through -DBVH_WIDTH when preprocessing
+#ifndef BVH_WIDTH
+#define BVH_WIDTH 2
+#endif
+
+#if BVH_WIDTH > 2
+#define BVH_LEAF_FLAG 0x80000000u
+// WideBVH::MAX_STACK, wide BLAS never need more traversal stack entries
+#define BVH_MAX_STACK 64
+
+// See WideBVHNode in wide_bvh.h, bounds hold one byte per child and axis
+struct WideBVHNode {
+    vec3 origin;
+    uint exponents;
+    uint bounds[BVH_WIDTH * 6 / 4];
+    uint children[BVH_WIDTH];
+};
+#endif
+
 struct TLASNode {
     vec4 aabb_min;
     vec4 aabb_max;
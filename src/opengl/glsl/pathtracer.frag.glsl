@@ -4,6 +4,8 @@
 
 #define MIN_RR_DEPTH 3
 #define MAX_BOUNCES 5
+// Dark pixels are measured against this luminance, so their noise is not amplified without bound
+#define ADAPTIVE_MIN_LUMINANCE 0.01f
 
 #include "common/color.glsl"
 #include "common/types.glsl"
@@ -14,7 +16,15 @@
 #include "common/intersect.glsl"
 
 uniform sampler2D u_frag_color_accum;
-out vec4 frag_color;
+// Mean of the squared sample luminance and sample count per pixel
+uniform sampler2D u_frag_moments_accum;
+// Target relative error of adaptive sampling, 0 if disabled, see Renderer::setAdaptiveSampling
+uniform float u_adaptive_error;
+uniform uint u_adaptive_min_samples;
+uniform uint u_adaptive_tile_size;
+
+layout(location = 0) out vec4 frag_color;
+layout(location = 1) out vec4 frag_moments;
 
 vec4 miss(Ray ray) {
     vec4 sky = vec4(70./255., 169./255., 235./255., 1.f);
@@ -34,7 +44,7 @@ vec4 closestHit(SurfaceInteraction si, inout RNG rng) {
     for (int i = 0; i < MAX_BOUNCES; i++) {
         si.w_i = bsdf_sample(si, f_pdf, rng);
         if (f_pdf <= 0.f) break;
-        f = bsdf_eval(si, si.w_i, si.w_o, rng);
+        f = bsdf_eval(si, si.w_i, si.w_o);
         throughput = f * throughput / f_pdf;
 
         Ray ray;
@@ -78,15 +88,56 @@ Ray spawnRay(vec2 d) {
     return ray;
 }
 
+// Standard error of the mean luminance relative to the mean, infinite until there are enough samples
+float relativeError(vec4 mean, vec4 moments) {
+    float n = moments.y;
+    if (n < float(u_adaptive_min_samples)) return uintBitsToFloat(0x7f800000u);
+
+    float y = luminance(mean.rgb);
+    float variance = max(moments.x - y * y, 0.f) * n / (n - 1.f);
+    return sqrt(variance / n) / max(y, ADAPTIVE_MIN_LUMINANCE);
+}
+
 void main() {
     uint pixel_id = uint(gl_FragCoord.y * u_viewport_size.x + gl_FragCoord.x);
     RNG rng = make_random(pixel_id, u_frame_no);
 
     vec4 L = vec4(0.f);
     vec2 uv = vec2(gl_FragCoord.xy) / u_viewport_size;
+    vec4 accum = texture(u_frag_color_accum, uv);
+    vec4 moments = texture(u_frag_moments_accum, uv);
+    float n = moments.y;
+
+    uvec2 tile = uvec2(gl_FragCoord.xy) / u_adaptive_tile_size;
+    uint tile_id = tile.y * ((u_viewport_size.x + u_adaptive_tile_size - 1u) / u_adaptive_tile_size) + tile.x;
+    uint write_offset = (u_frame_no & 1u) * u_tile_count;
+    uint read_offset = u_tile_count - write_offset;
+
+    // Converged tiles keep their accumulation, their error is carried over to the next frame
+    bool adaptive = u_adaptive_error > 0.f && u_render_mode == 0u;
+    if (adaptive && n >= float(u_adaptive_min_samples) && uintBitsToFloat(tile_errors[read_offset + tile_id]) <= u_adaptive_error) {
+        frag_color = accum;
+        frag_moments = moments;
+        atomicMax(tile_errors[write_offset + tile_id], floatBitsToUint(relativeError(accum, moments)));
+        return;
+    }
+
     vec2 d = uv + (next_random2f(rng) / u_viewport_size);
     Ray ray = spawnRay(d);
 
+    // Heatmap render modes, see RenderMode
+    if (u_render_mode != 0u) {
+        intersect(ray);
+        uint counters[4] = uint[4](stats_nodes, stats_aabb_tests, stats_triangle_tests, stats_instance_transforms);
+        for (int i = 0; i < 4; i++)
+            atomicAdd(traversal_stats[i], counters[i]);
+
+        L = heatmap(float(counters[u_render_mode - 1u]) / u_heatmap_scale);
+        frag_color = (n * accum + L) / (n + 1.f);
+        frag_moments = vec4(0.f, n + 1.f, 0.f, 0.f);
+        return;
+    }
+
     SurfaceInteraction si = intersect(ray);
     if (si.valid)
         L = closestHit(si, rng);
@@ -94,5 +145,9 @@ void main() {
         L = miss(ray);
 
     L = clamp(L, 0.f, 10.f);
-    frag_color = (u_frame_no * texture(u_frag_color_accum, uv) + L) / (u_frame_no + 1.f);
+    float y = luminance(L.rgb);
+    frag_color = (n * accum + L) / (n + 1.f);
+    frag_moments = vec4((n * moments.x + y * y) / (n + 1.f), n + 1.f, 0.f, 0.f);
+    if (adaptive)
+        atomicMax(tile_errors[write_offset + tile_id], floatBitsToUint(relativeError(frag_color, frag_moments)));
 }
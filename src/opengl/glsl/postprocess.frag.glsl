@@ -4,11 +4,13 @@
 #include "common/color.glsl"
 
 uniform sampler2D u_frag_color_accum;
+uniform bool u_tonemap;
 in vec2 o_uv;
 
 out vec4 frag_color;
 
 void main() {
     vec4 c = texture(u_frag_color_accum, o_uv);
-    frag_color = gamma(tonemap_ACES(c));
+    // Heatmaps are shown as they are
+    frag_color = u_tonemap ? gamma(tonemap_ACES(c)) : c;
 }
@@ -0,0 +1,63 @@
+#include "gpu_timer.h"
+
+#include <cstring>
+
+namespace fart {
+
+GpuTimer::GpuTimer() {
+    for (Frame& frame : m_frames) {
+        glGenQueries(frame.queries.size(), frame.queries.data());
+        frame.passes.reserve(MAX_PASSES);
+    }
+}
+
+GpuTimer::~GpuTimer() {
+    for (Frame& frame : m_frames) {
+        glDeleteQueries(frame.queries.size(), frame.queries.data());
+    }
+}
+
+void
+GpuTimer::begin(const char* name) {
+    Frame& frame = m_frames[m_frame % FRAMES_IN_FLIGHT];
+    if (m_in_pass || frame.passes.size() == MAX_PASSES) {
+        ERR("GpuTimer passes must not nest and are limited to " + std::to_string(MAX_PASSES) + " per frame");
+        return;
+    }
+
+    glQueryCounter(frame.queries[2 * frame.passes.size()], GL_TIMESTAMP);
+    frame.passes.push_back({ name, Profiler::get().now() });
+    m_in_pass = true;
+}
+
+void
+GpuTimer::end() {
+    if (!m_in_pass) return;
+
+    Frame& frame = m_frames[m_frame % FRAMES_IN_FLIGHT];
+    glQueryCounter(frame.queries[2 * frame.passes.size() - 1], GL_TIMESTAMP);
+    m_in_pass = false;
+}
+
+void
+GpuTimer::endFrame(std::vector<PassStats>& passes) {
+    m_frame += 1;
+
+    // The oldest frame is the next one to be recorded
+    Frame& frame = m_frames[m_frame % FRAMES_IN_FLIGHT];
+    Profiler& profiler = Profiler::get();
+    for (size_t i = 0; i < frame.passes.size(); i++) {
+        GLuint64 start_ns, end_ns;
+        glGetQueryObjectui64v(frame.queries[2 * i], GL_QUERY_RESULT, &start_ns);
+        glGetQueryObjectui64v(frame.queries[2 * i + 1], GL_QUERY_RESULT, &end_ns);
+        uint64_t duration_us = (end_ns - start_ns) / 1000;
+
+        if (profiler.isRecording()) profiler.addGpuZone(frame.passes[i].name, frame.passes[i].cpu_start_us, duration_us);
+        for (PassStats& pass : passes) {
+            if (std::strcmp(pass.name, frame.passes[i].name) == 0) pass.gpu_ms = (end_ns - start_ns) * 1e-6f;
+        }
+    }
+    frame.passes.clear();
+}
+
+}
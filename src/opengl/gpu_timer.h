@@ -0,0 +1,72 @@
+#pragma once
+
+#include "gldefs.h"
+#include "common/defs.h"
+#include "common/profiler.h"
+
+#include <array>
+#include <vector>
+
+namespace fart {
+
+/*
+ * Measures the GPU time of render passes with GL_TIMESTAMP queries. A frame's
+ * queries are only read FRAMES_IN_FLIGHT frames later so that reading them never
+ * stalls the pipeline, hence GPU timings lag behind the CPU timings of a frame.
+ */
+struct GpuTimer {
+
+    public:
+        static constexpr uint32_t FRAMES_IN_FLIGHT = 3;
+        static constexpr uint32_t MAX_PASSES = 8;
+
+        GpuTimer();
+        GpuTimer(GpuTimer& other) = delete;
+        GpuTimer& operator=(GpuTimer& other) = delete;
+        ~GpuTimer();
+
+        // Passes may not nest, name has to be a string literal
+        void begin(const char* name);
+        void end();
+
+        // Call after the last pass of a frame. Resolves the oldest frame in flight, adds
+        // its passes to the trace and sets gpu_ms of the passes with the same name
+        void endFrame(std::vector<PassStats>& passes);
+
+    private:
+        struct Pass {
+            const char* name;
+            uint64_t cpu_start_us;
+        };
+
+        struct Frame {
+            std::array<GLuint, 2 * MAX_PASSES> queries;
+            std::vector<Pass> passes;
+        };
+
+        std::array<Frame, FRAMES_IN_FLIGHT> m_frames;
+        uint32_t m_frame { 0 };
+        bool m_in_pass { false };
+};
+
+// Ends the pass when leaving the scope
+struct GpuZone {
+
+    public:
+        GpuZone(GpuTimer& timer, const char* name) : m_timer(timer) { m_timer.begin(name); }
+        ~GpuZone() { m_timer.end(); }
+
+        GpuZone(const GpuZone&) = delete;
+        GpuZone& operator=(const GpuZone&) = delete;
+
+    private:
+        GpuTimer& m_timer;
+};
+
+}
+
+#if FART_PROFILER
+#define FART_PROFILE_GPU_PASS(timer, name) fart::GpuZone FART_PROFILE_CONCAT(fart_gpu_zone_, __LINE__)(*(timer), name)
+#else
+#define FART_PROFILE_GPU_PASS(timer, name)
+#endif
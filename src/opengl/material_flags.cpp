@@ -0,0 +1,48 @@
+#include "material_flags.h"
+
+#include "common/job_system.h"
+
+namespace fart {
+
+static bool
+hasCutout(Image& image) {
+    size_t texels = (size_t)image.getWidth() * image.getHeight();
+    if (image.getChannels() != 4 || !image.getData()) return false;
+
+    if (image.isHDR()) {
+        const float* data = reinterpret_cast<const float*>(image.getData());
+        for (size_t i = 0; i < texels; i++)
+            if (data[4 * i + 3] < ALPHA_CUTOFF) return true;
+    } else {
+        const uint8_t* data = image.getData();
+        for (size_t i = 0; i < texels; i++)
+            if (data[4 * i + 3] / 255.f < ALPHA_CUTOFF) return true;
+    }
+    return false;
+}
+
+std::vector<uint32_t>
+computeMaterialFlags(const OpenPBRMaterial* materials, size_t material_count, std::vector<Image>& textures) {
+    // Textures are often shared between materials, so each is scanned at most once
+    std::vector<uint8_t> used(textures.size(), 0);
+    for (size_t i = 0; i < material_count; i++) {
+        int texid = materials[i].base_color_texid;
+        if (texid >= 0 && (size_t)texid < textures.size()) used[texid] = 1;
+    }
+
+    std::vector<uint8_t> cutout(textures.size(), 0);
+    parallelFor(0, textures.size(), 1, [&](size_t first, size_t last) {
+        for (size_t t = first; t < last; t++)
+            if (used[t]) cutout[t] = hasCutout(textures[t]) ? 1 : 0;
+    });
+
+    std::vector<uint32_t> flags(material_count, 0u);
+    for (size_t i = 0; i < material_count; i++) {
+        int texid = materials[i].base_color_texid;
+        if (texid < 0 || (size_t)texid >= textures.size()) continue;
+        if (cutout[texid]) flags[i] |= MATERIAL_ALPHA_TESTED;
+    }
+    return flags;
+}
+
+}
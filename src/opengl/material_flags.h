@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <stage.h>
+
+using namespace stage;
+
+namespace fart {
+
+// Set for materials whose base color alpha cuts out geometry. Only these run the any-hit
+// test during traversal, all other triangles are accepted without touching a texture.
+constexpr uint32_t MATERIAL_ALPHA_TESTED = 1u;
+
+// Texels with an alpha below the cutoff are treated as holes
+constexpr float ALPHA_CUTOFF = 0.001f;
+
+// One flag word per material, textures are scanned once for texels below ALPHA_CUTOFF
+std::vector<uint32_t> computeMaterialFlags(const OpenPBRMaterial* materials,
+                                           size_t material_count,
+                                           std::vector<Image>& textures);
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "common/bvh_layout.h"
+
+namespace fart {
+
+// Treelets are sized to a few cache lines, so the first levels below a node arrive together
+constexpr size_t TREELET_BYTES = 1024;
+
+/*
+ * Reorders the nodes of a BVH whose children are stored as adjacent pairs at left_child
+ * (left_child == 0 marks a leaf) and remaps left_child. The root stays at index 0 and
+ * children are always placed after their parents, which reverse sweep refits rely on.
+ * Builds already emit their pairs in depth-first order, so DFS leaves the nodes as they are.
+ *
+ * References:
+ * Yoon and Manocha 2006, "Cache-Efficient Layouts of Bounding Volume Hierarchies"
+ * Aila and Karras 2010, "Architecture Considerations for Tracing Incoherent Rays"
+ */
+template <typename Node>
+void
+reorderNodes(std::vector<Node>& nodes, size_t nodes_used, BVHLayout layout) {
+    if (nodes_used <= 1 || layout == BVHLayout::DFS) return;
+
+    const size_t pairs_per_treelet = std::max<size_t>(1, TREELET_BYTES / (2 * sizeof(Node)));
+
+    // Index of the left child of every pair, in the new order
+    std::vector<uint32_t> order;
+    order.reserve(nodes_used / 2);
+
+    std::vector<uint32_t> pending { nodes[0].left_child };
+    std::vector<uint32_t> treelet, frontier;
+    while (!pending.empty()) {
+        uint32_t pair = pending.back();
+        pending.pop_back();
+
+        treelet = { pair };
+        frontier.clear();
+        size_t treelet_size = layout == BVHLayout::Treelet ? pairs_per_treelet : 1;
+        for (size_t i = 0; i < treelet.size(); i++) {
+            for (uint32_t child = treelet[i]; child < treelet[i] + 2; child++) {
+                if (nodes[child].left_child == 0) continue;
+                if (treelet.size() < treelet_size) {
+                    treelet.push_back(nodes[child].left_child);
+                } else {
+                    frontier.push_back(nodes[child].left_child);
+                }
+            }
+        }
+
+        order.insert(order.end(), treelet.begin(), treelet.end());
+        pending.insert(pending.end(), frontier.rbegin(), frontier.rend());
+    }
+
+    std::vector<uint32_t> remap(nodes_used, 0);
+    for (size_t i = 0; i < order.size(); i++)
+        remap[order[i]] = 1 + 2 * i;
+
+    std::vector<Node> reordered(nodes_used);
+    reordered[0] = nodes[0];
+    for (size_t i = 0; i < order.size(); i++) {
+        reordered[1 + 2 * i] = nodes[order[i]];
+        reordered[2 + 2 * i] = nodes[order[i] + 1];
+    }
+    for (auto& node : reordered) {
+        if (node.left_child != 0)
+            node.left_child = remap[node.left_child];
+    }
+
+    std::copy(reordered.begin(), reordered.end(), nodes.begin());
+}
+
+}
@@ -1,9 +1,14 @@
 #include "gldefs.h"
 #include "renderer.h"
+#include "ggx_albedo.h"
+#include "material_flags.h"
+#include <array>
 #include <memory>
 #include <algorithm>
 #include <numeric>
 #include <chrono>
+#include <cstring>
+#include <vector>
 
 namespace fart {
 
@@ -12,61 +17,24 @@ OpenGlRenderer::init(std::shared_ptr<Scene> &scene, std::shared_ptr<Window> &win
     m_scene = scene;
     m_window = window;
 
-    initGl();
-    initAccelerationStructures();
-    initFrameBuffer();
-    initTextures();
-    initBuffers();
-    initShaders();
-    initBindings();
+    { FART_PROFILE_ZONE("initGl"); initGl(); }
+    { FART_PROFILE_ZONE("initAccelerationStructures"); initAccelerationStructures(); }
+    { FART_PROFILE_ZONE("initFrameBuffer"); initFrameBuffer(); }
+    { FART_PROFILE_ZONE("initTextures"); initTextures(); }
+    { FART_PROFILE_ZONE("initGGXAlbedo"); initGGXAlbedo(); }
+    { FART_PROFILE_ZONE("initBuffers"); initBuffers(); }
+    { FART_PROFILE_ZONE("initShaders"); initShaders(); }
+    { FART_PROFILE_ZONE("initBindings"); initBindings(); }
+
+#if FART_PROFILER
+    m_gpu_timer = std::make_unique<GpuTimer>();
+#endif
 }
 
 void
 OpenGlRenderer::initAccelerationStructures() {
-
-    // Build BLAS BVHs
-    std::vector<BVH> bvhs;
-    for (const auto& object : m_scene->getObjects()) {
-        BVH bvh(object.geometries);
-        bvhs.push_back(bvh);
-    }
-
-
-    // Store BVH information locally
-    size_t bvhnodes_size = std::accumulate(bvhs.begin(), bvhs.end(), 0, [](size_t acc, BVH& bvh) { return acc + bvh.getNodesUsed(); });
-    size_t vertices_size = std::accumulate(bvhs.begin(), bvhs.end(), 0, [](size_t acc, BVH& bvh) { return acc + bvh.getVertices().size(); });
-    size_t indices_size = std::accumulate(bvhs.begin(), bvhs.end(), 0, [](size_t acc, BVH& bvh) { return acc + bvh.getIndices().size(); });
-    size_t index_offset = 0;
-    size_t index_id_offset = 0;
-    m_blas_list.reserve(bvhnodes_size);
-    m_vertices_contiguous.reserve(vertices_size);
-    m_indices_contiguous.reserve(indices_size);
-    for (auto& bvh : bvhs) {
-        // Insert vertices and indices that were held by this BVH
-        m_vertices_contiguous.insert(m_vertices_contiguous.end(), bvh.getVertices().begin(), bvh.getVertices().end());
-        m_indices_contiguous.insert(m_indices_contiguous.end(), bvh.getIndices().begin(), bvh.getIndices().end());
-
-        // Offset index numbers by the current number of contiguous indices
-        std::transform(m_indices_contiguous.end() - bvh.getIndices().size(), 
-                       m_indices_contiguous.end(), 
-                       m_indices_contiguous.end() - bvh.getIndices().size(), 
-            [&](uint32_t index) {
-                return index + index_offset;
-        });
-
-        // Offset index ids by the current number of contiguous index ids
-        std::vector<BVHNode>& nodes = bvh.getNodes();
-        for (auto& node : nodes){
-            if (node.left_child == 0)
-                node.first_tri_index_id += index_id_offset;
-        }
-        m_blas_list.insert(m_blas_list.end(), nodes.begin(), nodes.begin() + bvh.getNodesUsed());
-        index_offset += bvh.getVertices().size();
-        index_id_offset += bvh.getIndices().size();
-    }
-
-    // Build TLAS
-    m_tlas = std::make_unique<TLAS>(m_scene->getInstances(), bvhs);
+    // Loads the flattened scene and its BVHs from disk, or builds and caches them
+    m_scene_cache = std::make_unique<SceneCache>(*m_scene, m_triangle_layout, m_split_method, m_node_layout, m_scene_cache_directory);
 }
 
 void
@@ -75,9 +43,15 @@ OpenGlRenderer::initFrameBuffer() {
     m_framebuffer1 = std::make_unique<FrameBuffer>();
     m_accum_texture0 = std::make_unique<Texture>(m_window->getWidth(), m_window->getHeight());
     m_accum_texture1 = std::make_unique<Texture>(m_window->getWidth(), m_window->getHeight());
+    m_moments_texture0 = std::make_unique<Texture>(m_window->getWidth(), m_window->getHeight());
+    m_moments_texture1 = std::make_unique<Texture>(m_window->getWidth(), m_window->getHeight());
 
     m_framebuffer0->addAttachment(*m_accum_texture0, GL_COLOR_ATTACHMENT0);
+    m_framebuffer0->addAttachment(*m_moments_texture0, GL_COLOR_ATTACHMENT1);
     m_framebuffer1->addAttachment(*m_accum_texture1, GL_COLOR_ATTACHMENT0);
+    m_framebuffer1->addAttachment(*m_moments_texture1, GL_COLOR_ATTACHMENT1);
+    m_framebuffer0->setDrawBuffers({ GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 });
+    m_framebuffer1->setDrawBuffers({ GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 });
 
     if (!m_framebuffer0->isComplete()) {
         ERR("Framebuffer 0 was not built correctly.");
@@ -90,7 +64,7 @@ OpenGlRenderer::initFrameBuffer() {
 void
 OpenGlRenderer::initBuffers() {
     m_quad = std::make_unique<Buffer>(GL_ARRAY_BUFFER);
-    m_vertices = std::make_unique<StorageBuffer>(0);
+    m_positions = std::make_unique<StorageBuffer>(0);
     m_indices = std::make_unique<StorageBuffer>(1);
     m_blas_buffer = std::make_unique<StorageBuffer>(2);
     m_tlas_buffer = std::make_unique<StorageBuffer>(3);
@@ -98,14 +72,31 @@ OpenGlRenderer::initBuffers() {
     m_instance_buffer = std::make_unique<StorageBuffer>(5);
     m_materials = std::make_unique<StorageBuffer>(6);
     m_textures_buffer = std::make_unique<StorageBuffer>(7);
-
-    m_vertices->setData(m_vertices_contiguous);
-    m_indices->setData(m_indices_contiguous);
-    m_blas_buffer->setData(m_blas_list);
-    m_tlas_buffer->setData(m_tlas->getNodes().data(), m_tlas->getNodesUsed());
-    m_blas_offset_buffer->setData(m_tlas->getBLASOffsets());
-    m_instance_buffer->setData(m_tlas->getInstances());
-    m_materials->setData(m_scene->getMaterials());
+    m_traversal_stats = std::make_unique<StorageBuffer>(8);
+    m_material_flags = std::make_unique<StorageBuffer>(9);
+    m_attributes = std::make_unique<StorageBuffer>(10);
+    m_triangle_materials = std::make_unique<StorageBuffer>(11);
+    m_triangles = std::make_unique<StorageBuffer>(12);
+    m_tile_errors = std::make_unique<StorageBuffer>(13);
+
+    m_positions->setData(m_scene_cache->getPositions(), m_scene_cache->getVertexCount());
+    m_attributes->setData(m_scene_cache->getAttributes(), m_scene_cache->getVertexCount());
+    m_indices->setData(m_scene_cache->getIndices(), m_scene_cache->getIndexCount());
+    m_triangle_materials->setData(m_scene_cache->getTriangleMaterials(), m_scene_cache->getTriangleCount());
+    if (m_scene_cache->getTriangles())
+        m_triangles->setData(m_scene_cache->getTriangles(), m_scene_cache->getTriangleCount());
+    m_blas_buffer->setData(m_scene_cache->getBLASNodes(), m_scene_cache->getBLASNodeCount());
+    m_tlas_buffer->setData(m_scene_cache->getTLASNodes(), m_scene_cache->getTLASNodeCount());
+    m_blas_offset_buffer->setData(m_scene_cache->getBLASOffsets(), m_scene_cache->getBLASOffsetCount());
+    m_instance_buffer->setData(m_scene_cache->getInstances(), m_scene_cache->getInstanceCount());
+    m_materials->setData(m_scene_cache->getMaterials(), m_scene_cache->getMaterialCount());
+    std::vector<uint32_t> material_flags = computeMaterialFlags(m_scene_cache->getMaterials(), m_scene_cache->getMaterialCount(), m_scene->getTextures());
+    m_material_flags->setData(material_flags);
+    std::array<uint32_t, 4> traversal_stats {};
+    m_traversal_stats->setData(traversal_stats.data(), traversal_stats.size());
+
+    // The scene lives on the GPU from here on
+    m_scene_cache.reset();
 
     std::vector<GLuint64> texture_handles;
     for (auto& texture : m_textures) {
@@ -146,6 +137,21 @@ OpenGlRenderer::initTextures() {
     }
 }
 
+void
+OpenGlRenderer::initGGXAlbedo() {
+    GGXAlbedoLUT lut;
+    m_ggx_albedo = std::make_unique<Texture>(GGXAlbedoLUT::SIZE,
+                                             GGXAlbedoLUT::SIZE,
+                                             GL_RG32F,
+                                             GL_RG,
+                                             GL_FLOAT);
+    m_ggx_albedo->setData((uint8_t*)lut.getData(),
+                          GL_LINEAR,
+                          GL_LINEAR,
+                          GL_CLAMP_TO_EDGE,
+                          GL_CLAMP_TO_EDGE);
+}
+
 void
 OpenGlRenderer::initShaders() {
     m_shader_pathtracer = std::make_unique<Shader>(
@@ -164,7 +170,7 @@ OpenGlRenderer::initBindings() {
     m_vertex_array_pathtracer = std::make_unique<VertexArray>();
     m_vertex_array_pathtracer->bind();
     m_quad->bind();
-    m_vertices->bind();
+    m_positions->bind();
     m_indices->bind();
     m_blas_buffer->bind();
     m_tlas_buffer->bind();
@@ -178,7 +184,7 @@ OpenGlRenderer::initBindings() {
                                        /*stride=*/3 * sizeof(float));
     m_vertex_array_pathtracer->unbind();
     m_quad->unbind();
-    m_vertices->unbind();
+    m_positions->unbind();
     m_indices->unbind();
     m_blas_buffer->unbind();
     m_tlas_buffer->unbind();
@@ -211,11 +217,13 @@ bool
 OpenGlRenderer::shouldClear(const glm::vec3& eye, const glm::vec3& dir, const glm::vec3& up) {
     bool clear = glm::any(glm::epsilonNotEqual(eye, m_prev_eye, 0.00001f)) ||
                  glm::any(glm::epsilonNotEqual(dir, m_prev_dir, 0.00001f)) ||
-                 glm::any(glm::epsilonNotEqual(up, m_prev_up, 0.00001f));
+                 glm::any(glm::epsilonNotEqual(up, m_prev_up, 0.00001f)) ||
+                 m_render_mode != m_prev_render_mode;
 
     m_prev_eye = eye;
     m_prev_dir = dir;
     m_prev_up = up;
+    m_prev_render_mode = m_render_mode;
 
     return clear;
 }
@@ -230,15 +238,41 @@ OpenGlRenderer::render(const glm::vec3 eye, const glm::vec3 dir, const glm::vec3
 
     m_accum_texture0->resize(viewport_size.x, viewport_size.y);
     m_accum_texture1->resize(viewport_size.x, viewport_size.y);
+    m_moments_texture0->resize(viewport_size.x, viewport_size.y);
+    m_moments_texture1->resize(viewport_size.x, viewport_size.y);
 
     if (shouldClear(eye, dir, up)) {
         m_frame_no = 0;
         m_accum_texture0->clear();
         m_accum_texture1->clear();
+        m_moments_texture0->clear();
+        m_moments_texture1->clear();
     }
 
+    // Both halves of the tile errors, see data.glsl. The half of this frame starts at 0 for atomicMax
+    uint32_t tile_count = ((viewport_size.x + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE) * ((viewport_size.y + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE);
+    if (tile_count != m_tile_count) {
+        m_tile_count = tile_count;
+        std::vector<uint32_t> tile_errors(2 * (size_t)m_tile_count, 0u);
+        m_tile_errors->setData(tile_errors);
+    }
+    uint32_t zero = 0;
+    glClearNamedBufferSubData(m_tile_errors->getBuffer(), GL_R32UI, (m_frame_no & 1) * m_tile_count * sizeof(uint32_t), m_tile_count * sizeof(uint32_t),
+                              GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+    bool heatmap = m_render_mode != RenderMode::Pathtracing;
+    uint32_t render_mode = (uint32_t)m_render_mode;
+    std::array<uint32_t, 4> traversal_stats {};
+    int ggx_albedo_unit = 1;
+    int precomputed_triangles = m_triangle_layout == TriangleLayout::Precomputed;
+    int moments_unit = 2;
+    uint32_t adaptive_min_samples = ADAPTIVE_MIN_SAMPLES;
+    uint32_t adaptive_tile_size = ADAPTIVE_TILE_SIZE;
+    if (heatmap) m_traversal_stats->setData(traversal_stats.data(), traversal_stats.size());
 
     { // Pathtracing renderpass
+        FART_PROFILE_PASS("Pathtracing", render_stats);
+        FART_PROFILE_GPU_PASS(m_gpu_timer, "Pathtracing");
         m_framebuffer0->bind();
         m_shader_pathtracer->use();
         m_shader_pathtracer->setUInt("u_frame_no", &m_frame_no);
@@ -248,37 +282,115 @@ OpenGlRenderer::render(const glm::vec3 eye, const glm::vec3 dir, const glm::vec3
         m_shader_pathtracer->setFloat3("u_camera.eye", glm::value_ptr(eye));
         m_shader_pathtracer->setFloat3("u_camera.dir", glm::value_ptr(dir));
         m_shader_pathtracer->setFloat3("u_camera.up", glm::value_ptr(up));
+        m_shader_pathtracer->setUInt("u_render_mode", &render_mode);
+        m_shader_pathtracer->setFloat("u_heatmap_scale", &m_heatmap_scale);
+        m_shader_pathtracer->setInt("u_ggx_albedo", &ggx_albedo_unit);
+        m_shader_pathtracer->setBool("u_precomputed_triangles", &precomputed_triangles);
+        m_shader_pathtracer->setInt("u_frag_moments_accum", &moments_unit);
+        m_shader_pathtracer->setFloat("u_adaptive_error", &m_adaptive_error);
+        m_shader_pathtracer->setUInt("u_adaptive_min_samples", &adaptive_min_samples);
+        m_shader_pathtracer->setUInt("u_adaptive_tile_size", &adaptive_tile_size);
+        m_shader_pathtracer->setUInt("u_tile_count", &m_tile_count);
         m_accum_texture1->activate(GL_TEXTURE0);
         m_accum_texture1->bind();
+        m_ggx_albedo->activate(GL_TEXTURE1);
+        m_ggx_albedo->bind();
+        m_moments_texture1->activate(GL_TEXTURE2);
+        m_moments_texture1->bind();
 
         m_vertex_array_pathtracer->bind();
         glDrawArrays(GL_TRIANGLES, 0, 6);
         m_vertex_array_pathtracer->unbind();
+        // The tile errors and traversal stats are written with atomics, the next frame reads
+        // the tile errors in its shader and isConverged() and the heatmaps read them back
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
 
+        m_moments_texture1->unbind();
+        m_ggx_albedo->activate(GL_TEXTURE1);
+        m_ggx_albedo->unbind();
+        m_accum_texture1->activate(GL_TEXTURE0);
         m_accum_texture1->unbind();
         m_shader_pathtracer->unuse();
         m_framebuffer0->unbind();
     }
 
-    { // Postprocessing renderpass
-        m_shader_postprocess->use();
-        m_accum_texture0->activate(GL_TEXTURE0);
-        m_accum_texture0->bind();
+    if (heatmap) {
+        // Stalls until the pass has finished, acceptable in the debug views
+        m_traversal_stats->getData(traversal_stats.data(), traversal_stats.size());
+        render_stats.traversal.nodes = traversal_stats[0];
+        render_stats.traversal.aabb_tests = traversal_stats[1];
+        render_stats.traversal.triangle_tests = traversal_stats[2];
+        render_stats.traversal.instance_transforms = traversal_stats[3];
+    }
 
-        m_vertex_array_postprocess->bind();
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        m_vertex_array_postprocess->unbind();
+    if (m_present_enabled) { // Postprocessing renderpass
+        {
+            FART_PROFILE_PASS("Postprocessing", render_stats);
+            FART_PROFILE_GPU_PASS(m_gpu_timer, "Postprocessing");
+            int tonemap = !heatmap;
+            m_shader_postprocess->use();
+            m_shader_postprocess->setBool("u_tonemap", &tonemap);
+            m_accum_texture0->activate(GL_TEXTURE0);
+            m_accum_texture0->bind();
+
+            m_vertex_array_postprocess->bind();
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+            m_vertex_array_postprocess->unbind();
+
+            m_shader_postprocess->unuse();
+        }
 
-        m_shader_postprocess->unuse();
+        FART_PROFILE_PASS("SwapBuffers", render_stats);
+        glfwSwapBuffers(m_window->getGlfwWindow());
     }
 
-    glfwSwapBuffers(m_window->getGlfwWindow());
+#if FART_PROFILER
+    m_gpu_timer->endFrame(render_stats.passes);
+#endif
+
     m_framebuffer0.swap(m_framebuffer1);
     m_accum_texture0.swap(m_accum_texture1);
+    m_moments_texture0.swap(m_moments_texture1);
 
     auto frame_time_mus = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - t_start);
     render_stats.frame_time_ms = frame_time_mus.count() * 0.001f;
     m_frame_no += 1;
 }
 
+bool
+OpenGlRenderer::readAccumulation(std::vector<glm::vec4>& pixels) {
+    // render() swaps after each frame, so the latest result is in m_accum_texture1
+    pixels.resize((size_t)m_accum_texture1->getWidth() * m_accum_texture1->getHeight());
+    m_accum_texture1->readData(&pixels[0].x);
+    return true;
+}
+
+bool
+OpenGlRenderer::isConverged() {
+    // The heatmaps write no tile errors
+    if (m_render_mode != RenderMode::Pathtracing || m_adaptive_error <= 0.f || m_frame_no == 0) return false;
+
+    // Half written by the last frame, render() has already counted it and issued the barrier
+    std::vector<uint32_t> tile_errors(2 * (size_t)m_tile_count);
+    m_tile_errors->getData(tile_errors.data(), tile_errors.size());
+    size_t offset = ((m_frame_no - 1) & 1) * (size_t)m_tile_count;
+    for (size_t i = 0; i < m_tile_count; i++) {
+        float error;
+        std::memcpy(&error, &tile_errors[offset + i], sizeof(float));
+        if (!(error <= m_adaptive_error)) return false;
+    }
+    return true;
+}
+
+uint64_t
+OpenGlRenderer::sampleCount() {
+    std::vector<glm::vec4> moments((size_t)m_moments_texture1->getWidth() * m_moments_texture1->getHeight());
+    m_moments_texture1->readData(&moments[0].x);
+
+    uint64_t samples = 0;
+    for (const glm::vec4& m : moments)
+        samples += (uint64_t)m.y;
+    return samples;
+}
+
 }
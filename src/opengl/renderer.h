@@ -1,9 +1,9 @@
 #pragma once
 
 #include "buffer.h"
-#include "bvh.h"
-#include "tlas.h"
+#include "scene_cache.h"
 #include "framebuffer.h"
+#include "gpu_timer.h"
 #include "vertex_array.h"
 #include "shader.h"
 #include "texture.h"
@@ -24,28 +24,43 @@ struct OpenGlRenderer : Renderer {
             return 8;
         }
 
+        bool readAccumulation(std::vector<glm::vec4>& pixels) override;
+        void synchronize() override { glFinish(); }
+        bool supportsRenderMode(RenderMode /*mode*/) override { return true; }
+        bool supportsAdaptiveSampling() override { return true; }
+        bool isConverged() override;
+        uint64_t sampleCount() override;
+
     private:
         uint32_t m_frame_no { 0 };
         glm::vec3 m_prev_eye, m_prev_dir, m_prev_up;
+        RenderMode m_prev_render_mode { RenderMode::Pathtracing };
 
         std::shared_ptr<Scene> m_scene;
         std::shared_ptr<Window> m_window;
-        std::vector<BVHNode> m_blas_list;
-        std::shared_ptr<TLAS> m_tlas;
-        std::vector<AligendVertex> m_vertices_contiguous;
-        std::vector<uint32_t> m_indices_contiguous;
+        std::unique_ptr<SceneCache> m_scene_cache;
+        // Only created when built with FART_PROFILER
+        std::unique_ptr<GpuTimer> m_gpu_timer;
 
         std::unique_ptr<Buffer> m_quad;
 
         std::unique_ptr<StorageBuffer> m_blas_buffer;
         std::unique_ptr<StorageBuffer> m_tlas_buffer;
         std::unique_ptr<StorageBuffer> m_blas_offset_buffer;
-        std::unique_ptr<StorageBuffer> m_vertices;
+        std::unique_ptr<StorageBuffer> m_positions;
+        std::unique_ptr<StorageBuffer> m_attributes;
         std::unique_ptr<StorageBuffer> m_indices;
+        std::unique_ptr<StorageBuffer> m_triangle_materials;
+        std::unique_ptr<StorageBuffer> m_triangles;
         std::unique_ptr<StorageBuffer> m_instance_buffer;
         std::unique_ptr<StorageBuffer> m_materials;
+        std::unique_ptr<StorageBuffer> m_material_flags;
         std::unique_ptr<StorageBuffer> m_textures_buffer;
+        std::unique_ptr<StorageBuffer> m_traversal_stats;
+        std::unique_ptr<StorageBuffer> m_tile_errors;
+        uint32_t m_tile_count { 0 };
         std::vector<Texture> m_textures;
+        std::unique_ptr<Texture> m_ggx_albedo;
 
         std::unique_ptr<VertexArray> m_vertex_array_pathtracer;
         std::unique_ptr<Shader> m_shader_pathtracer;
@@ -56,11 +71,15 @@ struct OpenGlRenderer : Renderer {
         std::unique_ptr<FrameBuffer> m_framebuffer1;
         std::unique_ptr<Texture> m_accum_texture0;
         std::unique_ptr<Texture> m_accum_texture1;
+        // Mean squared luminance and sample count per pixel, written alongside the accumulation
+        std::unique_ptr<Texture> m_moments_texture0;
+        std::unique_ptr<Texture> m_moments_texture1;
 
         void initAccelerationStructures();
         void initFrameBuffer();
         void initBuffers();
         void initTextures();
+        void initGGXAlbedo();
         void initShaders();
         void initBindings();
         void initGl();
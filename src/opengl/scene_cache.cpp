@@ -0,0 +1,378 @@
+#include "scene_cache.h"
+
+#include "common/defs.h"
+#include "common/profiler.h"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fart {
+
+static constexpr char MAGIC[8] = { 'F', 'A', 'R', 'T', 'C', 'A', 'C', 'H' };
+
+static uint64_t
+fnv1a( uint64_t hash, const void* data, size_t size ) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+template <typename T>
+static uint64_t
+fnv1a( uint64_t hash, const T& value ) {
+    return fnv1a(hash, &value, sizeof(T));
+}
+
+static uint64_t
+alignOffset( uint64_t offset ) {
+    return (offset + SceneCache::ALIGNMENT - 1) / SceneCache::ALIGNMENT * SceneCache::ALIGNMENT;
+}
+
+SceneCache::SceneCache( Scene& scene, TriangleLayout triangle_layout, BVHSplitMethod split_method, BVHLayout node_layout, const std::string& directory ) {
+    if (directory.empty()) {
+        LOG("Scene cache disabled, building acceleration structures");
+        build(scene, triangle_layout, split_method, node_layout, "", 0);
+        return;
+    }
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    uint64_t key;
+    {
+        FART_PROFILE_ZONE("Hash scene");
+        key = hashScene(scene, triangle_layout, split_method, node_layout);
+    }
+    std::stringstream path;
+    path << directory << "/" << std::hex << std::setw(16) << std::setfill('0') << key << EXTENSION;
+
+    if (load(path.str(), key)) {
+        auto load_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - t_start);
+        SUCC("Loaded scene cache " + path.str() + " in " + std::to_string(load_time_ms.count() / 1000.f) + " seconds");
+        return;
+    }
+
+    build(scene, triangle_layout, split_method, node_layout, path.str(), key);
+}
+
+SceneCache::~SceneCache() {
+    unmap();
+}
+
+/*
+ * Vertices, instances and materials are hashed field by field, their padding is not guaranteed to be initialized.
+ */
+uint64_t
+SceneCache::hashScene( Scene& scene, TriangleLayout triangle_layout, BVHSplitMethod split_method, BVHLayout node_layout ) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    // Build settings
+    hash = fnv1a(hash, VERSION);
+    hash = fnv1a(hash, (uint32_t)BVH_WIDTH);
+    hash = fnv1a(hash, (uint32_t)split_method);
+    hash = fnv1a(hash, (uint32_t)node_layout);
+    hash = fnv1a(hash, (uint32_t)triangle_layout);
+    hash = fnv1a(hash, (uint64_t)sizeof(glm::vec3));
+    hash = fnv1a(hash, (uint64_t)sizeof(VertexAttributes));
+    hash = fnv1a(hash, (uint64_t)sizeof(BLASNode));
+    hash = fnv1a(hash, (uint64_t)sizeof(TLASNode));
+    hash = fnv1a(hash, (uint64_t)sizeof(ObjectInstance));
+    hash = fnv1a(hash, (uint64_t)sizeof(OpenPBRMaterial));
+
+    // Scene content
+    hash = fnv1a(hash, (uint64_t)scene.getObjects().size());
+    for (auto& object : scene.getObjects()) {
+        hash = fnv1a(hash, (uint64_t)object.geometries.size());
+        for (auto& geometry : object.geometries) {
+            hash = fnv1a(hash, (uint64_t)geometry.vertices.size());
+            for (auto& vertex : geometry.vertices) {
+                hash = fnv1a(hash, &vertex.position, sizeof(glm::vec3));
+                hash = fnv1a(hash, &vertex.normal, sizeof(glm::vec3));
+                hash = fnv1a(hash, &vertex.uv, sizeof(glm::vec2));
+                hash = fnv1a(hash, vertex.material_id);
+            }
+            hash = fnv1a(hash, (uint64_t)geometry.indices.size());
+            hash = fnv1a(hash, geometry.indices.data(), geometry.indices.size() * sizeof(uint32_t));
+        }
+    }
+
+    hash = fnv1a(hash, (uint64_t)scene.getInstances().size());
+    for (auto& instance : scene.getInstances()) {
+        hash = fnv1a(hash, &instance.world_to_instance, sizeof(glm::mat4));
+        hash = fnv1a(hash, instance.object_id);
+    }
+
+    hash = fnv1a(hash, (uint64_t)scene.getMaterials().size());
+    for (auto& material : scene.getMaterials()) {
+        hash = fnv1a(hash, &material.base_color, sizeof(glm::vec3));
+        hash = fnv1a(hash, material.base_color_texid);
+        hash = fnv1a(hash, material.base_weight);
+        hash = fnv1a(hash, material.base_roughness);
+        hash = fnv1a(hash, material.base_metalness);
+        hash = fnv1a(hash, &material.specular_color, sizeof(glm::vec3));
+        hash = fnv1a(hash, material.specular_weight);
+        hash = fnv1a(hash, material.specular_roughness);
+        hash = fnv1a(hash, material.specular_anisotropy);
+        hash = fnv1a(hash, material.specular_rotation);
+        hash = fnv1a(hash, material.specular_ior);
+        hash = fnv1a(hash, material.specular_ior_level);
+        hash = fnv1a(hash, material.transmission_weight);
+        hash = fnv1a(hash, material.geometry_opacity);
+        hash = fnv1a(hash, material.geometry_opacity_texid);
+    }
+
+    return hash;
+}
+
+bool
+SceneCache::load( const std::string& path, uint64_t key ) {
+    FART_PROFILE_ZONE("Load scene cache");
+#ifdef _WIN32
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) return false;
+    m_heap.resize((size_t)file.tellg());
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(m_heap.data()), m_heap.size());
+    if (!file) {
+        m_heap = std::vector<uint8_t>();
+        return false;
+    }
+    m_data = m_heap.data();
+    size_t size = m_heap.size();
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header)) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return false;
+
+    m_mapping = mapping;
+    m_mapping_size = size;
+    m_data = static_cast<const uint8_t*>(mapping);
+#endif
+
+    const uint64_t strides[SectionCount] = {
+        sizeof(glm::vec3),
+        sizeof(VertexAttributes),
+        sizeof(uint32_t),
+        sizeof(uint32_t),
+        sizeof(TrianglePositions),
+        sizeof(BLASNode),
+        sizeof(TLASNode),
+        sizeof(uint32_t),
+        sizeof(ObjectInstance),
+        sizeof(OpenPBRMaterial),
+    };
+
+    bool valid = size >= sizeof(Header);
+    if (valid) {
+        std::memcpy(&m_header, m_data, sizeof(Header));
+        valid = std::memcmp(m_header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                m_header.version == VERSION &&
+                m_header.section_count == SectionCount &&
+                m_header.key == key &&
+                m_header.size == size;
+    }
+    for (uint32_t i = 0; valid && i < SectionCount; i++) {
+        const SectionEntry& entry = m_header.sections[i];
+        valid = entry.stride == strides[i] &&
+                entry.offset % ALIGNMENT == 0 &&
+                entry.offset <= size &&
+                entry.count <= (size - entry.offset) / entry.stride;
+    }
+
+    if (!valid) {
+        WARN("Ignoring outdated scene cache " + path);
+        unmap();
+        m_header = {};
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Mirrors what the renderers used to do on every launch: one contiguous geometry arena,
+ * per-object BVHs (collapsed into wide nodes for BVH_WIDTH > 2) and a TLAS on top.
+ * The arena is split into positions and compact attributes once the BVHs are built, materials
+ * are taken per triangle reference from the final index order and vertices renumbered in leaf order.
+ */
+void
+SceneCache::build( Scene& scene, TriangleLayout triangle_layout, BVHSplitMethod split_method, BVHLayout node_layout, const std::string& path, uint64_t key ) {
+    FART_PROFILE_ZONE("Build acceleration structures");
+    std::vector<AligendVertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<BVH> bvhs;
+    {
+        FART_PROFILE_ZONE("Build BLAS");
+        bvhs = BVH::buildAll(scene.getObjects(), vertices, indices, split_method);
+    }
+
+    // Leaf nodes already reference the contiguous index array
+    size_t bvhnodes_size = std::accumulate(bvhs.begin(), bvhs.end(), 0, [](size_t acc, BVH& bvh) { return acc + bvh.getNodesUsed(); });
+    std::vector<BLASNode> blas_nodes;
+    std::vector<BLASInfo> blas_info;
+    blas_info.reserve(bvhs.size());
+    blas_nodes.reserve(bvhnodes_size);
+    for (auto& bvh : bvhs) {
+#if BVH_WIDTH > 2
+        // Collapse into wide nodes with quantized child bounds, emitted in their own depth-first order
+        WideBVH blas(bvh);
+#else
+        BVH& blas = bvh;
+        blas.reorderNodes(node_layout);
+#endif
+        std::vector<BLASNode>& nodes = blas.getNodes();
+        blas_nodes.insert(blas_nodes.end(), nodes.begin(), nodes.begin() + blas.getNodesUsed());
+        blas_info.push_back({ bvh.getNodes()[0].aabb, (uint32_t)blas.getNodesUsed() });
+    }
+
+    // Release the per-object BVH copies before building the TLAS
+    bvhs.clear();
+    bvhs.shrink_to_fit();
+
+    TLAS tlas(scene.getInstances(), blas_info);
+    tlas.reorderNodes(node_layout);
+
+    std::vector<glm::vec3> positions;
+    std::vector<VertexAttributes> attributes;
+    std::vector<uint32_t> triangle_materials;
+    splitVertices(vertices, indices, positions, attributes, triangle_materials);
+    vertices = std::vector<AligendVertex>();
+    reorderVertices(indices, positions, attributes);
+
+    std::vector<TrianglePositions> triangles;
+    if (triangle_layout == TriangleLayout::Precomputed)
+        triangles = precomputeTriangles(indices, positions);
+
+    const SectionSource sources[SectionCount] = {
+        { positions.data(), positions.size(), sizeof(glm::vec3) },
+        { attributes.data(), attributes.size(), sizeof(VertexAttributes) },
+        { indices.data(), indices.size(), sizeof(uint32_t) },
+        { triangle_materials.data(), triangle_materials.size(), sizeof(uint32_t) },
+        { triangles.data(), triangles.size(), sizeof(TrianglePositions) },
+        { blas_nodes.data(), blas_nodes.size(), sizeof(BLASNode) },
+        { tlas.getNodes().data(), tlas.getNodesUsed(), sizeof(TLASNode) },
+        { tlas.getBLASOffsets().data(), tlas.getBLASOffsets().size(), sizeof(uint32_t) },
+        { tlas.getInstances().data(), tlas.getInstances().size(), sizeof(ObjectInstance) },
+        { scene.getMaterials().data(), scene.getMaterials().size(), sizeof(OpenPBRMaterial) },
+    };
+
+    // Map the written file so that both paths hand out the same memory, keep a heap copy otherwise
+    layout(sources, key);
+    if (!path.empty() && write(path, sources) && load(path, key)) {
+        SUCC("Wrote scene cache " + path);
+        return;
+    }
+
+    // load() resets the header when it fails
+    layout(sources, key);
+    m_heap.assign(m_header.size, 0);
+    std::memcpy(m_heap.data(), &m_header, sizeof(Header));
+    for (uint32_t i = 0; i < SectionCount; i++) {
+        if (sources[i].count == 0) continue;
+        std::memcpy(m_heap.data() + m_header.sections[i].offset, sources[i].data, sources[i].count * sources[i].stride);
+    }
+    m_data = m_heap.data();
+}
+
+void
+SceneCache::layout( const SectionSource* sources, uint64_t key ) {
+    m_header = {};
+    std::memcpy(m_header.magic, MAGIC, sizeof(MAGIC));
+    m_header.version = VERSION;
+    m_header.section_count = SectionCount;
+    m_header.key = key;
+
+    uint64_t offset = alignOffset(sizeof(Header));
+    for (uint32_t i = 0; i < SectionCount; i++) {
+        m_header.sections[i] = { offset, sources[i].count, sources[i].stride };
+        offset = alignOffset(offset + sources[i].count * sources[i].stride);
+    }
+    m_header.size = offset;
+}
+
+// Unique per writer, so that processes building the same scene into a shared directory never write into one file
+static std::string
+tempSuffix() {
+    std::random_device random;
+    uint64_t value = ((uint64_t)random() << 32) | random();
+    std::ostringstream suffix;
+#ifndef _WIN32
+    suffix << "." << getpid();
+#endif
+    suffix << "." << std::hex << value << ".tmp";
+    return suffix.str();
+}
+
+// Writes to a temporary file first, so that an interrupted run never leaves a truncated cache behind
+bool
+SceneCache::write( const std::string& path, const SectionSource* sources ) const {
+    FART_PROFILE_ZONE("Write scene cache");
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+    std::string tmp_path = path + tempSuffix();
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if (file) {
+            const char padding[ALIGNMENT] = {};
+            uint64_t position = sizeof(Header);
+            file.write(reinterpret_cast<const char*>(&m_header), sizeof(Header));
+            for (uint32_t i = 0; i < SectionCount; i++) {
+                const SectionEntry& entry = m_header.sections[i];
+                file.write(padding, entry.offset - position);
+                file.write(static_cast<const char*>(sources[i].data), entry.count * entry.stride);
+                position = entry.offset + entry.count * entry.stride;
+            }
+            file.write(padding, m_header.size - position);
+        }
+        if (!file) {
+            WARN("Could not write scene cache " + path);
+            std::filesystem::remove(tmp_path, error);
+            return false;
+        }
+    }
+
+    std::filesystem::rename(tmp_path, path, error);
+    if (error) {
+        WARN("Could not write scene cache " + path + ": " + error.message());
+        std::filesystem::remove(tmp_path, error);
+        return false;
+    }
+    return true;
+}
+
+void
+SceneCache::unmap() {
+#ifndef _WIN32
+    if (m_mapping) munmap(m_mapping, m_mapping_size);
+#endif
+    m_mapping = nullptr;
+    m_mapping_size = 0;
+    m_heap = std::vector<uint8_t>();
+    m_data = nullptr;
+}
+
+}
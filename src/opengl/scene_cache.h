@@ -0,0 +1,134 @@
+#pragma once
+
+#include "bvh.h"
+#include "geometry.h"
+#include "wide_bvh.h"
+#include "tlas.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <stage.h>
+
+using namespace stage;
+
+namespace fart {
+
+/*
+ * The flattened scene in upload-ready layout: the contiguous vertex position, vertex attribute and index arrays,
+ * the material id of every triangle reference, the concatenated BLAS nodes, the TLAS and the instances and
+ * materials in TLAS order. Vertices are numbered in BVH leaf order. With TriangleLayout::Precomputed the
+ * cache also holds the positions of every triangle reference, see TrianglePositions.
+ *
+ * Caches live in a directory (DEFAULT_DIRECTORY unless set) as <key>.fartcache, where the key
+ * hashes the parsed scene together with everything that changes the build output. On a hit
+ * the file is memory mapped and its sections are handed out as is, otherwise the acceleration
+ * structures are built and written for the next run. Without a directory nothing is read or
+ * written and every run builds into a heap copy.
+ *
+ * File layout: a Header followed by the sections, each starting at a multiple of ALIGNMENT.
+ */
+struct SceneCache {
+
+    public:
+        static constexpr const char* DEFAULT_DIRECTORY = "fartcache";
+        static constexpr const char* EXTENSION = ".fartcache";
+        // Bump whenever the file layout, the layout of a cached type or a guarantee the traversals rely on changes
+        static constexpr uint32_t VERSION = 5;
+        static constexpr size_t ALIGNMENT = 64;
+
+        // Loads the cache for the scene, or builds the acceleration structures and writes it.
+        // An empty directory disables the cache.
+        SceneCache( Scene& scene,
+                    TriangleLayout triangle_layout = TriangleLayout::Indexed,
+                    BVHSplitMethod split_method = BVHSplitMethod::SAH,
+                    BVHLayout node_layout = BVHLayout::DFS,
+                    const std::string& directory = DEFAULT_DIRECTORY );
+        SceneCache( SceneCache& other ) = delete;
+        SceneCache& operator=( SceneCache& other ) = delete;
+        ~SceneCache();
+
+        const glm::vec3* getPositions() const { return section<glm::vec3>(Positions); }
+        const VertexAttributes* getAttributes() const { return section<VertexAttributes>(Attributes); }
+        size_t getVertexCount() const { return m_header.sections[Positions].count; }
+        const uint32_t* getIndices() const { return section<uint32_t>(Indices); }
+        size_t getIndexCount() const { return m_header.sections[Indices].count; }
+        // One per index triple, in the order of the BVH leaves
+        const uint32_t* getTriangleMaterials() const { return section<uint32_t>(TriangleMaterials); }
+        size_t getTriangleCount() const { return m_header.sections[TriangleMaterials].count; }
+        // Same order as the materials, nullptr unless built with TriangleLayout::Precomputed
+        const TrianglePositions* getTriangles() const {
+            return m_header.sections[Triangles].count ? section<TrianglePositions>(Triangles) : nullptr;
+        }
+        const BLASNode* getBLASNodes() const { return section<BLASNode>(BLASNodes); }
+        size_t getBLASNodeCount() const { return m_header.sections[BLASNodes].count; }
+        const TLASNode* getTLASNodes() const { return section<TLASNode>(TLASNodes); }
+        size_t getTLASNodeCount() const { return m_header.sections[TLASNodes].count; }
+        const uint32_t* getBLASOffsets() const { return section<uint32_t>(BLASOffsets); }
+        size_t getBLASOffsetCount() const { return m_header.sections[BLASOffsets].count; }
+        const ObjectInstance* getInstances() const { return section<ObjectInstance>(Instances); }
+        size_t getInstanceCount() const { return m_header.sections[Instances].count; }
+        const OpenPBRMaterial* getMaterials() const { return section<OpenPBRMaterial>(Materials); }
+        size_t getMaterialCount() const { return m_header.sections[Materials].count; }
+
+        // FNV-1a over the scene content and the build settings
+        static uint64_t hashScene( Scene& scene, TriangleLayout triangle_layout, BVHSplitMethod split_method, BVHLayout node_layout );
+
+    private:
+        enum Section {
+            Positions,
+            Attributes,
+            Indices,
+            TriangleMaterials,
+            Triangles,
+            BLASNodes,
+            TLASNodes,
+            BLASOffsets,
+            Instances,
+            Materials,
+            SectionCount,
+        };
+
+        struct SectionEntry {
+            uint64_t offset;
+            uint64_t count;
+            uint64_t stride;
+        };
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t section_count;
+            uint64_t key;
+            uint64_t size;
+            SectionEntry sections[SectionCount];
+        };
+
+        // Points into a file or heap image of the cache, filled by build()
+        struct SectionSource {
+            const void* data;
+            uint64_t count;
+            uint64_t stride;
+        };
+
+        bool load( const std::string& path, uint64_t key );
+        void build( Scene& scene, TriangleLayout triangle_layout, BVHSplitMethod split_method, BVHLayout node_layout, const std::string& path, uint64_t key );
+        void layout( const SectionSource* sources, uint64_t key );
+        bool write( const std::string& path, const SectionSource* sources ) const;
+        void unmap();
+
+        template <typename T>
+        const T* section( Section s ) const {
+            return reinterpret_cast<const T*>(m_data + m_header.sections[s].offset);
+        }
+
+        Header m_header {};
+        const uint8_t* m_data { nullptr };
+
+        // Either a read-only mapping of the file, or a heap copy if mapping or writing failed
+        void* m_mapping { nullptr };
+        size_t m_mapping_size { 0 };
+        std::vector<uint8_t> m_heap;
+};
+
+}
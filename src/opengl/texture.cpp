@@ -90,6 +90,13 @@ Texture::clear() {
     setData(nullptr);
 }
 
+void
+Texture::readData(float* data) {
+    bind();
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, data);
+    unbind();
+}
+
 GLuint64&
 Texture::getTextureHandle() {
     if (!m_handle)
@@ -26,8 +26,12 @@ struct Texture {
                      GLenum wrap_t = GL_MIRRORED_REPEAT);
         void resize(uint32_t width, uint32_t height);
         void clear();
+        // Reads back level 0 as RGBA floats, data must hold 4 * width * height values
+        void readData(float* data);
 
         GLuint& getTexture() { return m_texture; }
+        uint32_t getWidth() const { return m_width; }
+        uint32_t getHeight() const { return m_height; }
         GLuint64& getTextureHandle();
         void makeResident();
         void makeNonResident();
@@ -1,16 +1,19 @@
 #include "tlas.h"
 
 #include "common/defs.h"
+#include "common/job_system.h"
 #include <string>
 #include <cstdint>
 #include <chrono>
 #include <algorithm>
+#include <array>
+#include <numeric>
 
 namespace fart {
 
-TLAS::TLAS(const std::vector<ObjectInstance>& instances, const std::vector<BVH>& bvhs) {
+TLAS::TLAS(const std::vector<ObjectInstance>& instances, const std::vector<BLASInfo>& blas_info) {
     m_instances = instances;
-    m_bvhs = bvhs;
+    m_blas_info = blas_info;
 
     build();
 }
@@ -21,17 +24,17 @@ TLAS::build() {
     auto t_start = std::chrono::high_resolution_clock::now();
 
     size_t N = m_instances.size();
-    m_nodes_used = 1;
+    uint32_t n_threads = JobSystem::get().threadCount();
     m_bounds.resize(N);
-    m_tlas_nodes.resize(N * 2);
-    m_bvh_node_offsets.resize(m_bvhs.size());
+    m_instance_ids.resize(N);
+    std::iota(m_instance_ids.begin(), m_instance_ids.end(), 0);
+    m_tlas_nodes.resize(std::max<size_t>(N * 2, 1));
+    m_bvh_node_offsets.resize(m_blas_info.size());
     m_bvh_node_offsets[0] = 0;
 
-    for (size_t i = 0; i < N; ++i) {
-        m_bounds[i] = m_bvhs[m_instances[i].object_id].getNodes()[0].aabb.transform(glm::inverse(m_instances[i].world_to_instance));
-    }
-    for (size_t i = 1; i < m_bvhs.size(); i++) {
-        m_bvh_node_offsets[i] = m_bvh_node_offsets[i - 1] + m_bvhs[i - 1].getNodesUsed();
+    updateInstanceBounds(n_threads);
+    for (size_t i = 1; i < m_blas_info.size(); i++) {
+        m_bvh_node_offsets[i] = m_bvh_node_offsets[i - 1] + m_blas_info[i - 1].nodes_used;
     }
 
     uint32_t root_idx = 0;
@@ -40,12 +43,63 @@ TLAS::build() {
     root.first_instance_id = 0;
     root.instance_count = N;
     updateNodeBounds(root_idx);
-    subdivide(root_idx);
+    subdivide(root_idx, root_idx + 1, n_threads);
+    compact();
 
     auto build_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - t_start);
     SUCC("Built TLAS over " + std::to_string(m_instances.size()) + " instances in " + std::to_string(build_time_ms.count() / 1000.f) + " seconds");
 }
 
+void
+TLAS::refit(const std::vector<ObjectInstance>& instances) {
+    if (instances.size() != m_instances.size()) {
+        ERR("Cannot refit TLAS over " + std::to_string(m_instances.size()) + " instances with " + std::to_string(instances.size()) + " instances, it has to be rebuilt");
+        return;
+    }
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    for (size_t i = 0; i < m_instances.size(); i++) {
+        m_instances[i] = instances[m_instance_ids[i]];
+    }
+    updateInstanceBounds(JobSystem::get().threadCount());
+
+    // Children are always stored after their parent, so a reverse sweep visits them first
+    for (size_t i = m_nodes_used; i-- > 0;) {
+        TLASNode& node = m_tlas_nodes[i];
+        if (node.left_child == 0) {
+            updateNodeBounds(i);
+        } else {
+            node.aabb = m_tlas_nodes[node.left_child].aabb.merge(m_tlas_nodes[node.left_child + 1].aabb);
+        }
+    }
+
+    auto refit_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - t_start);
+    LOG("Refit TLAS over " + std::to_string(m_instances.size()) + " instances in " + std::to_string(refit_time_ms.count() / 1000.f) + " seconds");
+}
+
+void
+TLAS::reorderNodes(BVHLayout layout) {
+    fart::reorderNodes(m_tlas_nodes, m_nodes_used, layout);
+}
+
+void
+TLAS::updateInstanceBounds(uint32_t n_threads) {
+    auto transform_bounds = [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            m_bounds[i] = m_blas_info[m_instances[i].object_id].bounds.transform(glm::inverse(m_instances[i].world_to_instance));
+        }
+    };
+
+    size_t N = m_instances.size();
+    size_t n_chunks = N >= PARALLEL_BINNING_THRESHOLD ? n_threads : 1;
+    TaskGroup tasks;
+    for (size_t c = 1; c < n_chunks; c++)
+        tasks.run([&, c]() { transform_bounds(N * c / n_chunks, N * (c + 1) / n_chunks); });
+    transform_bounds(0, N / n_chunks);
+    tasks.wait();
+}
+
 void
 TLAS::updateNodeBounds(uint32_t node_idx) {
     TLASNode& node = m_tlas_nodes[node_idx];
@@ -57,11 +111,15 @@ TLAS::updateNodeBounds(uint32_t node_idx) {
     }
 }
 
+/*
+ * Mirrors BVH::subdivide: every node owns a block of 2 * instance_count - 2 slots for its
+ * descendants, so subtrees can be built concurrently and are packed afterwards by compact().
+ */
 void
-TLAS::subdivide(uint32_t node_idx) {
+TLAS::subdivide(uint32_t node_idx, uint32_t first_child_idx, uint32_t n_threads) {
     uint32_t axis = 0;
     float split_pos = 0.f;
-    if (!splitSAH(node_idx, split_pos, axis))
+    if (!splitSAH(node_idx, split_pos, axis, n_threads))
         return;
 
     TLASNode& node = m_tlas_nodes[node_idx];
@@ -73,6 +131,7 @@ TLAS::subdivide(uint32_t node_idx) {
         }
         else {
             std::swap(m_instances[i], m_instances[j]);
+            std::swap(m_instance_ids[i], m_instance_ids[j]);
             std::swap(m_bounds[i], m_bounds[j]);
             j -= 1;
         }
@@ -81,34 +140,113 @@ TLAS::subdivide(uint32_t node_idx) {
     uint32_t left_count = i - node.first_instance_id;
     if (left_count == 0 || left_count == node.instance_count) return;
 
-    uint32_t left_child_idx = m_nodes_used++;
-    uint32_t right_child_idx = m_nodes_used++;
+    uint32_t left_child_idx = first_child_idx;
+    uint32_t right_child_idx = first_child_idx + 1;
+    uint32_t right_count = node.instance_count - left_count;
     
     node.left_child = left_child_idx;
 
     m_tlas_nodes[left_child_idx].first_instance_id = node.first_instance_id;
     m_tlas_nodes[left_child_idx].instance_count = left_count;
     m_tlas_nodes[right_child_idx].first_instance_id = i;
-    m_tlas_nodes[right_child_idx].instance_count = node.instance_count - left_count;
+    m_tlas_nodes[right_child_idx].instance_count = right_count;
 
     node.instance_count = 0;
 
     updateNodeBounds(left_child_idx);
     updateNodeBounds(right_child_idx);
 
-    subdivide(left_child_idx);
-    subdivide(right_child_idx);
+    uint32_t left_first_child_idx = first_child_idx + 2;
+    uint32_t right_first_child_idx = left_first_child_idx + 2 * left_count - 2;
+
+    if (n_threads > 1 && std::min(left_count, right_count) >= PARALLEL_BUILD_THRESHOLD) {
+        TaskGroup left;
+        left.run([&]() {
+            subdivide(left_child_idx, left_first_child_idx, n_threads / 2);
+        });
+        subdivide(right_child_idx, right_first_child_idx, n_threads - n_threads / 2);
+        left.wait();
+    } else {
+        subdivide(left_child_idx, left_first_child_idx, n_threads);
+        subdivide(right_child_idx, right_first_child_idx, n_threads);
+    }
+}
+
+void
+TLAS::compact() {
+    std::vector<TLASNode> nodes(m_tlas_nodes.size());
+    nodes[0] = m_tlas_nodes[0];
+    m_nodes_used = 1;
+
+    std::vector<uint32_t> stack { 0 };
+    while (!stack.empty()) {
+        uint32_t node_idx = stack.back();
+        stack.pop_back();
+
+        TLASNode& node = nodes[node_idx];
+        if (node.left_child == 0) continue;
+
+        uint32_t left_child_idx = m_nodes_used;
+        m_nodes_used += 2;
+        nodes[left_child_idx] = m_tlas_nodes[node.left_child];
+        nodes[left_child_idx + 1] = m_tlas_nodes[node.left_child + 1];
+        node.left_child = left_child_idx;
 
+        stack.push_back(left_child_idx + 1);
+        stack.push_back(left_child_idx);
+    }
+
+    nodes.resize(m_nodes_used);
+    m_tlas_nodes = std::move(nodes);
 }
 
 bool
-TLAS::splitSAH(uint32_t node_idx, float& split_pos, uint32_t& axis){
+TLAS::splitSAH(uint32_t node_idx, float& split_pos, uint32_t& axis, uint32_t n_threads){
     TLASNode& node = m_tlas_nodes[node_idx];
     const glm::vec3 node_extent = node.aabb.extent();
     if (node.instance_count <= 4) return false;
 
     const int n_buckets = 12;
     const int n_splits = n_buckets - 1;
+    using Buckets = std::array<std::array<TLASSplitBucket, n_buckets>, 3>;
+
+    // Bins a range of instances into buckets along all three axes
+    auto bin = [&](uint32_t first, uint32_t last, Buckets& buckets) {
+        for (uint32_t i = first; i < last; i++) {
+            glm::vec3 centroid = m_bounds[i].centroid();
+            for (size_t ax = 0; ax < 3; ax++) {
+                if (node_extent[ax] <= 0.f) continue;
+                int b = n_buckets * std::clamp(((centroid[ax] - node.aabb.min[ax]) / node_extent[ax]), 0.f, 1.f);
+                if (b == n_buckets) b = n_buckets - 1;
+                buckets[ax][b].count += 1;
+                buckets[ax][b].bounds = buckets[ax][b].bounds.merge(m_bounds[i]);
+            }
+        }
+    };
+
+    uint32_t first = node.first_instance_id;
+    uint32_t n_chunks = node.instance_count >= PARALLEL_BINNING_THRESHOLD ? n_threads : 1;
+
+    // Chunks are binned concurrently and merged in a fixed order, so the result does not depend on n_threads
+    std::vector<Buckets> chunk_buckets(n_chunks);
+    TaskGroup tasks;
+    for (uint32_t c = 1; c < n_chunks; c++) {
+        uint32_t chunk_first = first + (uint64_t)node.instance_count * c / n_chunks;
+        uint32_t chunk_last = first + (uint64_t)node.instance_count * (c + 1) / n_chunks;
+        tasks.run([&, c, chunk_first, chunk_last]() { bin(chunk_first, chunk_last, chunk_buckets[c]); });
+    }
+    bin(first, first + node.instance_count / n_chunks, chunk_buckets[0]);
+    tasks.wait();
+
+    Buckets& buckets = chunk_buckets[0];
+    for (uint32_t c = 1; c < n_chunks; c++) {
+        for (size_t ax = 0; ax < 3; ax++) {
+            for (int b = 0; b < n_buckets; b++) {
+                buckets[ax][b].count += chunk_buckets[c][ax][b].count;
+                buckets[ax][b].bounds = buckets[ax][b].bounds.merge(chunk_buckets[c][ax][b].bounds);
+            }
+        }
+    }
 
     int min_cost_split_bucket = -1;
     uint32_t min_split_axis = 0;
@@ -116,29 +254,21 @@ TLAS::splitSAH(uint32_t node_idx, float& split_pos, uint32_t& axis){
 
     for (size_t ax = 0; ax < 3; ax++) {
         if (node_extent[ax] <= 0.f) continue;
-        std::vector<TLASSplitBucket> buckets (n_buckets);
-
-        for (uint32_t i = node.first_instance_id; i < node.first_instance_id + node.instance_count; i++) {
-            int b = n_buckets * std::clamp(((m_bounds[i].centroid()[ax] - node.aabb.min[ax]) / node_extent[ax]), 0.f, 1.f);
-            if (b == n_buckets) b = n_buckets - 1;
-            buckets[b].count += 1;
-            buckets[b].bounds = buckets[b].bounds.merge(m_bounds[i]);
-        }
 
         std::vector<float> costs (n_splits);
         int count_below = 0;
         AABB bound_below;
         for (int i = 0; i < n_splits; i++) {
-            bound_below = bound_below.merge(buckets[i].bounds);
-            count_below += buckets[i].count;
+            bound_below = bound_below.merge(buckets[ax][i].bounds);
+            count_below += buckets[ax][i].count;
             costs[i] += count_below * bound_below.surfaceArea();
         }
 
         int count_above = 0;
         AABB bound_above;
         for (int i = n_splits; i >= 1; i--) {
-            bound_above = bound_above.merge(buckets[i].bounds);
-            count_above += buckets[i].count;
+            bound_above = bound_above.merge(buckets[ax][i].bounds);
+            count_above += buckets[ax][i].count;
             costs[i - 1] += count_above * bound_above.surfaceArea();
         }
 
@@ -6,7 +6,7 @@
 
 #include "common/mesh.h"
 #include "aabb.h"
-#include "bvh.h"
+#include "node_layout.h"
 
 
 namespace fart {
@@ -16,6 +16,12 @@ struct TLASSplitBucket {
     uint32_t count { 0 };
 };
 
+// The only per-object information the TLAS needs from a BLAS
+struct BLASInfo {
+    AABB bounds;
+    uint32_t nodes_used;
+};
+
 struct TLASNode {
     AABB aabb;
     uint32_t left_child { 0 };
@@ -25,7 +31,20 @@ struct TLASNode {
 
 struct TLAS {
 public:
-    TLAS(const std::vector<ObjectInstance>& instances, const std::vector<BVH>& bvhs);
+    // Subtrees with at least this many instances are built as separate tasks
+    static constexpr uint32_t PARALLEL_BUILD_THRESHOLD = 4096;
+    // Nodes with at least this many instances bin their SAH buckets in parallel
+    static constexpr uint32_t PARALLEL_BINNING_THRESHOLD = 65536;
+
+    TLAS(const std::vector<ObjectInstance>& instances, const std::vector<BLASInfo>& blas_info);
+
+    // Updates instance transforms and refits node bounds without changing the topology.
+    // Expects the instances in their original order and with unchanged object ids,
+    // a different instance count is rejected.
+    void refit(const std::vector<ObjectInstance>& instances);
+
+    // Reorders the nodes, builds emit DFS
+    void reorderNodes(BVHLayout layout);
 
     size_t getNodesUsed() { return m_nodes_used; }
     std::vector<TLASNode>& getNodes() { return m_tlas_nodes; }
@@ -34,12 +53,15 @@ public:
 
     private:
         void build();
+        void updateInstanceBounds(uint32_t n_threads);
         void updateNodeBounds(uint32_t node_idx);
-        void subdivide(uint32_t node_idx);
-        bool splitSAH(uint32_t node_idx, float& split_pos, uint32_t& axis);
+        void subdivide(uint32_t node_idx, uint32_t first_child_idx, uint32_t n_threads);
+        void compact();
+        bool splitSAH(uint32_t node_idx, float& split_pos, uint32_t& axis, uint32_t n_threads);
 
         std::vector<ObjectInstance> m_instances;
-        std::vector<BVH> m_bvhs;
+        std::vector<uint32_t> m_instance_ids;
+        std::vector<BLASInfo> m_blas_info;
 
         std::vector<AABB> m_bounds;
         std::vector<uint32_t> m_bvh_node_offsets;
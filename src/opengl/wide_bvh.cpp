@@ -0,0 +1,213 @@
+#include "wide_bvh.h"
+
+#include "common/defs.h"
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+/*
+ * References:
+ * Ylitie et al. 2017, "Efficient Incoherent Ray Traversal on GPUs Through Compressed Wide BVHs"
+ * Wald et al. 2008, "Getting Rid of Packets"
+ */
+namespace fart {
+
+WideBVH::WideBVH( BVH& bvh ) : m_binary_nodes(bvh.getNodes()) {
+    m_nodes.reserve(bvh.getNodesUsed() / 2 + 1);
+    m_stack_need.resize(m_binary_nodes.size(), 0);
+    // The binary depth is clamped to BVH::MAX_DEPTH, so the root always fits
+    collapse(0, MAX_STACK);
+    if (m_stack_limited)
+        WARN("Wide BVH over " + std::to_string(bvh.getIndexCount() / 3) + " triangles would exceed the traversal stack of "
+             + std::to_string(MAX_STACK) + " entries, some nodes were collapsed less");
+}
+
+AABB
+WideBVH::childBounds( const WideBVHNode& node, uint32_t slot ) {
+    AABB bounds;
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        float scale = std::ldexp(1.f, (int)((node.exponents >> (8 * axis)) & 0xff) - 127);
+        bounds.min[axis] = node.origin[axis] + node.bounds[axis * WIDTH + slot] * scale;
+        bounds.max[axis] = node.origin[axis] + node.bounds[(3 + axis) * WIDTH + slot] * scale;
+    }
+    return bounds;
+}
+
+/*
+ * A node with k children that traversal pushes needs k - 1 entries for the siblings of the
+ * child it descends into. Leaves too large for one child entry become a node of their own,
+ * which needs one entry.
+ */
+uint32_t
+WideBVH::stackNeed( uint32_t binary_idx ) {
+    const BVHNode& node = m_binary_nodes[binary_idx];
+    if (node.left_child == 0) return 1;
+    if (m_stack_need[binary_idx] == 0)
+        m_stack_need[binary_idx] = 1 + std::max(stackNeed(node.left_child), stackNeed(node.left_child + 1));
+    return m_stack_need[binary_idx];
+}
+
+/*
+ * Pulls up the descendants of a binary node, always opening the inner child with the
+ * largest surface area, until the wide node is full. Nodes are emitted in depth-first order.
+ * A child is only opened if the pushed children and what their subtrees need still fit
+ * into stack_budget, each pushed child leaves its subtree stack_budget - (pushed - 1).
+ */
+uint32_t
+WideBVH::collapse( uint32_t binary_idx, uint32_t stack_budget ) {
+    const BVHNode& binary_node = m_binary_nodes[binary_idx];
+
+    std::vector<uint32_t> children;
+    if (binary_node.left_child == 0) {
+        children = { binary_idx };
+    } else {
+        children = { binary_node.left_child, binary_node.left_child + 1 };
+    }
+
+    auto pushed = [&](uint32_t child) {
+        const BVHNode& node = m_binary_nodes[child];
+        return node.left_child != 0 || node.tri_count > MAX_LEAF_TRIS;
+    };
+    auto fits = [&](const std::vector<uint32_t>& candidate) {
+        uint32_t n_pushed = 0, child_need = 0;
+        for (uint32_t child : candidate) {
+            if (!pushed(child)) continue;
+            n_pushed++;
+            child_need = std::max(child_need, stackNeed(child));
+        }
+        return n_pushed <= stack_budget && (n_pushed == 0 || child_need <= stack_budget - (n_pushed - 1));
+    };
+
+    while (children.size() < WIDTH) {
+        int largest = -1;
+        float largest_area = -1.f;
+        for (size_t i = 0; i < children.size(); i++) {
+            const BVHNode& child = m_binary_nodes[children[i]];
+            if (child.left_child != 0 && child.aabb.surfaceArea() > largest_area) {
+                largest = i;
+                largest_area = child.aabb.surfaceArea();
+            }
+        }
+        if (largest < 0) break;
+
+        std::vector<uint32_t> opened = children;
+        uint32_t left_child = m_binary_nodes[opened[largest]].left_child;
+        opened[largest] = left_child;
+        opened.insert(opened.begin() + largest + 1, left_child + 1);
+        if (!fits(opened)) {
+            m_stack_limited = true;
+            break;
+        }
+        children = std::move(opened);
+    }
+
+    uint32_t n_pushed = 0;
+    for (uint32_t child : children)
+        n_pushed += pushed(child);
+
+    uint32_t node_idx = m_nodes.size();
+    m_nodes.emplace_back();
+
+    std::vector<AABB> child_bounds;
+    uint32_t entries[WIDTH] = {};
+    for (size_t i = 0; i < children.size(); i++) {
+        const BVHNode& child = m_binary_nodes[children[i]];
+        child_bounds.push_back(child.aabb);
+        entries[i] = child.left_child == 0
+            ? emitLeaf(child.first_tri_index_id / 3, child.tri_count, child.aabb)
+            : collapse(children[i], stack_budget - (n_pushed - 1));
+    }
+
+    WideBVHNode& node = m_nodes[node_idx];
+    std::copy(entries, entries + WIDTH, node.children);
+    quantize(node, binary_node.aabb, child_bounds);
+
+    return node_idx;
+}
+
+/*
+ * Leaves are encoded in the child entry. The rare leaf with more triangles than fit into
+ * the count bits is split over a node of its own, whose children all use the leaf's bounds.
+ * Traversal visits all of them anyway, so leaves too large for one node continue in a chain
+ * through the last slot, which needs a single stack entry.
+ */
+uint32_t
+WideBVH::emitLeaf( uint32_t first_tri, uint32_t tri_count, const AABB& bounds ) {
+    if (tri_count == 0) return 0;
+    if (first_tri + tri_count - 1 > MAX_TRIANGLE_ID) {
+        ERR("Scene exceeds " + std::to_string(MAX_TRIANGLE_ID + 1) + " triangles, build with BVH_WIDTH=2");
+        return 0;
+    }
+    if (tri_count <= MAX_LEAF_TRIS)
+        return LEAF_FLAG | (tri_count << 26) | first_tri;
+
+    uint32_t node_idx = m_nodes.size();
+    m_nodes.emplace_back();
+
+    uint32_t entries[WIDTH] = {};
+    std::vector<AABB> child_bounds;
+    if (tri_count <= WIDTH * MAX_LEAF_TRIS) {
+        uint32_t chunk = (tri_count + WIDTH - 1) / WIDTH;
+        for (uint32_t i = 0; i < WIDTH && i * chunk < tri_count; i++) {
+            entries[i] = emitLeaf(first_tri + i * chunk, std::min(chunk, tri_count - i * chunk), bounds);
+            child_bounds.push_back(bounds);
+        }
+    } else {
+        for (uint32_t i = 0; i < WIDTH - 1; i++) {
+            entries[i] = emitLeaf(first_tri + i * MAX_LEAF_TRIS, MAX_LEAF_TRIS, bounds);
+            child_bounds.push_back(bounds);
+        }
+        uint32_t rest = (WIDTH - 1) * MAX_LEAF_TRIS;
+        entries[WIDTH - 1] = emitLeaf(first_tri + rest, tri_count - rest, bounds);
+        child_bounds.push_back(bounds);
+    }
+
+    WideBVHNode& node = m_nodes[node_idx];
+    std::copy(entries, entries + WIDTH, node.children);
+    quantize(node, bounds, child_bounds);
+    return node_idx;
+}
+
+/*
+ * Picks per-axis power of two scales so that 255 steps from the node's minimum cover the node,
+ * then rounds child bounds outwards onto that grid.
+ */
+void
+WideBVH::quantize( WideBVHNode& node, const AABB& bounds, const std::vector<AABB>& child_bounds ) {
+    node.origin = bounds.min;
+    node.exponents = 0;
+
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        float extent = bounds.max[axis] - bounds.min[axis];
+        int exponent = -126;
+        if (extent > 0.f)
+            std::frexp(extent / 255.f, &exponent);
+        exponent = std::clamp(exponent, -126, 127);
+        while (exponent < 127 && node.origin[axis] + 255.f * std::ldexp(1.f, exponent) < bounds.max[axis])
+            exponent++;
+        node.exponents |= (uint32_t)(exponent + 127) << (8 * axis);
+
+        float scale = std::ldexp(1.f, exponent);
+        for (uint32_t slot = 0; slot < WIDTH; slot++) {
+            uint8_t& lo = node.bounds[axis * WIDTH + slot];
+            uint8_t& hi = node.bounds[(3 + axis) * WIDTH + slot];
+            if (slot >= child_bounds.size()) {
+                lo = hi = 0;
+                continue;
+            }
+
+            const AABB& child = child_bounds[slot];
+            float q_lo = std::clamp(std::floor((child.min[axis] - node.origin[axis]) / scale), 0.f, 255.f);
+            float q_hi = std::clamp(std::ceil((child.max[axis] - node.origin[axis]) / scale), 0.f, 255.f);
+
+            // The subtraction above rounds, widen until the decoded bounds enclose the child
+            while (q_lo > 0.f && node.origin[axis] + q_lo * scale > child.min[axis]) q_lo--;
+            while (q_hi < 255.f && node.origin[axis] + q_hi * scale < child.max[axis]) q_hi++;
+
+            lo = (uint8_t)q_lo;
+            hi = (uint8_t)q_hi;
+        }
+    }
+}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "bvh.h"
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Branching factor of the BLAS, 2 keeps the binary BVH
+#ifndef BVH_WIDTH
+#define BVH_WIDTH 2
+#endif
+
+namespace fart {
+
+/*
+ * A node with up to BVH_WIDTH children whose bounds are quantized to 8 bits per axis.
+ * Child bounds decode as origin + q * 2^exponent, with the biased exponents of x, y and z
+ * in the lower three bytes of exponents. Bounds are stored as lo x, y, z followed by hi x, y, z,
+ * one byte per child. Matches WideBVHNode in types.glsl.
+ *
+ * Child entries are 0 for an empty slot, the node index for an inner child, or a leaf
+ * with LEAF_FLAG set, the triangle count in bits 26-30 and the first triangle in bits 0-25.
+ */
+template <uint32_t Width>
+struct alignas(16) WideBVHNodeT {
+    glm::vec3 origin;
+    uint32_t exponents;
+    uint8_t bounds[6 * Width];
+    uint32_t children[Width];
+};
+
+using WideBVHNode = WideBVHNodeT<BVH_WIDTH < 4 ? 4 : BVH_WIDTH>;
+
+#if BVH_WIDTH > 2
+using BLASNode = WideBVHNode;
+#else
+using BLASNode = BVHNode;
+#endif
+
+struct WideBVH {
+
+    public:
+        static constexpr uint32_t WIDTH = sizeof(WideBVHNode::children) / sizeof(uint32_t);
+        static constexpr uint32_t LEAF_FLAG = 1u << 31;
+        static constexpr uint32_t MAX_LEAF_TRIS = 31;
+        static constexpr uint32_t MAX_TRIANGLE_ID = (1u << 26) - 1;
+        // Entries of the traversal stacks. The inner children left pending along any path
+        // from the root never exceed it, collapsing opens fewer binary nodes where they would.
+        static constexpr uint32_t MAX_STACK = 64;
+
+        // Collapses a binary BVH, its leaves must reference the contiguous index array
+        WideBVH( BVH& bvh );
+
+        size_t getNodesUsed() { return m_nodes.size(); }
+        std::vector<WideBVHNode>& getNodes() { return m_nodes; }
+
+        static bool isLeaf( uint32_t child ) { return child & LEAF_FLAG; }
+        static uint32_t leafTriCount( uint32_t child ) { return (child >> 26) & 0x1f; }
+        static uint32_t leafFirstTriangle( uint32_t child ) { return child & MAX_TRIANGLE_ID; }
+
+        // Decodes the bounds of a child slot, always enclosing the original bounds
+        static AABB childBounds( const WideBVHNode& node, uint32_t slot );
+
+    private:
+        // stack_budget is the number of stack entries the subtree may use, at least stackNeed(binary_idx)
+        uint32_t collapse( uint32_t binary_idx, uint32_t stack_budget );
+        // Stack entries that suffice for the subtree without opening any binary node
+        uint32_t stackNeed( uint32_t binary_idx );
+        uint32_t emitLeaf( uint32_t first_tri, uint32_t tri_count, const AABB& bounds );
+        void quantize( WideBVHNode& node, const AABB& bounds, const std::vector<AABB>& child_bounds );
+
+        std::vector<BVHNode>& m_binary_nodes;
+        std::vector<WideBVHNode> m_nodes;
+        std::vector<uint32_t> m_stack_need;
+        // Set when the stack budget kept collapse() from filling a node
+        bool m_stack_limited { false };
+};
+
+}
@@ -0,0 +1,80 @@
+#include <cmath>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include "common/defs.h"
+#include "cpu/common/material.h"
+#include "opengl/ggx_albedo.h"
+
+using namespace fart;
+
+// Stratified uniform hemisphere samples per axis, the reference needs far more than the table
+static constexpr uint32_t STRATA = 512;
+// Largest accepted difference of scale or bias, covers the Hammersley noise of the table and its bilinear interpolation
+static constexpr float TOLERANCE = 0.02f;
+
+/*
+ * Integrates eval_ggx, which already includes cos_theta_i, over the hemisphere with
+ * uniformly distributed directions. f0 = 1 gives scale + bias, f0 = 0 only the bias.
+ */
+static glm::vec2
+referenceAlbedo(float roughness, float cos_theta) {
+    OpenPBRMaterial material;
+    material.specular_weight = 1.f;
+    material.specular_color = glm::vec3(1.f);
+    material.specular_roughness = roughness;
+
+    SurfaceInteraction si;
+    si.n = glm::vec3(0.f, 0.f, 1.f);
+    si.w_o = glm::vec3(std::sqrt(1.f - cos_theta * cos_theta), 0.f, cos_theta);
+    si.mat = &material;
+
+    double full = 0., bias = 0.;
+    for (uint32_t i = 0; i < STRATA; i++) {
+        // Uniform in cos_theta_i gives uniform solid angle
+        float cos_theta_i = (i + .5f) / STRATA;
+        float sin_theta_i = std::sqrt(1.f - cos_theta_i * cos_theta_i);
+        for (uint32_t j = 0; j < STRATA; j++) {
+            float phi = 2.f * PI * (j + .5f) / STRATA;
+            glm::vec3 w_i = glm::vec3(sin_theta_i * std::cos(phi), sin_theta_i * std::sin(phi), cos_theta_i);
+            full += eval_ggx(si, w_i, si.w_o, glm::vec3(1.f)).x;
+            bias += eval_ggx(si, w_i, si.w_o, glm::vec3(0.f)).x;
+        }
+    }
+    double weight = 2. * PI / ((double)STRATA * STRATA);
+    return glm::vec2((float)((full - bias) * weight), (float)(bias * weight));
+}
+
+int
+main() {
+    GGXAlbedoLUT lut;
+
+    // Very smooth lobes are too narrow for uniform sampling, grazing angles are clamped by the table
+    const float roughnesses[] = { .2f, .35f, .5f, .65f, .8f, 1.f };
+    const float cos_thetas[] = { .1f, .25f, .4f, .55f, .7f, .85f, 1.f };
+
+    uint32_t failures = 0;
+    float max_error = 0.f;
+    for (float roughness : roughnesses) {
+        for (float cos_theta : cos_thetas) {
+            glm::vec2 expected = referenceAlbedo(roughness, cos_theta);
+            glm::vec2 actual = lut.lookup(roughness, cos_theta);
+            float error = std::max(std::abs(expected.x - actual.x), std::abs(expected.y - actual.y));
+            max_error = std::max(max_error, error);
+            if (error > TOLERANCE) {
+                ERR("roughness " + std::to_string(roughness) + ", cos_theta " + std::to_string(cos_theta) 
+                    + ": table (" + std::to_string(actual.x) + ", " + std::to_string(actual.y) 
+                    + "), reference (" + std::to_string(expected.x) + ", " + std::to_string(expected.y) + ")");
+                failures++;
+            }
+        }
+    }
+
+    if (failures > 0) {
+        ERR(std::to_string(failures) + " GGX albedo lookups exceed the tolerance of " + std::to_string(TOLERANCE));
+        return 1;
+    }
+    SUCC("GGX albedo table matches the reference, largest difference " + std::to_string(max_error));
+    return 0;
+}
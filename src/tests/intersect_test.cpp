@@ -0,0 +1,296 @@
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "common/defs.h"
+#include "cpu/common/intersect.h"
+
+using namespace fart;
+
+static constexpr uint32_t RANDOM_TRIANGLES = 61;
+static constexpr uint32_t RANDOM_RAYS = 20000;
+static constexpr uint32_t RANDOM_NODES = 2000;
+
+static std::mt19937 g_rng(1234);
+
+static float
+uniform(float lo, float hi) {
+    return std::uniform_real_distribution<float>(lo, hi)(g_rng);
+}
+
+static Ray
+makeRay(glm::vec3 o, glm::vec3 d, float t) {
+    Ray ray;
+    ray.o = o;
+    ray.d = d;
+    ray.rD = 1.f / d;
+    ray.t = t;
+    return ray;
+}
+
+static Ray
+randomRay() {
+    glm::vec3 d;
+    do {
+        d = glm::vec3(uniform(-1.f, 1.f), uniform(-1.f, 1.f), uniform(-1.f, 1.f));
+    } while (glm::dot(d, d) < .01f);
+    // One in four rays stops early, so that the t test decides as well
+    float t = uniform(0.f, 1.f) < .25f ? uniform(.1f, 4.f) : 1e30f;
+    return makeRay(glm::vec3(uniform(-2.f, 2.f), uniform(-2.f, 2.f), uniform(-2.f, 2.f)), glm::normalize(d), t);
+}
+
+// Rays along +-x, +-y and +-z, which divide by zero in the slab tests
+static Ray
+axisRay(uint32_t axis, bool negative, glm::vec3 o, float t = 1e30f) {
+    glm::vec3 d(0.f);
+    d[axis] = negative ? -1.f : 1.f;
+    return makeRay(o, d, t);
+}
+
+static bool
+sameBits(float a, float b) {
+    return std::memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+/*
+ * A scene of one opaque material with random triangles, degenerate triangles and a triangle
+ * in the plane z = 1 whose hits are exact in floating point.
+ */
+struct TestScene {
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> triangle_materials;
+    std::vector<TrianglePositions> triangles;
+    OpenPBRMaterial material;
+    uint32_t material_flags { 0 };
+
+    TestScene() {
+        addTriangle({ -1.f, -1.f, 1.f }, { 1.f, -1.f, 1.f }, { -1.f, 1.f, 1.f });
+        // Zero area: a point, a line and two coincident vertices
+        addTriangle({ .1f, .2f, .3f }, { .1f, .2f, .3f }, { .1f, .2f, .3f });
+        addTriangle({ -1.f, 0.f, 0.f }, { 0.f, 0.f, 0.f }, { 1.f, 0.f, 0.f });
+        addTriangle({ 0.f, -1.f, .5f }, { 0.f, 1.f, .5f }, { 0.f, 1.f, .5f });
+        for (uint32_t i = 0; i < RANDOM_TRIANGLES; i++) {
+            glm::vec3 v0(uniform(-1.f, 1.f), uniform(-1.f, 1.f), uniform(-1.f, 1.f));
+            addTriangle(v0, v0 + glm::vec3(uniform(-.5f, .5f), uniform(-.5f, .5f), uniform(-.5f, .5f)),
+                        v0 + glm::vec3(uniform(-.5f, .5f), uniform(-.5f, .5f), uniform(-.5f, .5f)));
+        }
+        triangles = precomputeTriangles(indices, positions);
+    }
+
+    void addTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2) {
+        for (glm::vec3 v : { v0, v1, v2 }) {
+            indices.push_back((uint32_t)positions.size());
+            positions.push_back(v);
+        }
+        triangle_materials.push_back(0);
+    }
+
+    uint32_t triangleCount() const { return (uint32_t)triangle_materials.size(); }
+
+    SceneData data(bool precomputed) const {
+        SceneData scene {};
+        scene.positions = positions.data();
+        scene.indices = indices.data();
+        scene.triangle_materials = triangle_materials.data();
+        scene.triangles = precomputed ? triangles.data() : nullptr;
+        scene.materials = &material;
+        scene.material_flags = &material_flags;
+        return scene;
+    }
+};
+
+struct Failures {
+    uint32_t count { 0 };
+
+    void check(bool passed, const std::string& message) {
+        if (passed) return;
+        // Only the first few are worth reading
+        if (count < 10) ERR(message);
+        count++;
+    }
+};
+
+static std::string
+describe(const Ray& ray) {
+    auto str = [](glm::vec3 v) {
+        return "(" + std::to_string(v.x) + ", " + std::to_string(v.y) + ", " + std::to_string(v.z) + ")";
+    };
+    return "ray " + str(ray.o) + " -> " + str(ray.d) + ", t " + std::to_string(ray.t);
+}
+
+// intersectLeaf over count triangles must commit the same hit as intersectTriangle on each of them in turn
+static void
+checkLeaf(const SceneData& scene, const Ray& ray, uint32_t first_tri, uint32_t count, Failures& failures) {
+    Ray expected_ray = ray;
+    Hit expected;
+    for (uint32_t i = 0; i < count; i++)
+        intersectTriangle(scene, expected_ray, expected, 3 * (first_tri + i));
+
+    Ray actual_ray = ray;
+    Hit actual;
+    intersectLeaf(scene, actual_ray, actual, 3 * first_tri, count);
+
+    bool same = actual.valid == expected.valid && sameBits(actual_ray.t, expected_ray.t);
+    if (same && expected.valid) {
+        same = actual.first_index == expected.first_index &&
+               sameBits(actual.bary.x, expected.bary.x) && sameBits(actual.bary.y, expected.bary.y);
+    }
+    failures.check(same, "intersectLeaf over triangles " + std::to_string(first_tri) + " to "
+                         + std::to_string(first_tri + count - 1) + " differs from intersectTriangle for " + describe(ray));
+}
+
+static void
+testLeaves(const TestScene& test_scene, bool precomputed, Failures& failures) {
+    SceneData scene = test_scene.data(precomputed);
+    uint32_t n_triangles = test_scene.triangleCount();
+
+    // Leaves of every size up to a few batches, including partial batches
+    for (uint32_t r = 0; r < RANDOM_RAYS; r++) {
+        Ray ray = randomRay();
+        uint32_t count = 1 + r % WideBVH::MAX_LEAF_TRIS;
+        uint32_t first_tri = std::uniform_int_distribution<uint32_t>(0, n_triangles - count)(g_rng);
+        checkLeaf(scene, ray, first_tri, count, failures);
+    }
+
+    for (uint32_t r = 0; r < RANDOM_RAYS / 10; r++) {
+        glm::vec3 o(uniform(-2.f, 2.f), uniform(-2.f, 2.f), uniform(-2.f, 2.f));
+        Ray ray = axisRay(r % 3, r % 2, o);
+        uint32_t count = std::min(1 + r % WideBVH::MAX_LEAF_TRIS, n_triangles);
+        checkLeaf(scene, ray, 0, count, failures);
+        checkLeaf(scene, ray, n_triangles - count, count, failures);
+    }
+
+    // The plane triangle is hit at exactly t = 1, the degenerate ones are never hit
+    const glm::vec3 o(-.5f, -.5f, 0.f);
+    for (uint32_t count : { 1u, 4u, 9u }) {
+        Ray ray = axisRay(2, false, o, 1.f);
+        Hit hit;
+        intersectLeaf(scene, ray, hit, 0, count);
+        failures.check(!hit.valid, "Hit at t_max = 1 was not rejected over " + std::to_string(count) + " triangles");
+        checkLeaf(scene, axisRay(2, false, o, 1.f), 0, count, failures);
+
+        ray = axisRay(2, false, o, std::nextafter(1.f, 2.f));
+        hit = Hit();
+        intersectLeaf(scene, ray, hit, 0, count);
+        failures.check(hit.valid && hit.first_index == 0 && ray.t == 1.f,
+                       "Hit just inside t_max was missed over " + std::to_string(count) + " triangles");
+        checkLeaf(scene, axisRay(2, false, o, std::nextafter(1.f, 2.f)), 0, count, failures);
+
+        // Starting on the plane triangle gives t = 0, which is not a hit
+        checkLeaf(scene, axisRay(2, false, glm::vec3(o.x, o.y, 1.f)), 0, count, failures);
+        checkLeaf(scene, axisRay(2, true, glm::vec3(o.x, o.y, 1.f)), 0, count, failures);
+
+        // Parallel to the plane triangle, through the degenerate ones
+        for (uint32_t axis = 0; axis < 2; axis++) {
+            glm::vec3 o_parallel(0.f, 0.f, 1.f);
+            o_parallel[axis] = -2.f;
+            checkLeaf(scene, axisRay(axis, false, o_parallel), 0, count, failures);
+            checkLeaf(scene, axisRay(axis, false, glm::vec3(-2.f, 0.f, 0.f)), 0, count, failures);
+        }
+    }
+    for (uint32_t tri = 1; tri < 4; tri++) {
+        for (uint32_t r = 0; r < 100; r++) {
+            Ray ray = r % 2 ? randomRay() : axisRay(r % 3, r % 4 == 0, glm::vec3(uniform(-2.f, 2.f), 0.f, .5f));
+            ray.t = 1e30f;
+            Hit hit;
+            intersectLeaf(scene, ray, hit, 3 * tri, 1);
+            failures.check(!hit.valid, "Degenerate triangle " + std::to_string(tri) + " was hit by " + describe(ray));
+        }
+    }
+}
+
+static WideBVHNode
+randomNode() {
+    constexpr uint32_t width = WideBVH::WIDTH;
+    WideBVHNode node;
+    node.origin = glm::vec3(uniform(-1.f, 0.f), uniform(-1.f, 0.f), uniform(-1.f, 0.f));
+    node.exponents = 0;
+    for (uint32_t axis = 0; axis < 3; axis++)
+        node.exponents |= (uint32_t)std::uniform_int_distribution<int>(118, 122)(g_rng) << (8 * axis);
+
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (uint32_t i = 0; i < width; i++) {
+        // One slot in four is empty
+        node.children[i] = byte(g_rng) < 64 ? 0 : i + 1;
+        for (uint32_t axis = 0; axis < 3; axis++) {
+            uint8_t a = (uint8_t)byte(g_rng), b = (uint8_t)byte(g_rng);
+            node.bounds[axis * width + i] = std::min(a, b);
+            node.bounds[(3 + axis) * width + i] = std::max(a, b);
+        }
+    }
+    return node;
+}
+
+// intersectChildren must give every slot the distance intersectAABB gives its decoded bounds
+static void
+checkChildren(const WideBVHNode& node, const Ray& ray, Failures& failures) {
+    alignas(32) float child_dist[WideBVH::WIDTH];
+    intersectChildren(node, ray, child_dist);
+
+    for (uint32_t i = 0; i < WideBVH::WIDTH; i++) {
+        AABB bounds = WideBVH::childBounds(node, i);
+        float expected = node.children[i] == 0 ? 1e30f : intersectAABB(ray, bounds.min, bounds.max);
+        failures.check(sameBits(child_dist[i], expected), "intersectChildren gives slot " + std::to_string(i) + " "
+                       + std::to_string(child_dist[i]) + " instead of " + std::to_string(expected) + " for " + describe(ray));
+    }
+}
+
+static void
+testChildren(Failures& failures) {
+    for (uint32_t n = 0; n < RANDOM_NODES; n++) {
+        WideBVHNode node = randomNode();
+        for (uint32_t r = 0; r < 10; r++)
+            checkChildren(node, randomRay(), failures);
+
+        // Axis parallel rays starting on a slab plane multiply 0 by infinity
+        for (uint32_t axis = 0; axis < 3; axis++) {
+            AABB bounds = WideBVH::childBounds(node, n % WideBVH::WIDTH);
+            glm::vec3 o = bounds.min;
+            o[axis] = uniform(-2.f, 2.f);
+            checkChildren(node, axisRay(axis, false, o), failures);
+            checkChildren(node, axisRay(axis, true, o), failures);
+            o = bounds.max;
+            o[axis] = uniform(-2.f, 2.f);
+            checkChildren(node, axisRay(axis, n % 2, o), failures);
+        }
+
+        // Leaving a box right at the origin gives tmax = 0, which is a miss
+        for (uint32_t axis = 0; axis < 3; axis++) {
+            AABB bounds = WideBVH::childBounds(node, n % WideBVH::WIDTH);
+            glm::vec3 o = (bounds.min + bounds.max) * .5f;
+            o[axis] = bounds.max[axis];
+            checkChildren(node, axisRay(axis, false, o), failures);
+            o[axis] = bounds.min[axis];
+            checkChildren(node, axisRay(axis, true, o), failures);
+        }
+
+        // Ending exactly at the entry of a box still counts as a miss
+        AABB bounds = WideBVH::childBounds(node, 0);
+        glm::vec3 o = glm::vec3(bounds.min.x - 1.f, (bounds.min.y + bounds.max.y) * .5f, (bounds.min.z + bounds.max.z) * .5f);
+        Ray ray = axisRay(0, false, o);
+        ray.t = intersectAABB(ray, bounds.min, bounds.max);
+        checkChildren(node, ray, failures);
+    }
+}
+
+int
+main() {
+    TestScene test_scene;
+
+    Failures failures;
+    testLeaves(test_scene, false, failures);
+    testLeaves(test_scene, true, failures);
+    testChildren(failures);
+
+    if (failures.count > 0) {
+        ERR(std::to_string(failures.count) + " intersection checks failed");
+        return 1;
+    }
+    SUCC("intersectLeaf and intersectChildren match the scalar tests");
+    return 0;
+}